@@ -0,0 +1,120 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <kage/Backend.hpp>
+#include "record/RecordLog.hpp"
+#include "record/RecordReplay.hpp"
+#include "Serialization.hpp"
+
+#include <thallium.hpp>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <getopt.h>
+
+namespace tl = thallium;
+using json = nlohmann::json;
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " -f <capture log> [-s <speedup>]\n"
+              << "         (-b <backend.json> | -a <address> -p <provider id> -r <rpc name>...)\n"
+              << "         [-n <protocol>] [-v <log level>]\n\n"
+              << "  -f  capture log written by a \"record\" stage\n"
+              << "  -s  replay rate relative to the original traffic (default 1.0)\n"
+              << "  -b  JSON file with a {\"type\", \"config\"} backend to replay against\n"
+              << "  -a  address of a target provider to replay against\n"
+              << "  -p  provider id of the target provider\n"
+              << "  -r  name of a recorded RPC (repeat for each RPC)\n"
+              << "  -n  protocol used to initialize the local engine (default na+sm)\n"
+              << "  -v  logging level (default info)\n";
+}
+
+int main(int argc, char** argv) {
+    std::string log_file, backend_file, address, protocol = "na+sm", log_level = "info";
+    std::vector<std::string> rpc_names;
+    int    provider_id = -1;
+    double speedup = 1.0;
+
+    int opt;
+    while((opt = getopt(argc, argv, "f:s:b:a:p:r:n:v:h")) != -1) {
+        switch(opt) {
+            case 'f': log_file = optarg; break;
+            case 's': speedup = std::stod(optarg); break;
+            case 'b': backend_file = optarg; break;
+            case 'a': address = optarg; break;
+            case 'p': provider_id = std::stoi(optarg); break;
+            case 'r': rpc_names.push_back(optarg); break;
+            case 'n': protocol = optarg; break;
+            case 'v': log_level = optarg; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : -1;
+        }
+    }
+    if(log_file.empty() || speedup <= 0.0
+    || (backend_file.empty() && (address.empty() || provider_id < 0 || rpc_names.empty()))) {
+        usage(argv[0]);
+        return -1;
+    }
+    spdlog::set_level(spdlog::level::from_str(log_level));
+
+    try {
+        kage::RecordLogReader log{log_file};
+        tl::engine engine{protocol, THALLIUM_CLIENT_MODE};
+
+        // Either replay through a backend, or directly against a target provider
+        std::unique_ptr<kage::Backend> backend;
+        std::unordered_map<hg_id_t, tl::remote_procedure> rpcs;
+        tl::provider_handle target;
+        if(!backend_file.empty()) {
+            std::ifstream backend_stream{backend_file};
+            auto backend_config = json::parse(backend_stream);
+            backend = kage::ProxyFactory::createProxy(
+                backend_config, engine, engine.get_handler_pool());
+        } else {
+            for(auto& name : rpc_names) {
+                auto rpc = engine.define(name);
+                rpcs.emplace(rpc.id(), std::move(rpc));
+            }
+            target = tl::provider_handle{engine.lookup(address), static_cast<uint16_t>(provider_id)};
+        }
+
+        auto send = [&](const kage::RecordHeader& record) {
+            if(backend) {
+                kage::RequestContext context;
+                auto result = backend->forwardOutput(
+                    record.rpc_id, record.input(), record.input_size,
+                    [](const char*, size_t) {}, context);
+                if(!result.success())
+                    spdlog::debug("Replayed request failed: {}", result.error());
+                return result.success();
+            }
+            auto it = rpcs.find(record.rpc_id);
+            if(it == rpcs.end()) {
+                spdlog::debug("Skipping request for unknown RPC id {}", record.rpc_id);
+                return false;
+            }
+            kage::Serializer serializer{record.input(), record.input_size};
+            it->second.on(target)(serializer);
+            return true;
+        };
+
+        // Issue each request at its original time offset divided by the speedup
+        auto report = kage::ReplayLog(engine, log, speedup, send);
+        std::cout << report.dump(4) << std::endl;
+
+        if(backend) backend->destroy();
+        backend.reset();
+        rpcs.clear();
+        target = tl::provider_handle{};
+        engine.finalize();
+    } catch(const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
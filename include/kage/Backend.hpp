@@ -7,9 +7,13 @@
 #define __KAGE_BACKEND_HPP
 
 #include <kage/Result.hpp>
+#include <kage/Callback.hpp>
+#include <kage/RequestContext.hpp>
 #include <kage/InputProxy.hpp>
 #include <unordered_set>
 #include <unordered_map>
+#include <memory>
+#include <vector>
 #include <functional>
 #include <nlohmann/json.hpp>
 #include <thallium.hpp>
@@ -83,6 +87,39 @@ class Backend {
      */
     virtual std::string getConfig() const = 0;
 
+    /**
+     * @brief Returns a JSON-formatted string of statistics
+     * collected by the backend (empty object by default).
+     */
+    virtual std::string getStatistics() const {
+        return "{}";
+    }
+
+    /**
+     * @brief Sends a heartbeat to the remote side of the backend's
+     * link and waits at most timeout_ns for it to come back.
+     *
+     * @return a Result holding the round-trip time in nanoseconds, or an
+     * error if the remote did not answer in time. Backends without a
+     * remote side are always reachable, with a round-trip time of 0.
+     */
+    virtual Result<uint64_t> ping(uint64_t timeout_ns) {
+        (void)timeout_ns;
+        Result<uint64_t> result;
+        result.value() = 0;
+        return result;
+    }
+
+    /**
+     * @brief Waits for the backend's link to be usable, for at most
+     * timeout_ns. By default, sends heartbeats (see ping) until one
+     * comes back, which also covers messages lost while the remote
+     * is still connecting.
+     *
+     * @return a Result indicating whether the backend is ready.
+     */
+    virtual Result<bool> waitReady(uint64_t timeout_ns);
+
     /**
      * @brief Forward the input data to the backend and
      * call output_cb on the obtained output data.
@@ -91,11 +128,13 @@ class Backend {
      * @param data Data to forward.
      * @param data_size Size of the data.
      * @param output_cb Callback to invoke on the output.
+     * @param context State of the request (see RequestContext).
      *
      * @return a Result containing the result of the operation.
      */
     virtual Result<bool> forwardOutput(hg_id_t rpc_id, const char* data, size_t data_size,
-                                       const std::function<void(const char*, size_t)>& output_cb) = 0;
+                                       OutputCallback output_cb,
+                                       RequestContext& context) = 0;
 
     /**
      * @brief Set the InputProxy to which to redirect input RPCs.
@@ -110,6 +149,16 @@ class Backend {
      */
     virtual Result<bool> destroy() = 0;
 
+    protected:
+
+    /**
+     * @brief Waits for all the given backends to be ready, for at most
+     * timeout_ns in total. Backends connect in the background, so this
+     * takes as long as the slowest of them rather than the sum.
+     */
+    static Result<bool> WaitAllReady(
+        const std::vector<std::shared_ptr<Backend>>& backends, uint64_t timeout_ns);
+
 };
 
 /**
@@ -141,6 +190,21 @@ class ProxyFactory {
                                                 const json& config,
                                                 const thallium::pool& pool);
 
+    /**
+     * @brief Creates a proxy from a {"type": ..., "config": ...} object,
+     * such as the "proxy" field of a provider configuration. This is used
+     * by backends that are composed of other backends.
+     *
+     * @param spec JSON object with a "type" and an optional "config".
+     * @param engine Thallium engine.
+     * @param pool Optional pool in which to submit work.
+     *
+     * @return a unique_ptr to the created Proxy (throws if the type is unknown).
+     */
+    static std::unique_ptr<Backend> createProxy(const json& spec,
+                                                const thallium::engine& engine,
+                                                const thallium::pool& pool);
+
     private:
 
     static std::unordered_map<std::string,
@@ -0,0 +1,83 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_CALLBACK_HPP
+#define __KAGE_CALLBACK_HPP
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace kage {
+
+template<typename Signature>
+class FunctionRef;
+
+/**
+ * @brief Non-owning reference to a callable, in the spirit of
+ * C++26's std::function_ref. A FunctionRef is two pointers wide, never
+ * allocates, and calling it costs a single indirect call.
+ *
+ * Since it does not own the callable, a FunctionRef must not outlive it.
+ * Passing a lambda directly as a FunctionRef argument is always safe,
+ * but a FunctionRef must not be stored beyond the call it was passed to,
+ * nor be initialized from a temporary outside of a function call.
+ */
+template<typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+
+    void* m_callable;
+    R (*m_invoke)(void*, Args...);
+
+    public:
+
+    /**
+     * @brief Constructor from any callable with a compatible signature.
+     */
+    template<typename F,
+             typename = std::enable_if_t<
+                !std::is_same_v<std::decay_t<F>, FunctionRef>
+                && std::is_invocable_r_v<R, F&, Args...>>>
+    FunctionRef(F&& f) noexcept
+    : m_callable{const_cast<void*>(static_cast<const void*>(std::addressof(f)))}
+    , m_invoke{[](void* callable, Args... args) -> R {
+        return (*static_cast<std::remove_reference_t<F>*>(callable))(
+            std::forward<Args>(args)...);
+    }} {}
+
+    /**
+     * @brief Copy-constructor.
+     */
+    FunctionRef(const FunctionRef&) noexcept = default;
+
+    /**
+     * @brief Copy-assignment operator.
+     */
+    FunctionRef& operator=(const FunctionRef&) noexcept = default;
+
+    /**
+     * @brief Invokes the referenced callable.
+     */
+    R operator()(Args... args) const {
+        return m_invoke(m_callable, std::forward<Args>(args)...);
+    }
+};
+
+/**
+ * @brief Type of the callbacks through which backends and providers
+ * hand the output of an RPC back to their caller.
+ *
+ * This used to be a const std::function<void(const char*, size_t)>&.
+ * Callers passing lambdas or std::function objects are not affected.
+ * Backends overriding forwardOutput (or Middleware::forwardInput) need to
+ * replace that parameter type with kage::OutputCallback, passed by value,
+ * and must not keep it after returning.
+ */
+using OutputCallback = FunctionRef<void(const char*, size_t)>;
+
+}
+
+#endif
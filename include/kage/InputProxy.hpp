@@ -7,6 +7,8 @@
 #define __KAGE_INPUT_PROXY_HPP
 
 #include <kage/Result.hpp>
+#include <kage/Callback.hpp>
+#include <kage/RequestContext.hpp>
 #include <thallium.hpp>
 #include <memory>
 
@@ -16,6 +18,7 @@ namespace tl = thallium;
 
 class Provider;
 class ProviderImpl;
+class Middleware;
 
 /**
  * @brief An InputProxy is an object holding a reference to
@@ -31,6 +34,13 @@ class InputProxy {
      */
     InputProxy() = default;
 
+    /**
+     * @brief Constructor redirecting input RPCs to a Middleware stage
+     * instead of a Provider. This is used by the "chain" backend so that
+     * each stage sees the input RPCs coming out of the stage it wraps.
+     */
+    InputProxy(std::shared_ptr<Middleware> stage);
+
     /**
      * @brief Copy-constructor is deleted.
      */
@@ -69,17 +79,20 @@ class InputProxy {
      * @param data Data to forward.
      * @param data_size Size of the data.
      * @param output_cb Callback to invoke on the output.
+     * @param context State of the request (see RequestContext).
      *
      * @return a Result containing the result of the operation.
      */
     Result<bool> forwardInput(hg_id_t rpc_id, const char* data, size_t data_size,
-                              const std::function<void(const char*, size_t)>& output_cb);
+                              OutputCallback output_cb,
+                              RequestContext& context);
 
     private:
 
     friend class Provider;
 
     std::weak_ptr<ProviderImpl> self;
+    std::weak_ptr<Middleware>   stage;
 
     InputProxy(std::shared_ptr<ProviderImpl> impl);
 };
@@ -0,0 +1,98 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_MIDDLEWARE_HPP
+#define __KAGE_MIDDLEWARE_HPP
+
+#include <kage/Backend.hpp>
+#include <memory>
+
+namespace kage {
+
+/**
+ * @brief A Middleware is a Backend that does not talk to a remote
+ * itself but wraps the next Backend of a "chain" backend (e.g. a cache,
+ * a compression stage, or a batching stage in front of a zmq backend).
+ *
+ * Output RPCs enter the stage through forwardOutput, which by default calls
+ * the next backend's forwardOutput. Input RPCs coming out of the next backend
+ * enter the stage through forwardInput, which by default calls the InputProxy
+ * set by setInputProxy. The output callback is a non-owning reference passed
+ * down as is, so a stage that does not override these functions only adds
+ * a virtual call.
+ *
+ * Middleware types are registered with KAGE_REGISTER_BACKEND like any
+ * other Backend and can only appear before the last stage of a chain.
+ */
+class Middleware : public Backend {
+
+    public:
+
+    /**
+     * @brief Set the Backend that this stage wraps.
+     */
+    void setNext(std::shared_ptr<Backend> next) {
+        m_next = std::move(next);
+    }
+
+    /**
+     * @brief Return the Backend that this stage wraps.
+     */
+    const std::shared_ptr<Backend>& next() const {
+        return m_next;
+    }
+
+    /**
+     * @see Backend::forwardOutput
+     */
+    Result<bool> forwardOutput(hg_id_t rpc_id, const char* data, size_t data_size,
+                               OutputCallback output_cb,
+                               RequestContext& context) override {
+        if(!m_next)
+            return Result<bool>{ErrorCode::Unavailable, "Middleware stage has no next backend"};
+        return m_next->forwardOutput(rpc_id, data, data_size, output_cb, context);
+    }
+
+    /**
+     * @brief Forward an input RPC received by the next backend
+     * towards the Provider (or towards the previous stage).
+     *
+     * @param rpc_id ID of the RPC to forward.
+     * @param data Data to forward.
+     * @param data_size Size of the data.
+     * @param output_cb Callback to invoke on the output.
+     * @param context State of the request (see RequestContext).
+     *
+     * @return a Result containing the result of the operation.
+     */
+    virtual Result<bool> forwardInput(hg_id_t rpc_id, const char* data, size_t data_size,
+                                      OutputCallback output_cb,
+                                      RequestContext& context) {
+        return m_input_proxy.forwardInput(rpc_id, data, data_size, output_cb, context);
+    }
+
+    /**
+     * @see Backend::setInputProxy
+     */
+    void setInputProxy(InputProxy proxy) override {
+        m_input_proxy = std::move(proxy);
+    }
+
+    /**
+     * @see Backend::destroy
+     */
+    Result<bool> destroy() override {
+        return Result<bool>{};
+    }
+
+    protected:
+
+    std::shared_ptr<Backend> m_next;
+    InputProxy               m_input_proxy;
+};
+
+}
+
+#endif
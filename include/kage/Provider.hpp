@@ -7,8 +7,14 @@
 #define __KAGE_PROVIDER_HPP
 
 #include <kage/Result.hpp>
+#include <kage/Callback.hpp>
+#include <kage/RequestContext.hpp>
 #include <thallium.hpp>
+#include <chrono>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace kage {
 
@@ -31,9 +37,14 @@ class Provider {
      * @param provider_id Provider id.
      * @param identity Identity this provider pretends to be.
      * @param config JSON-formatted configuration.
-     * @param target Target of input RPCs, if input provider.
+     * @param target Target of input RPCs, if input provider
+     * (exported RPCs may also have their own "target").
      * @param rpc_pool Argobots pool to use to handle RPCs.
      * @param proxy_pool Argobots pool to pass to the proxy.
+     * @param pools Named pools that exported RPCs can refer to
+     * with their "pool" field, to get their own handler and dispatch pool.
+     * On the input side, the ULT that received the request still waits
+     * for the call to the target dispatched to that pool.
      */
     Provider(const tl::engine& engine,
              uint16_t provider_id,
@@ -41,7 +52,34 @@ class Provider {
              const std::string& config,
              const tl::provider_handle& target = tl::provider_handle{},
              const tl::pool& rpc_pool = tl::pool(),
-             const tl::pool& proxy_pool = tl::pool());
+             const tl::pool& proxy_pool = tl::pool(),
+             const std::unordered_map<std::string, tl::pool>& pools = {});
+
+    /**
+     * @brief Constructor for an input provider that spreads its requests
+     * across several replicas of the target provider, following the
+     * "routing" field of the "input" configuration.
+     *
+     * @param engine Thallium engine to use to receive RPCs.
+     * @param provider_id Provider id.
+     * @param identity Identity this provider pretends to be.
+     * @param config JSON-formatted configuration.
+     * @param targets Targets of input RPCs.
+     * @param rpc_pool Argobots pool to use to handle RPCs.
+     * @param proxy_pool Argobots pool to pass to the proxy.
+     * @param pools Named pools that exported RPCs can refer to
+     * with their "pool" field, to get their own handler and dispatch pool.
+     * On the input side, the ULT that received the request still waits
+     * for the call to the target dispatched to that pool.
+     */
+    Provider(const tl::engine& engine,
+             uint16_t provider_id,
+             const char* identity,
+             const std::string& config,
+             const std::vector<tl::provider_handle>& targets,
+             const tl::pool& rpc_pool = tl::pool(),
+             const tl::pool& proxy_pool = tl::pool(),
+             const std::unordered_map<std::string, tl::pool>& pools = {});
 
     /**
      * @brief Copy-constructor is deleted.
@@ -75,6 +113,24 @@ class Provider {
      */
     std::string getConfig() const;
 
+    /**
+     * @brief Return a JSON-formatted string with the statistics
+     * collected by the provider (admission control, queueing, etc.).
+     *
+     * @return JSON formatted string.
+     */
+    std::string getStatistics() const;
+
+    /**
+     * @brief Wait for the provider's backend to be able to carry
+     * requests (e.g. for the remote side of its link to answer).
+     *
+     * @param timeout Maximum time to wait.
+     *
+     * @return a Result indicating whether the backend is ready.
+     */
+    Result<bool> waitReady(std::chrono::milliseconds timeout) const;
+
     /**
      * @brief Checks whether the Provider instance is valid.
      */
@@ -90,11 +146,13 @@ class Provider {
      * @param data Data to forward.
      * @param data_size Size of the data.
      * @param output_cb Callback to invoke on the output.
+     * @param context State of the request (see RequestContext).
      *
      * @return a Result containing the result of the operation.
      */
     Result<bool> forwardInput(hg_id_t rpc_id, const char* data, size_t data_size,
-                              const std::function<void(const char*, size_t)>& output_cb);
+                              OutputCallback output_cb,
+                              RequestContext& context);
 
     private:
 
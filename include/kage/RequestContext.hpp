@@ -0,0 +1,141 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_REQUEST_CONTEXT_HPP
+#define __KAGE_REQUEST_CONTEXT_HPP
+
+#include <chrono>
+#include <cstdint>
+
+namespace kage {
+
+/**
+ * @brief Per-request state that travels with a forwarded RPC, from the
+ * Provider through the Backend, and across the link to the remote kage
+ * provider inside the backend's own message headers.
+ *
+ * When instrumented is true, the Provider and the Backend take a timestamp
+ * at each Stage of the request they go through. Timestamps are only
+ * comparable within a process: the input side sends back the durations
+ * it measured (remote_*_ns) rather than its own timestamps.
+ *
+ * When trace_id is non-zero, the request is traced (see the provider's
+ * "tracing" configuration). On the output side, span_id is the id of the
+ * span under which the request crosses the link; on the input side, it is
+ * that same id as received from the remote, i.e., the parent of the spans
+ * emitted on this side.
+ *
+ * When one_way is true, the output side does not wait for the output of
+ * the request, and the input side does not send it back: backends that
+ * support it return as soon as the request is sent.
+ *
+ * deadline_ns is the monotonic time after which the client no longer
+ * waits for the request (0 if it has none). Backends send the remaining
+ * budget rather than the deadline itself, and the receiving side turns it
+ * back into a local deadline, so the one-way latency of the link is not
+ * deducted from it.
+ */
+struct RequestContext {
+
+    /**
+     * @brief Stages of a forwarded request. The first four are reached
+     * on the output side, the other four on the input side.
+     */
+    enum Stage : uint8_t {
+        HandlerStart = 0, /* Mercury handler of the exported RPC starts */
+        BackendSend,      /* backend sends the request to the remote */
+        ResponseReceived, /* backend receives the response */
+        Responded,        /* req.respond() has returned */
+        RemoteReceived,   /* remote backend receives the request */
+        TargetStart,      /* remote provider calls the target */
+        TargetEnd,        /* target's response arrives */
+        ResponseSend,     /* remote backend sends the response back */
+        NumStages
+    };
+
+    bool     instrumented = false;
+    bool     one_way      = false;
+    uint64_t timestamps[NumStages] = {};
+
+    uint64_t remote_queue_ns    = 0; /* RemoteReceived -> TargetStart */
+    uint64_t remote_target_ns   = 0; /* TargetStart -> TargetEnd */
+    uint64_t remote_response_ns = 0; /* TargetEnd -> ResponseSend */
+
+    uint64_t trace_id = 0;
+    uint64_t span_id  = 0;
+
+    uint64_t deadline_ns = 0;
+
+    /**
+     * @brief Monotonic time in nanoseconds.
+     */
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @brief Whether the request has a deadline that has passed.
+     */
+    bool expired() const {
+        return deadline_ns != 0 && now() >= deadline_ns;
+    }
+
+    /**
+     * @brief Nanoseconds left before the deadline, to send over the link:
+     * 0 if the request has no deadline, at least 1 if it has expired.
+     */
+    uint64_t remainingBudget() const {
+        if(deadline_ns == 0) return 0;
+        auto t = now();
+        return deadline_ns > t ? deadline_ns - t : 1;
+    }
+
+    /**
+     * @brief Sets the deadline from a budget received with remainingBudget().
+     */
+    void setBudget(uint64_t budget_ns) {
+        deadline_ns = budget_ns ? now() + budget_ns : 0;
+    }
+
+    /**
+     * @brief Records the current time for the given stage,
+     * if the request is instrumented.
+     */
+    void stamp(Stage stage) {
+        if(instrumented) timestamps[stage] = now();
+    }
+
+    /**
+     * @brief Whether both stages were reached.
+     */
+    bool reached(Stage from, Stage to) const {
+        return timestamps[from] != 0 && timestamps[to] >= timestamps[from];
+    }
+
+    /**
+     * @brief Nanoseconds between two stages, which must both be reached.
+     */
+    uint64_t elapsed(Stage from, Stage to) const {
+        return timestamps[to] - timestamps[from];
+    }
+
+    /**
+     * @brief Fills the remote_*_ns durations from the input-side
+     * timestamps, before they are sent back to the output side.
+     */
+    void computeRemoteDurations() {
+        if(reached(RemoteReceived, TargetStart))
+            remote_queue_ns = elapsed(RemoteReceived, TargetStart);
+        if(reached(TargetStart, TargetEnd))
+            remote_target_ns = elapsed(TargetStart, TargetEnd);
+        if(reached(TargetEnd, ResponseSend))
+            remote_response_ns = elapsed(TargetEnd, ResponseSend);
+    }
+};
+
+}
+
+#endif
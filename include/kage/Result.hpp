@@ -7,7 +7,10 @@
 #define __KAGE_RESULT_HPP
 
 #include <kage/Exception.hpp>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 
 namespace kage {
 
@@ -222,16 +225,67 @@ class Result<std::string> {
     std::string m_content = "";
 };
 
+/**
+ * @brief Category of the error held by a failed Result<bool>.
+ */
+enum class ErrorCode : uint8_t {
+    Success = 0,
+    Unknown,      /* error only described by its message */
+    Unavailable,  /* nothing to forward the request to */
+    InvalidRPC,   /* RPC not exported by the provider */
+    Rejected,     /* request rejected by admission control */
+    Transport,    /* failure communicating with a remote process */
+    Timeout       /* request deadline expired */
+};
+
+/**
+ * @brief Result<bool> is returned on every forwarded RPC, so it is laid
+ * out to keep the success path away from the allocator: it holds an
+ * ErrorCode and, for errors, either a pointer to a static message
+ * (see the Result(ErrorCode, const char*) constructor, which does
+ * not allocate either) or a heap-allocated string, created only when
+ * the non-const error() is first accessed. Copying a successful Result
+ * copies two bytes and two pointers, and moving it never allocates.
+ *
+ * Owning that string makes the type nothrow-movable but not trivially
+ * movable: interning arbitrary messages instead would grow without bound.
+ * The const error() returns a view of the message without allocating or
+ * modifying the Result, so a Result can be read concurrently. Unlike the
+ * other Result types, it returns a std::string_view rather than a
+ * const std::string&.
+ */
 template<>
 class Result<bool> {
 
     public:
 
     Result() = default;
-    Result(Result&&) = default;
-    Result(const Result&) = default;
-    Result& operator=(Result&&) = default;
-    Result& operator=(const Result&) = default;
+    Result(Result&&) noexcept = default;
+    Result& operator=(Result&&) noexcept = default;
+
+    Result(const Result& other)
+    : m_success{other.m_success}
+    , m_code{other.m_code}
+    , m_static_error{other.m_static_error}
+    , m_error{other.m_error ? std::make_unique<std::string>(*other.m_error) : nullptr} {}
+
+    Result& operator=(const Result& other) {
+        if(this == &other) return *this;
+        m_success      = other.m_success;
+        m_code         = other.m_code;
+        m_static_error = other.m_static_error;
+        m_error        = other.m_error ? std::make_unique<std::string>(*other.m_error) : nullptr;
+        return *this;
+    }
+
+    /**
+     * @brief Constructs a failed Result. The message must be a
+     * string with static storage duration (e.g. a literal).
+     */
+    Result(ErrorCode code, const char* static_message) noexcept
+    : m_success{code == ErrorCode::Success}
+    , m_code{code}
+    , m_static_error{static_message} {}
 
     bool& success() {
         return m_success;
@@ -241,12 +295,27 @@ class Result<bool> {
         return m_success;
     }
 
+    /**
+     * @brief Category of the error, ErrorCode::Unknown if the
+     * Result was failed by only setting success() and error().
+     */
+    ErrorCode code() const {
+        if(m_success) return ErrorCode::Success;
+        return m_code == ErrorCode::Success ? ErrorCode::Unknown : m_code;
+    }
+
     std::string& error() {
-        return m_error;
+        if(!m_error) {
+            m_error = m_static_error ? std::make_unique<std::string>(m_static_error)
+                                     : std::make_unique<std::string>();
+        }
+        return *m_error;
     }
 
-    const std::string& error() const {
-        return m_error;
+    std::string_view error() const {
+        if(m_error) return *m_error;
+        if(m_static_error) return m_static_error;
+        return {};
     }
 
     bool& value() {
@@ -270,20 +339,22 @@ class Result<bool> {
 
     void check() const {
         if(!m_success)
-            throw Exception(m_error);
+            throw Exception(error());
     }
 
     template<typename Archive>
     void serialize(Archive& a) {
         a & m_success;
         if(!m_success)
-            a & m_error;
+            a & error();
     }
 
     private:
 
-    bool        m_success = true;
-    std::string m_error   = "";
+    bool                         m_success      = true;
+    ErrorCode                    m_code         = ErrorCode::Success;
+    const char*                  m_static_error = nullptr;
+    std::unique_ptr<std::string> m_error;
 };
 
 }
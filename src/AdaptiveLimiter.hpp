@@ -0,0 +1,205 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_ADAPTIVE_LIMITER_HPP
+#define __KAGE_ADAPTIVE_LIMITER_HPP
+
+#include <thallium.hpp>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <cstdint>
+
+namespace kage {
+
+namespace tl = thallium;
+
+/**
+ * @brief Bounds the number of requests in flight towards the backend
+ * with a limit that follows the observed round-trip time, in the manner
+ * of Netflix's concurrency-limits. Requests above the limit are rejected
+ * right away rather than queued.
+ *
+ * - aimd adds 1 to the limit after a successful request that kept the
+ *   limit at least half used, and multiplies it by backoff_ratio after a
+ *   failed request or one whose RTT exceeds tolerance * min RTT.
+ * - gradient moves the limit towards limit * min_rtt * tolerance / rtt
+ *   (the gradient being clamped to [0.5, 1]) plus sqrt(limit) of headroom,
+ *   where rtt is a moving average, so the limit grows while RTT stays near
+ *   the minimum and shrinks as soon as requests start queueing. As in
+ *   Netflix's Gradient2, the limit is left unchanged by requests that kept
+ *   less than half of it in use, so that it does not drift up to max_limit
+ *   under light load. Failed requests are handled as in aimd.
+ *
+ * The minimum RTT is forgotten every min_rtt_window samples, so that the
+ * limiter follows a link whose base latency increases.
+ */
+class AdaptiveLimiter {
+
+    public:
+
+    enum class Algorithm { AIMD, Gradient };
+
+    private:
+
+    mutable tl::mutex m_mutex;
+    Algorithm         m_algorithm;
+    double            m_limit;
+    double            m_min_limit;
+    double            m_max_limit;
+    double            m_tolerance;
+    double            m_backoff_ratio;
+    double            m_smoothing;
+    uint64_t          m_min_rtt_window;
+    size_t            m_in_flight = 0;
+    uint64_t          m_min_rtt_ns = 0;
+    double            m_smoothed_rtt_ns = 0;
+    uint64_t          m_window_samples = 0;
+    uint64_t          m_accepted = 0;
+    uint64_t          m_rejected = 0;
+    uint64_t          m_dropped = 0;
+
+    public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param algorithm Algorithm updating the limit.
+     * @param initial_limit Initial limit.
+     * @param min_limit Lower bound of the limit.
+     * @param max_limit Upper bound of the limit.
+     * @param tolerance RTT, as a multiple of the minimum RTT, above
+     * which requests are considered to be queueing.
+     * @param backoff_ratio Factor applied to the limit on failure.
+     * @param smoothing Weight of each new sample (gradient only).
+     * @param min_rtt_window Number of samples after which the minimum
+     * RTT is measured anew.
+     */
+    AdaptiveLimiter(Algorithm algorithm, size_t initial_limit, size_t min_limit,
+                    size_t max_limit, double tolerance, double backoff_ratio,
+                    double smoothing, uint64_t min_rtt_window)
+    : m_algorithm{algorithm}
+    , m_min_limit{static_cast<double>(std::max<size_t>(min_limit, 1))}
+    , m_max_limit{static_cast<double>(std::max(max_limit, std::max<size_t>(min_limit, 1)))}
+    , m_tolerance{std::max(tolerance, 1.0)}
+    , m_backoff_ratio{backoff_ratio}
+    , m_smoothing{smoothing}
+    , m_min_rtt_window{min_rtt_window > 0 ? min_rtt_window : 1}
+    {
+        m_limit = std::clamp(static_cast<double>(initial_limit), m_min_limit, m_max_limit);
+    }
+
+    AdaptiveLimiter(const AdaptiveLimiter&) = delete;
+    AdaptiveLimiter& operator=(const AdaptiveLimiter&) = delete;
+
+    /**
+     * @brief Parses an algorithm name from the configuration.
+     */
+    static Algorithm AlgorithmFromString(const std::string& name) {
+        if(name == "aimd") return Algorithm::AIMD;
+        return Algorithm::Gradient;
+    }
+
+    /**
+     * @brief Take a slot if the number of requests in flight is below
+     * the current limit. Never waits.
+     *
+     * @return false if the request is rejected.
+     */
+    bool tryAcquire() {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        if(m_in_flight >= static_cast<size_t>(m_limit)) {
+            ++m_rejected;
+            return false;
+        }
+        ++m_in_flight;
+        ++m_accepted;
+        return true;
+    }
+
+    /**
+     * @brief Take a slot regardless of the limit, for requests whose
+     * admission follows the limit elsewhere (see FairScheduler::setSlots).
+     */
+    void acquire() {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        ++m_in_flight;
+        ++m_accepted;
+    }
+
+    /**
+     * @brief Current limit.
+     */
+    size_t limit() const {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        return static_cast<size_t>(m_limit);
+    }
+
+    /**
+     * @brief Release a slot acquired with tryAcquire() or acquire() and update the
+     * limit with the outcome of the request.
+     *
+     * @param rtt_ns Round-trip time of the request (0 if it has none,
+     * e.g. one-way requests, in which case the limit is left unchanged).
+     * @param dropped Whether the request failed or timed out.
+     */
+    void release(uint64_t rtt_ns, bool dropped) {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        auto in_flight = m_in_flight--;
+        if(dropped) {
+            ++m_dropped;
+            m_limit = std::max(m_min_limit, m_limit * m_backoff_ratio);
+            return;
+        }
+        if(rtt_ns == 0) return;
+        if(++m_window_samples > m_min_rtt_window) {
+            m_window_samples = 1;
+            m_min_rtt_ns = 0;
+        }
+        if(m_min_rtt_ns == 0 || rtt_ns < m_min_rtt_ns)
+            m_min_rtt_ns = rtt_ns;
+        m_smoothed_rtt_ns = m_smoothed_rtt_ns == 0 ? rtt_ns
+            : (1 - m_smoothing) * m_smoothed_rtt_ns + m_smoothing * rtt_ns;
+        double new_limit;
+        if(m_algorithm == Algorithm::AIMD) {
+            if(rtt_ns > m_tolerance * m_min_rtt_ns)
+                new_limit = m_limit * m_backoff_ratio;
+            else if(2 * in_flight >= m_limit)
+                new_limit = m_limit + 1;
+            else
+                return;
+        } else {
+            // app-limited: the RTT says nothing about a higher limit
+            if(2 * in_flight < m_limit) return;
+            auto gradient = std::clamp(
+                m_tolerance * m_min_rtt_ns / m_smoothed_rtt_ns, 0.5, 1.0);
+            auto target = m_limit * gradient + std::sqrt(m_limit);
+            new_limit = (1 - m_smoothing) * m_limit + m_smoothing * target;
+        }
+        m_limit = std::clamp(new_limit, m_min_limit, m_max_limit);
+    }
+
+    /**
+     * @brief Return the limit and the measurements it derives from.
+     */
+    nlohmann::json statistics() const {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        return nlohmann::json{
+            {"algorithm", m_algorithm == Algorithm::AIMD ? "aimd" : "gradient"},
+            {"limit", static_cast<size_t>(m_limit)},
+            {"in_flight", m_in_flight},
+            {"min_rtt_ms", m_min_rtt_ns / 1e6},
+            {"smoothed_rtt_ms", m_smoothed_rtt_ns / 1e6},
+            {"accepted", m_accepted},
+            {"rejected", m_rejected},
+            {"dropped", m_dropped}
+        };
+    }
+};
+
+}
+
+#endif
@@ -4,6 +4,8 @@
  * See COPYRIGHT in top-level directory.
  */
 #include "kage/Backend.hpp"
+#include <algorithm>
+#include <ctime>
 
 namespace tl = thallium;
 
@@ -16,6 +18,49 @@ std::unordered_map<std::string,
             const tl::engine&, const json&, const tl::pool&)>>
         ProxyFactory::create_fn;
 
+/* Time between two heartbeats while waiting for a backend to be ready */
+static constexpr uint64_t readiness_retry_ns = 100000000;
+
+/* Blocks the calling ULT until the given monotonic time (see RequestContext::now) */
+static void sleepUntil(uint64_t t_ns) {
+    auto now = RequestContext::now();
+    if(t_ns <= now) return;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += (deadline.tv_nsec + (t_ns - now)) / 1000000000;
+    deadline.tv_nsec  = (deadline.tv_nsec + (t_ns - now)) % 1000000000;
+    tl::mutex mutex;
+    tl::condition_variable cv;
+    std::unique_lock<tl::mutex> lock{mutex};
+    while(RequestContext::now() < t_ns && cv.wait_until(lock, &deadline)) {}
+}
+
+Result<bool> Backend::waitReady(uint64_t timeout_ns) {
+    auto deadline = RequestContext::now() + timeout_ns;
+    while(true) {
+        auto attempt_start = RequestContext::now();
+        auto attempt_ns = std::min(
+            deadline > attempt_start ? deadline - attempt_start : 0, readiness_retry_ns);
+        if(ping(attempt_ns).success()) return Result<bool>{};
+        if(attempt_start + attempt_ns >= deadline) break;
+        // the heartbeat may fail right away, e.g. if the
+        // remote is not listening yet, so don't retry sooner
+        sleepUntil(attempt_start + attempt_ns);
+    }
+    return Result<bool>{ErrorCode::Unavailable, "Backend not ready before timeout"};
+}
+
+Result<bool> Backend::WaitAllReady(
+        const std::vector<std::shared_ptr<Backend>>& backends, uint64_t timeout_ns) {
+    auto deadline = RequestContext::now() + timeout_ns;
+    for(auto& backend : backends) {
+        auto now = RequestContext::now();
+        auto result = backend->waitReady(deadline > now ? deadline - now : 0);
+        if(!result.success()) return result;
+    }
+    return Result<bool>{};
+}
+
 std::unique_ptr<Backend> ProxyFactory::createProxy(const std::string& backend_name,
                                                    const tl::engine& engine,
                                                    const json& config,
@@ -26,4 +71,15 @@ std::unique_ptr<Backend> ProxyFactory::createProxy(const std::string& backend_na
     return f(engine, config,  pool);
 }
 
+std::unique_ptr<Backend> ProxyFactory::createProxy(const json& spec,
+                                                   const tl::engine& engine,
+                                                   const tl::pool& pool) {
+    auto& type = spec["type"].get_ref<const std::string&>();
+    auto backend = createProxy(
+        type, engine, spec.contains("config") ? spec["config"] : json::object(), pool);
+    if(!backend)
+        throw Exception{"Unknown backend type " + type};
+    return backend;
+}
+
 }
@@ -9,6 +9,9 @@
 #include <bedrock/AbstractComponent.hpp>
 
 #include <nlohmann/json.hpp>
+#include <set>
+#include <vector>
+#include <unordered_map>
 
 namespace tl = thallium;
 using json = nlohmann::json;
@@ -17,17 +20,41 @@ class KageComponent : public bedrock::AbstractComponent {
 
     std::unique_ptr<kage::Provider> m_provider;
 
+    /**
+     * @brief Names of the pools that exported RPCs request with their "pool" field.
+     */
+    static std::set<std::string> RequestedPools(const json& config) {
+        std::set<std::string> pools;
+        if(!config.contains("exported_rpcs") || !config["exported_rpcs"].is_array())
+            return pools;
+        for(auto& rpc : config["exported_rpcs"]) {
+            if(rpc.is_object() && rpc.contains("pool") && rpc["pool"].is_string())
+                pools.insert(rpc["pool"].get<std::string>());
+        }
+        return pools;
+    }
+
+    /**
+     * @brief Name of the dependency providing the pool an exported RPC
+     * requests, prefixed so that it cannot collide with the "rpc_pool",
+     * "proxy_pool" and "target" dependencies.
+     */
+    static std::string PoolDependency(const std::string& pool_name) {
+        return "rpc_pool:" + pool_name;
+    }
+
     public:
 
     KageComponent(const tl::engine& engine,
                   uint16_t provider_id,
                   const char* identity,
                   const std::string& config,
-                  tl::provider_handle target,
+                  const std::vector<tl::provider_handle>& targets,
                   const tl::pool& rpc_pool,
-                  const tl::pool& proxy_pool)
+                  const tl::pool& proxy_pool,
+                  const std::unordered_map<std::string, tl::pool>& pools)
     : m_provider{std::make_unique<kage::Provider>(
-        engine, provider_id, identity, config, target, rpc_pool, proxy_pool)}
+        engine, provider_id, identity, config, targets, rpc_pool, proxy_pool, pools)}
     {}
 
     void* getHandle() override {
@@ -51,20 +78,28 @@ class KageComponent : public bedrock::AbstractComponent {
             if(it != args.dependencies.end() && !it->second.empty()) {
                 proxy_pool = it->second[0]->getHandle<tl::pool>();
             }
-            tl::provider_handle target;
+            std::vector<tl::provider_handle> targets;
             it = args.dependencies.find("target");
-            if(it != args.dependencies.end() && !it->second.empty()) {
-                target = it->second[0]->getHandle<tl::provider_handle>();
+            if(it != args.dependencies.end()) {
+                for(auto& target : it->second)
+                    targets.push_back(target->getHandle<tl::provider_handle>());
+            }
+            std::unordered_map<std::string, tl::pool> pools;
+            for(auto& pool_name : RequestedPools(config)) {
+                it = args.dependencies.find(PoolDependency(pool_name));
+                if(it != args.dependencies.end() && !it->second.empty()) {
+                    pools[pool_name] = it->second[0]->getHandle<tl::pool>();
+                }
             }
             return std::make_shared<KageComponent>(
                 args.engine, args.provider_id, identity.c_str(),
-                args.config, target, rpc_pool, proxy_pool);
+                args.config, targets, rpc_pool, proxy_pool, pools);
         }
 
     static std::vector<bedrock::Dependency>
         GetDependencies(const bedrock::ComponentArgs& args) {
             auto config = json::parse(args.config);
-            if(config.is_object())
+            if(!config.is_object())
                 throw bedrock::Exception{"Configuration for kage provider should be an object"};
             if(!config.contains("identity") || !config["identity"].is_string())
                 throw bedrock::Exception{
@@ -90,10 +125,19 @@ class KageComponent : public bedrock::AbstractComponent {
                     /* name */ "target",
                     /* type */ identity,
                     /* is_required */ false,
-                    /* is_array */ false,
+                    /* is_array */ true,
                     /* is_updatable */ false
                 }
             };
+            for(auto& pool_name : RequestedPools(config)) {
+                dependencies.push_back(bedrock::Dependency{
+                    /* name */ PoolDependency(pool_name),
+                    /* type */ "pool",
+                    /* is_required */ true,
+                    /* is_array */ false,
+                    /* is_updatable */ false
+                });
+            }
             return dependencies;
         }
 };
@@ -0,0 +1,326 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_BUFFER_POOL_HPP
+#define __KAGE_BUFFER_POOL_HPP
+
+#include <nlohmann/json.hpp>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace kage {
+
+/**
+ * @brief Process-wide pool of payload buffers.
+ *
+ * Buffers are rounded up to power-of-two size classes (256 B to 4 MiB) and
+ * cached in intrusive free lists once released, so that in steady state
+ * acquiring a buffer never calls malloc. Free lists are sharded: each OS
+ * thread, hence each Argobots xstream, is assigned a shard, so that
+ * concurrent xstreams rarely contend on the same lock. Each buffer remembers
+ * the shard of the thread that first allocated it and always goes back to
+ * that shard, so that buffers released from other threads, such as ZMQ's
+ * I/O thread, are found again by the xstreams that acquire them.
+ *
+ * When hugepages are enabled, buffers of a size class are carved out of
+ * 2 MiB slabs mapped with MAP_HUGETLB (or, if no hugepage is reserved,
+ * with transparent hugepages). Slabs are kept until the process exits.
+ * Buffers larger than the largest size class are neither pooled nor cached.
+ */
+class BufferPool {
+
+    static constexpr size_t   min_class_shift = 8;
+    static constexpr size_t   num_classes     = 15;
+    static constexpr size_t   num_shards      = 16;
+    static constexpr size_t   slab_size       = size_t{2} << 20;
+    static constexpr uint32_t oversized       = UINT32_MAX;
+
+    struct alignas(16) BlockHeader {
+        uint32_t size_class;
+        uint32_t from_slab;
+        uint32_t shard; // shard whose free list the block belongs to
+    };
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        FreeBlock* free_lists[num_classes] = {};
+        size_t     cached[num_classes] = {};
+    };
+
+    Shard                 m_shards[num_shards];
+    std::atomic<bool>     m_hugepages{false};
+    std::atomic<size_t>   m_max_cached_bytes{size_t{4} << 20};
+    std::mutex            m_slabs_mtx;
+    std::vector<void*>    m_slabs;
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<uint64_t> m_oversized{0};
+
+    BufferPool() = default;
+
+    static size_t classSize(size_t size_class) {
+        return size_t{1} << (size_class + min_class_shift);
+    }
+
+    static uint32_t sizeClass(size_t size) {
+        size_t size_class = 0;
+        while(size_class < num_classes && classSize(size_class) < size)
+            size_class += 1;
+        return size_class == num_classes ? oversized : static_cast<uint32_t>(size_class);
+    }
+
+    static BlockHeader* header(char* data) {
+        return reinterpret_cast<BlockHeader*>(data - sizeof(BlockHeader));
+    }
+
+    static char* payload(void* block) {
+        return static_cast<char*>(block) + sizeof(BlockHeader);
+    }
+
+    static uint32_t localShard() {
+        static std::atomic<uint32_t> next_shard{0};
+        thread_local uint32_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % num_shards;
+        return shard;
+    }
+
+    void* mapSlab() {
+        void* slab = mmap(nullptr, slab_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(slab == MAP_FAILED) {
+            slab = mmap(nullptr, slab_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(slab == MAP_FAILED) return nullptr;
+            madvise(slab, slab_size, MADV_HUGEPAGE);
+        }
+        std::lock_guard<std::mutex> lock{m_slabs_mtx};
+        m_slabs.push_back(slab);
+        return slab;
+    }
+
+    /**
+     * Carves a new slab into blocks of the given class, pushes all
+     * but one to the shard's free list and returns the remaining one.
+     */
+    char* refillFromSlab(uint32_t shard_index, uint32_t size_class) {
+        auto block_size = sizeof(BlockHeader) + classSize(size_class);
+        if(block_size > slab_size) return nullptr;
+        auto slab = static_cast<char*>(mapSlab());
+        if(!slab) return nullptr;
+        auto num_blocks = slab_size / block_size;
+        for(size_t i = 0; i < num_blocks; ++i) {
+            auto h = reinterpret_cast<BlockHeader*>(slab + i * block_size);
+            h->size_class = size_class;
+            h->from_slab  = 1;
+            h->shard      = shard_index;
+        }
+        auto& shard = m_shards[shard_index];
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        for(size_t i = 1; i < num_blocks; ++i) {
+            auto block = reinterpret_cast<FreeBlock*>(payload(slab + i * block_size));
+            block->next = shard.free_lists[size_class];
+            shard.free_lists[size_class] = block;
+        }
+        return payload(slab);
+    }
+
+    public:
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool(BufferPool&&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    BufferPool& operator=(BufferPool&&) = delete;
+
+    ~BufferPool() {
+        for(auto& shard : m_shards) {
+            for(auto free_list : shard.free_lists) {
+                while(free_list) {
+                    auto next = free_list->next;
+                    auto h = header(reinterpret_cast<char*>(free_list));
+                    if(!h->from_slab) std::free(h);
+                    free_list = next;
+                }
+            }
+        }
+        for(auto slab : m_slabs) munmap(slab, slab_size);
+    }
+
+    /**
+     * @brief Returns the process-wide pool.
+     */
+    static BufferPool& Get() {
+        static BufferPool pool;
+        return pool;
+    }
+
+    /**
+     * @brief Changes how future buffers are obtained. Buffers that
+     * are already cached are not affected.
+     *
+     * @param hugepages Carve buffers out of hugepage-backed slabs.
+     * @param max_cached_bytes Maximum number of bytes of heap-allocated
+     * buffers cached per size class and per shard (at least one buffer
+     * is always cached).
+     */
+    void configure(bool hugepages, size_t max_cached_bytes) {
+        m_hugepages.store(hugepages);
+        m_max_cached_bytes.store(max_cached_bytes);
+    }
+
+    /**
+     * @brief Acquires a buffer of at least the requested size.
+     * The buffer must be released with release().
+     */
+    char* acquire(size_t size) {
+        auto size_class = sizeClass(size);
+        if(size_class == oversized) {
+            m_oversized.fetch_add(1, std::memory_order_relaxed);
+            auto h = static_cast<BlockHeader*>(std::malloc(sizeof(BlockHeader) + size));
+            if(!h) throw std::bad_alloc{};
+            h->size_class = oversized;
+            h->from_slab  = 0;
+            h->shard      = 0;
+            return payload(h);
+        }
+        auto shard_index = localShard();
+        auto& shard = m_shards[shard_index];
+        {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            if(auto block = shard.free_lists[size_class]) {
+                shard.free_lists[size_class] = block->next;
+                if(!header(reinterpret_cast<char*>(block))->from_slab)
+                    shard.cached[size_class] -= 1;
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return reinterpret_cast<char*>(block);
+            }
+        }
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        if(m_hugepages.load(std::memory_order_relaxed)) {
+            if(auto data = refillFromSlab(shard_index, size_class))
+                return data;
+        }
+        auto h = static_cast<BlockHeader*>(
+            std::malloc(sizeof(BlockHeader) + classSize(size_class)));
+        if(!h) throw std::bad_alloc{};
+        h->size_class = size_class;
+        h->from_slab  = 0;
+        h->shard      = shard_index;
+        return payload(h);
+    }
+
+    /**
+     * @brief Returns a buffer obtained from acquire() to the pool,
+     * from any thread.
+     */
+    void release(char* data) {
+        if(!data) return;
+        auto h = header(data);
+        if(h->size_class == oversized) {
+            std::free(h);
+            return;
+        }
+        auto& shard = m_shards[h->shard];
+        {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            auto& cached = shard.cached[h->size_class];
+            auto max_cached = m_max_cached_bytes.load(std::memory_order_relaxed) / classSize(h->size_class);
+            if(h->from_slab || cached < std::max<size_t>(max_cached, 1)) {
+                auto block = reinterpret_cast<FreeBlock*>(data);
+                block->next = shard.free_lists[h->size_class];
+                shard.free_lists[h->size_class] = block;
+                if(!h->from_slab) cached += 1;
+                return;
+            }
+        }
+        std::free(h);
+    }
+
+    /**
+     * @brief Deallocation function with the signature expected by
+     * zmq_msg_init_data, to hand pooled buffers over to ZMQ. ZMQ still
+     * allocates its own small descriptor for each such message.
+     */
+    static void Release(void* data, void*) {
+        Get().release(static_cast<char*>(data));
+    }
+
+    nlohmann::json statistics() const {
+        return nlohmann::json{
+            {"hits", m_hits.load()},
+            {"misses", m_misses.load()},
+            {"oversized", m_oversized.load()}
+        };
+    }
+
+    /**
+     * @brief RAII handle on a pooled buffer.
+     */
+    class Buffer {
+
+        char*  m_data = nullptr;
+        size_t m_size = 0;
+
+        public:
+
+        Buffer() = default;
+
+        Buffer(const char* data, size_t size)
+        : m_data{BufferPool::Get().acquire(size)}
+        , m_size{size} {
+            if(size) std::memcpy(m_data, data, size);
+        }
+
+        Buffer(Buffer&& other) noexcept
+        : m_data{other.m_data}, m_size{other.m_size} {
+            other.m_data = nullptr;
+            other.m_size = 0;
+        }
+
+        Buffer& operator=(Buffer&& other) noexcept {
+            if(this == &other) return *this;
+            BufferPool::Get().release(m_data);
+            m_data = other.m_data;
+            m_size = other.m_size;
+            other.m_data = nullptr;
+            other.m_size = 0;
+            return *this;
+        }
+
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        ~Buffer() {
+            BufferPool::Get().release(m_data);
+        }
+
+        const char* data() const { return m_data; }
+        char* data() { return m_data; }
+        size_t size() const { return m_size; }
+
+        /**
+         * @brief Gives up ownership of the buffer, which
+         * must then be returned with BufferPool::release.
+         */
+        char* detach() {
+            auto data = m_data;
+            m_data = nullptr;
+            m_size = 0;
+            return data;
+        }
+    };
+};
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_BULKHEAD_HPP
+#define __KAGE_BULKHEAD_HPP
+
+#include <thallium.hpp>
+#include <nlohmann/json.hpp>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <cstdint>
+
+namespace kage {
+
+namespace tl = thallium;
+
+/**
+ * @brief A Bulkhead bounds the number of requests in flight towards
+ * a resource. Requests above the bound wait in a bounded queue, served
+ * either in FIFO order or by decreasing priority (FIFO among requests
+ * of equal priority). Requests arriving when the queue is full are rejected.
+ */
+class Bulkhead {
+
+    mutable tl::mutex      m_mutex;
+    tl::condition_variable m_cv;
+    size_t                 m_max_in_flight;
+    size_t                 m_max_queued;
+    bool                   m_use_priority;
+    size_t                 m_in_flight = 0;
+    uint64_t               m_next_ticket = 0;
+    uint64_t               m_rejected = 0;
+    // (negated priority, ticket), so that begin() is the next to serve
+    std::set<std::pair<int64_t, uint64_t>> m_waiting;
+
+    public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param max_in_flight Maximum number of requests in flight.
+     * @param max_queued Maximum number of waiting requests.
+     * @param use_priority Serve waiting requests by priority rather than FIFO.
+     */
+    Bulkhead(size_t max_in_flight, size_t max_queued, bool use_priority)
+    : m_max_in_flight{max_in_flight > 0 ? max_in_flight : 1}
+    , m_max_queued{max_queued}
+    , m_use_priority{use_priority} {}
+
+    Bulkhead(const Bulkhead&) = delete;
+    Bulkhead& operator=(const Bulkhead&) = delete;
+
+    /**
+     * @brief Acquire a slot, waiting if necessary.
+     *
+     * @param priority Priority of the request (higher is served first).
+     *
+     * @return false if the queue was full and the request is rejected.
+     */
+    bool acquire(int64_t priority = 0) {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        if(m_waiting.empty() && m_in_flight < m_max_in_flight) {
+            ++m_in_flight;
+            return true;
+        }
+        if(m_waiting.size() >= m_max_queued) {
+            ++m_rejected;
+            return false;
+        }
+        auto key = std::make_pair(m_use_priority ? -priority : 0, m_next_ticket++);
+        m_waiting.insert(key);
+        while(m_in_flight >= m_max_in_flight || *m_waiting.begin() != key)
+            m_cv.wait(lock);
+        m_waiting.erase(m_waiting.begin());
+        ++m_in_flight;
+        if(!m_waiting.empty() && m_in_flight < m_max_in_flight)
+            m_cv.notify_all();
+        return true;
+    }
+
+    /**
+     * @brief Release a slot acquired with acquire().
+     */
+    void release() {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        --m_in_flight;
+        if(!m_waiting.empty())
+            m_cv.notify_all();
+    }
+
+    /**
+     * @brief Return the state of the bulkhead as a JSON object.
+     */
+    nlohmann::json statistics() const {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        return nlohmann::json{
+            {"max_in_flight", m_max_in_flight},
+            {"in_flight", m_in_flight},
+            {"queued", m_waiting.size()},
+            {"rejected", m_rejected}
+        };
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_FAIR_SCHEDULER_HPP
+#define __KAGE_FAIR_SCHEDULER_HPP
+
+#include <thallium.hpp>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+namespace kage {
+
+namespace tl = thallium;
+
+/**
+ * @brief Shares a bounded number of slots among flows (e.g. clients)
+ * with deficit round robin.
+ *
+ * Requests get a slot right away while there are free slots and nobody
+ * is waiting. Otherwise they wait in their flow's FIFO queue, and each
+ * released slot goes to the next backlogged flow in round-robin order
+ * whose deficit covers the cost (in bytes) of its first request. A flow
+ * earns quantum * weight bytes of deficit per round, so flows share the
+ * slots in proportion to their weight regardless of how many requests
+ * each of them sends, and a flow with an empty queue does not accumulate
+ * credit. Requests arriving when max_queued requests are waiting are
+ * rejected.
+ *
+ * The number of slots can be lowered below max_in_flight at run time with
+ * setSlots(), e.g. to follow an AdaptiveLimiter's limit.
+ */
+class FairScheduler {
+
+    struct Waiter {
+        uint64_t cost;
+        bool     granted = false;
+    };
+
+    struct Flow {
+        double              weight;
+        uint64_t            deficit = 0;
+        bool                credited = false;
+        std::deque<Waiter*> queue;
+    };
+
+    mutable tl::mutex      m_mutex;
+    tl::condition_variable m_cv;
+    size_t                 m_max_in_flight;
+    size_t                 m_slots;
+    size_t                 m_max_queued;
+    uint64_t               m_quantum;
+    double                 m_default_weight;
+    std::unordered_map<std::string, double> m_weights;
+    // Backlogged flows, in round-robin order
+    std::unordered_map<std::string, std::unique_ptr<Flow>> m_flows;
+    std::deque<std::string>                                m_active;
+    size_t                 m_in_flight = 0;
+    size_t                 m_queued = 0;
+    uint64_t               m_immediate = 0;
+    uint64_t               m_delayed = 0;
+    uint64_t               m_rejected = 0;
+
+    /* Hands out free slots to waiting requests, following DRR */
+    void dispatch() {
+        bool granted = false;
+        while(m_in_flight < m_slots && !m_active.empty()) {
+            auto& flow = *m_flows[m_active.front()];
+            auto waiter = flow.queue.front();
+            if(flow.deficit < waiter->cost) {
+                if(flow.credited) {
+                    // This flow's turn is over
+                    flow.credited = false;
+                    auto name = std::move(m_active.front());
+                    m_active.pop_front();
+                    m_active.push_back(std::move(name));
+                } else {
+                    auto credit = static_cast<uint64_t>(m_quantum * flow.weight);
+                    flow.deficit += std::max<uint64_t>(credit, 1);
+                    flow.credited = true;
+                }
+                continue;
+            }
+            flow.deficit -= waiter->cost;
+            flow.queue.pop_front();
+            waiter->granted = true;
+            granted = true;
+            --m_queued;
+            ++m_in_flight;
+            if(flow.queue.empty()) {
+                m_flows.erase(m_active.front());
+                m_active.pop_front();
+            }
+        }
+        if(granted) m_cv.notify_all();
+    }
+
+    public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param max_in_flight Number of slots.
+     * @param max_queued Maximum number of waiting requests.
+     * @param quantum Bytes credited to a flow of weight 1 per round.
+     * @param default_weight Weight of the flows absent from weights.
+     * @param weights Weights of specific flows.
+     */
+    FairScheduler(size_t max_in_flight, size_t max_queued, uint64_t quantum,
+                  double default_weight, std::unordered_map<std::string, double> weights)
+    : m_max_in_flight{max_in_flight > 0 ? max_in_flight : 1}
+    , m_slots{m_max_in_flight}
+    , m_max_queued{max_queued}
+    , m_quantum{quantum > 0 ? quantum : 1}
+    , m_default_weight{default_weight}
+    , m_weights{std::move(weights)} {}
+
+    FairScheduler(const FairScheduler&) = delete;
+    FairScheduler& operator=(const FairScheduler&) = delete;
+
+    /**
+     * @brief Acquire a slot for a request of the given flow and cost,
+     * waiting for its turn if necessary.
+     *
+     * @return false if the queue was full and the request is rejected.
+     */
+    bool acquire(const std::string& flow_name, uint64_t cost) {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        if(m_queued == 0 && m_in_flight < m_slots) {
+            ++m_in_flight;
+            ++m_immediate;
+            return true;
+        }
+        if(m_queued >= m_max_queued) {
+            ++m_rejected;
+            return false;
+        }
+        Waiter waiter{cost};
+        auto& flow = m_flows[flow_name];
+        if(!flow) {
+            auto it = m_weights.find(flow_name);
+            flow = std::make_unique<Flow>();
+            flow->weight = it == m_weights.end() ? m_default_weight : it->second;
+            m_active.push_back(flow_name);
+        }
+        flow->queue.push_back(&waiter);
+        ++m_queued;
+        ++m_delayed;
+        dispatch();
+        while(!waiter.granted)
+            m_cv.wait(lock);
+        return true;
+    }
+
+    /**
+     * @brief Release a slot acquired with acquire().
+     */
+    void release() {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        --m_in_flight;
+        dispatch();
+    }
+
+    /**
+     * @brief Set the number of slots, within [1, max_in_flight]. Requests
+     * already in flight keep their slot if the number of slots decreases.
+     */
+    void setSlots(size_t slots) {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        m_slots = std::clamp<size_t>(slots, 1, m_max_in_flight);
+        dispatch();
+    }
+
+    /**
+     * @brief Return the state of the scheduler as a JSON object.
+     */
+    nlohmann::json statistics() const {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        return nlohmann::json{
+            {"max_in_flight", m_max_in_flight},
+            {"slots", m_slots},
+            {"in_flight", m_in_flight},
+            {"queued", m_queued},
+            {"backlogged_flows", m_active.size()},
+            {"immediate", m_immediate},
+            {"delayed", m_delayed},
+            {"rejected", m_rejected}
+        };
+    }
+};
+
+}
+
+#endif
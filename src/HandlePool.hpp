@@ -0,0 +1,116 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_HANDLE_POOL_HPP
+#define __KAGE_HANDLE_POOL_HPP
+
+#include <thallium.hpp>
+#include <optional>
+#include <vector>
+
+namespace kage {
+
+namespace tl = thallium;
+
+/**
+ * @brief Pool of Mercury handles for a given (RPC, target) pair.
+ *
+ * Calling rpc.on(target)(...) creates and destroys an hg_handle_t on every
+ * request. Since the RPC and the target never change, a handle can instead
+ * be forwarded again once its previous response has been consumed, so the
+ * pool keeps up to max_cached idle handles and hands them out through
+ * RAII leases. A handle whose call threw is not returned to the pool,
+ * since Mercury may not have completed the operation on it.
+ */
+class HandlePool {
+
+    tl::remote_procedure                       m_rpc;
+    tl::provider_handle                        m_target;
+    size_t                                     m_max_cached;
+    tl::mutex                                  m_mutex;
+    std::vector<tl::callable_remote_procedure> m_idle;
+
+    public:
+
+    /**
+     * @brief RAII lease on a handle. The lease must outlive the
+     * packed_data returned by the call made with the handle.
+     */
+    class Lease {
+
+        HandlePool*                                  m_pool;
+        std::optional<tl::callable_remote_procedure> m_handle;
+
+        public:
+
+        Lease(HandlePool* pool, tl::callable_remote_procedure&& handle)
+        : m_pool{pool}, m_handle{std::move(handle)} {}
+
+        Lease(Lease&&) = delete;
+        Lease(const Lease&) = delete;
+        Lease& operator=(Lease&&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        ~Lease() {
+            if(m_handle) m_pool->release(std::move(*m_handle));
+        }
+
+        tl::callable_remote_procedure& operator*() {
+            return *m_handle;
+        }
+
+        /**
+         * @brief Destroys the handle instead of returning it to the pool.
+         */
+        void discard() {
+            m_handle.reset();
+        }
+    };
+
+    HandlePool(tl::remote_procedure rpc, tl::provider_handle target, size_t max_cached = 64)
+    : m_rpc{std::move(rpc)}
+    , m_target{std::move(target)}
+    , m_max_cached{max_cached} {}
+
+    HandlePool(HandlePool&&) = delete;
+    HandlePool(const HandlePool&) = delete;
+    HandlePool& operator=(HandlePool&&) = delete;
+    HandlePool& operator=(const HandlePool&) = delete;
+
+    /**
+     * @brief Takes an idle handle, or creates one if there is none.
+     */
+    Lease acquire() {
+        {
+            std::unique_lock<tl::mutex> lock{m_mutex};
+            if(!m_idle.empty()) {
+                auto handle = std::move(m_idle.back());
+                m_idle.pop_back();
+                return Lease{this, std::move(handle)};
+            }
+        }
+        return Lease{this, m_rpc.on(m_target)};
+    }
+
+    /**
+     * @brief Destroys all the idle handles.
+     */
+    void clear() {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        m_idle.clear();
+    }
+
+    private:
+
+    void release(tl::callable_remote_procedure&& handle) {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        if(m_idle.size() < m_max_cached)
+            m_idle.push_back(std::move(handle));
+    }
+};
+
+}
+
+#endif
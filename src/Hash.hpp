@@ -0,0 +1,40 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_HASH_HPP
+#define __KAGE_HASH_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace kage {
+
+/**
+ * @brief 64-bit FNV-1a hash. Unlike std::hash, its value does not depend
+ * on the standard library, so that all the processes agree on it.
+ */
+inline uint64_t FNV1a(const char* data, size_t size, uint64_t h = 14695981039346656037ULL) {
+    for(size_t i = 0; i < size; ++i) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief Hash of the length bytes of a payload starting at offset,
+ * clipped to the payload (a length of 0 means up to the end).
+ */
+inline uint64_t HashPayloadRange(const char* data, size_t size, size_t offset, size_t length) {
+    offset = std::min(offset, size);
+    auto available = size - offset;
+    if(length) available = std::min(available, length);
+    return FNV1a(data + offset, available);
+}
+
+}
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_ORDERED_DISPATCHER_HPP
+#define __KAGE_ORDERED_DISPATCHER_HPP
+
+#include <thallium.hpp>
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace kage {
+
+namespace tl = thallium;
+
+/**
+ * @brief Dispatches items to a set of shards, each with its own FIFO queue
+ * served by a single ULT. Items are assigned to a shard by the hash of their
+ * ordering key, so items with the same key are handled one at a time, in the
+ * order they were pushed, while items with different keys are handled in
+ * parallel by as many execution streams as the pool has.
+ *
+ * tryPush() refuses items while their shard's queue holds max_queued of
+ * them, so that a slow key neither grows its queue without bound nor
+ * blocks the caller, which typically also reads the items of other keys.
+ * Items still queued when the dispatcher is stopped are dropped.
+ */
+template<typename Item>
+class OrderedDispatcher {
+
+    struct Shard {
+        tl::mutex               mutex;
+        tl::condition_variable  cv;
+        std::deque<Item>        queue;
+        tl::managed<tl::thread> ult;
+    };
+
+    std::function<void(Item&)>          m_handler;
+    size_t                              m_max_queued;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::atomic<bool>                   m_need_stop{false};
+    std::atomic<uint64_t>               m_dispatched{0};
+    std::atomic<uint64_t>               m_rejected{0};
+
+    void runShard(Shard& shard) {
+        while(true) {
+            Item item;
+            {
+                std::unique_lock<tl::mutex> lock{shard.mutex};
+                while(shard.queue.empty() && !m_need_stop)
+                    shard.cv.wait(lock);
+                if(m_need_stop) break;
+                item = std::move(shard.queue.front());
+                shard.queue.pop_front();
+            }
+            m_handler(item);
+        }
+    }
+
+    public:
+
+    /**
+     * @brief Constructor. Starts one ULT per shard in the given pool.
+     *
+     * @param pool Pool in which to run the shards' ULTs.
+     * @param num_shards Number of shards.
+     * @param max_queued Maximum number of items queued in each shard.
+     * @param handler Function called on each item.
+     */
+    OrderedDispatcher(tl::pool pool, size_t num_shards, size_t max_queued,
+                      std::function<void(Item&)> handler)
+    : m_handler{std::move(handler)}
+    , m_max_queued{max_queued > 0 ? max_queued : 1}
+    {
+        if(num_shards == 0) num_shards = 1;
+        for(size_t i = 0; i < num_shards; ++i)
+            m_shards.push_back(std::make_unique<Shard>());
+        for(auto& shard : m_shards) {
+            auto s = shard.get();
+            shard->ult = pool.make_thread([this, s]{ runShard(*s); });
+        }
+    }
+
+    OrderedDispatcher(const OrderedDispatcher&) = delete;
+    OrderedDispatcher& operator=(const OrderedDispatcher&) = delete;
+
+    ~OrderedDispatcher() {
+        stop();
+    }
+
+    /**
+     * @brief Queues an item in the shard of the given key.
+     *
+     * @return false, leaving the item untouched, if the
+     * shard's queue is full or the dispatcher is stopped.
+     */
+    bool tryPush(uint64_t key, Item& item) {
+        auto& shard = *m_shards[key % m_shards.size()];
+        {
+            std::unique_lock<tl::mutex> lock{shard.mutex};
+            if(m_need_stop) return false;
+            if(shard.queue.size() >= m_max_queued) {
+                m_rejected.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            shard.queue.push_back(std::move(item));
+        }
+        m_dispatched.fetch_add(1, std::memory_order_relaxed);
+        shard.cv.notify_all();
+        return true;
+    }
+
+    /**
+     * @brief Stops and joins the shards' ULTs.
+     */
+    void stop() {
+        m_need_stop = true;
+        for(auto& shard : m_shards) {
+            std::unique_lock<tl::mutex> lock{shard->mutex};
+            shard->queue.clear();
+        }
+        for(auto& shard : m_shards) {
+            shard->cv.notify_all();
+            if(shard->ult) {
+                shard->ult->join();
+                shard->ult.release();
+            }
+        }
+    }
+
+    /**
+     * @brief Number of dispatched items, and of items
+     * refused because their shard was full.
+     */
+    nlohmann::json statistics() const {
+        return nlohmann::json{
+            {"shards", m_shards.size()},
+            {"dispatched", m_dispatched.load(std::memory_order_relaxed)},
+            {"rejected", m_rejected.load(std::memory_order_relaxed)}
+        };
+    }
+};
+
+}
+
+#endif
@@ -5,6 +5,7 @@
  */
 #include "kage/Provider.hpp"
 #include "kage/InputProxy.hpp"
+#include "kage/Middleware.hpp"
 
 #include "ProviderImpl.hpp"
 
@@ -20,9 +21,23 @@ Provider::Provider(const tl::engine& engine,
                    const std::string& config,
                    const tl::provider_handle& target,
                    const tl::pool& rpc_pool,
-                   const tl::pool& proxy_pool)
+                   const tl::pool& proxy_pool,
+                   const std::unordered_map<std::string, tl::pool>& pools)
+: Provider(engine, provider_id, identity, config,
+           target.is_null() ? std::vector<tl::provider_handle>{}
+                            : std::vector<tl::provider_handle>{target},
+           rpc_pool, proxy_pool, pools) {}
+
+Provider::Provider(const tl::engine& engine,
+                   uint16_t provider_id,
+                   const char* identity,
+                   const std::string& config,
+                   const std::vector<tl::provider_handle>& targets,
+                   const tl::pool& rpc_pool,
+                   const tl::pool& proxy_pool,
+                   const std::unordered_map<std::string, tl::pool>& pools)
 : self(std::make_shared<ProviderImpl>(
-        engine, provider_id, identity, config, target, rpc_pool, proxy_pool)) {
+        engine, provider_id, identity, config, targets, rpc_pool, proxy_pool, pools)) {
     self->m_backend->setInputProxy(InputProxy{self});
     self->get_engine().push_finalize_callback(this, [p=this]() { p->self.reset(); });
 }
@@ -43,6 +58,16 @@ std::string Provider::getConfig() const {
     return self ? self->getConfig() : "{}";
 }
 
+std::string Provider::getStatistics() const {
+    return self ? self->getStatistics() : "{}";
+}
+
+Result<bool> Provider::waitReady(std::chrono::milliseconds timeout) const {
+    if(!self) return Result<bool>{ErrorCode::Unavailable, "Invalid provider"};
+    return self->waitReady(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+}
+
 Provider::operator bool() const {
     return static_cast<bool>(self);
 }
@@ -50,24 +75,24 @@ Provider::operator bool() const {
 InputProxy::~InputProxy() = default;
 
 InputProxy::operator bool() const {
-    return static_cast<bool>(self.lock());
+    return static_cast<bool>(self.lock()) || static_cast<bool>(stage.lock());
 }
 
 Result<bool> InputProxy::forwardInput(
         hg_id_t rpc_id, const char* data, size_t data_size,
-        const std::function<void(const char*, size_t)>& output_cb) {
-    auto impl = self.lock();
-    Result<bool> result;
-    if(!impl) {
-        result.success() = false;
-        result.error() = "InputProxy not available";
-    } else {
-        result = impl->forwardRPCtoInput(rpc_id, data, data_size, output_cb);
-    }
-    return result;
+        OutputCallback output_cb,
+        RequestContext& context) {
+    if(auto next_stage = stage.lock())
+        return next_stage->forwardInput(rpc_id, data, data_size, output_cb, context);
+    if(auto impl = self.lock())
+        return impl->forwardRPCtoInput(rpc_id, data, data_size, output_cb, context);
+    return Result<bool>{ErrorCode::Unavailable, "InputProxy not available"};
 }
 
 InputProxy::InputProxy(std::shared_ptr<ProviderImpl> impl)
 : self{impl} {}
 
+InputProxy::InputProxy(std::shared_ptr<Middleware> next_stage)
+: stage{next_stage} {}
+
 }
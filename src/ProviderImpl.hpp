@@ -8,6 +8,15 @@
 
 #include "kage/Backend.hpp"
 #include "Serialization.hpp"
+#include "RateLimiter.hpp"
+#include "Bulkhead.hpp"
+#include "FairScheduler.hpp"
+#include "AdaptiveLimiter.hpp"
+#include "Statistics.hpp"
+#include "BufferPool.hpp"
+#include "HandlePool.hpp"
+#include "Tracer.hpp"
+#include "TargetGroup.hpp"
 
 #include <thallium.hpp>
 #include <thallium/serialization/stl/string.hpp>
@@ -17,6 +26,8 @@
 #include <nlohmann/json.hpp>
 #include <spdlog/spdlog.h>
 
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <tuple>
 
@@ -42,9 +53,22 @@ class ProviderImpl : public tl::provider<ProviderImpl>, std::enable_shared_from_
 
     struct RPC {
 
-        tl::remote_procedure proc;
-        std::string          name;
-        hg_id_t              client_rpc_id;
+        tl::remote_procedure             proc;
+        std::string                      name;
+        hg_id_t                          client_rpc_id;
+        std::unique_ptr<RateLimiter>     rate_limiter;
+        std::unique_ptr<Bulkhead>        bulkhead;
+        int64_t                          priority = 0;
+        bool                             input_side = false;
+        bool                             one_way = false;
+        uint64_t                         deadline_ns = 0;
+        tl::pool                         pool;
+        std::unique_ptr<Histogram>       queue_wait;
+        // Targets of the RPC (the provider's, unless it has its own),
+        // with one pool of handles per target
+        std::shared_ptr<TargetGroup>             targets;
+        std::vector<std::unique_ptr<HandlePool>> handles;
+        std::unique_ptr<StageStatistics> stages;
 
         RPC(tl::remote_procedure&& rpc, std::string n, hg_id_t client_id)
         : proc{std::move(rpc)}
@@ -68,9 +92,27 @@ class ProviderImpl : public tl::provider<ProviderImpl>, std::enable_shared_from_
     tl::engine           m_engine;
     tl::pool             m_rpc_pool;
     tl::pool             m_proxy_pool;
-    tl::provider_handle  m_target;
+    // Named pools that exported RPCs can be assigned to
+    std::unordered_map<std::string, tl::pool> m_pools;
+    // Targets of input RPCs that do not have their own
+    std::shared_ptr<TargetGroup> m_targets;
     bool                 m_is_input;
     bool                 m_is_output;
+    // Fair sharing of the backend among the output side's clients
+    std::unique_ptr<FairScheduler> m_fair_scheduler;
+    bool                           m_fair_by_source = true;
+    // Latency-driven bound on the requests in flight towards the backend
+    std::unique_ptr<AdaptiveLimiter> m_adaptive_limiter;
+    // Bound on the requests in flight towards m_target
+    std::unique_ptr<Bulkhead> m_input_bulkhead;
+    // Whether to timestamp the stages of each request
+    bool m_instrumented = false;
+    // Requests dropped because their deadline expired, before being
+    // sent by the output side or before calling the target on the input side
+    std::atomic<uint64_t> m_expired_output{0};
+    std::atomic<uint64_t> m_expired_input{0};
+    // Writes the spans of sampled requests, if tracing is enabled
+    std::unique_ptr<Tracer> m_tracer;
     // Exported RPCs
     std::unordered_map<hg_id_t, RPC> m_rpcs;
     // Backend
@@ -80,14 +122,15 @@ class ProviderImpl : public tl::provider<ProviderImpl>, std::enable_shared_from_
                  uint16_t provider_id,
                  const char* identity,
                  const std::string& config,
-                 const tl::provider_handle& target,
+                 const std::vector<tl::provider_handle>& targets,
                  const tl::pool& rpc_pool,
-                 const tl::pool& proxy_pool)
+                 const tl::pool& proxy_pool,
+                 const std::unordered_map<std::string, tl::pool>& pools)
     : tl::provider<ProviderImpl>(engine, provider_id, identity)
     , m_engine{engine}
     , m_rpc_pool{rpc_pool.is_null() ? m_engine.get_handler_pool() : rpc_pool}
     , m_proxy_pool{proxy_pool.is_null() ? m_engine.get_handler_pool() : proxy_pool}
-    , m_target{target}
+    , m_pools{pools}
     {
         static const json schema = R"(
         {
@@ -107,7 +150,115 @@ class ProviderImpl : public tl::provider<ProviderImpl>, std::enable_shared_from_
                 },
                 "exported_rpcs": {
                     "type": "array",
-                    "items": { "type": "string", "minLength": 1 }
+                    "items": {
+                        "oneOf": [
+                            { "type": "string", "minLength": 1 },
+                            {
+                                "type": "object",
+                                "properties": {
+                                    "name": { "type": "string", "minLength": 1 },
+                                    "pool": { "type": "string", "minLength": 1 },
+                                    "one_way": { "type": "boolean" },
+                                    "deadline_ms": { "type": "number", "exclusiveMinimum": 0 },
+                                    "target": {
+                                        "type": "object",
+                                        "properties": {
+                                            "address": { "type": "string", "minLength": 1 },
+                                            "provider_id": { "type": "integer", "minimum": 0, "maximum": 65535 }
+                                        },
+                                        "required": ["address", "provider_id"]
+                                    },
+                                    "rate_limit": {
+                                        "type": "object",
+                                        "properties": {
+                                            "rate": { "type": "number", "exclusiveMinimum": 0 },
+                                            "burst": { "type": "integer", "minimum": 1 },
+                                            "per_source": { "type": "boolean" },
+                                            "source_buckets": { "type": "integer", "minimum": 1 },
+                                            "max_queued": { "type": "integer", "minimum": 0 }
+                                        },
+                                        "required": ["rate"]
+                                    },
+                                    "input": {
+                                        "type": "object",
+                                        "properties": {
+                                            "max_in_flight": { "type": "integer", "minimum": 1 },
+                                            "max_queued": { "type": "integer", "minimum": 0 },
+                                            "priority": { "type": "integer" }
+                                        }
+                                    }
+                                },
+                                "required": ["name"]
+                            }
+                        ]
+                    }
+                },
+                "input": {
+                    "type": "object",
+                    "properties": {
+                        "max_in_flight": { "type": "integer", "minimum": 1 },
+                        "max_queued": { "type": "integer", "minimum": 0 },
+                        "queue": { "type": "string", "enum": ["fifo", "priority"] },
+                        "routing": {
+                            "type": "object",
+                            "properties": {
+                                "policy": {
+                                    "type": "string",
+                                    "enum": ["round_robin", "least_in_flight", "hash"]
+                                },
+                                "hash_offset": { "type": "integer", "minimum": 0 },
+                                "hash_length": { "type": "integer", "minimum": 0 }
+                            }
+                        }
+                    }
+                },
+                "fair_queueing": {
+                    "type": "object",
+                    "properties": {
+                        "classify_by": { "type": "string", "enum": ["source", "rpc"] },
+                        "max_in_flight": { "type": "integer", "minimum": 1 },
+                        "max_queued": { "type": "integer", "minimum": 0 },
+                        "quantum": { "type": "integer", "minimum": 1 },
+                        "default_weight": { "type": "number", "exclusiveMinimum": 0 },
+                        "weights": {
+                            "type": "object",
+                            "additionalProperties": { "type": "number", "exclusiveMinimum": 0 }
+                        }
+                    },
+                    "required": ["max_in_flight"]
+                },
+                "adaptive_limit": {
+                    "type": "object",
+                    "properties": {
+                        "algorithm": { "type": "string", "enum": ["gradient", "aimd"] },
+                        "initial_limit": { "type": "integer", "minimum": 1 },
+                        "min_limit": { "type": "integer", "minimum": 1 },
+                        "max_limit": { "type": "integer", "minimum": 1 },
+                        "tolerance": { "type": "number", "minimum": 1 },
+                        "backoff_ratio": { "type": "number", "exclusiveMinimum": 0, "maximum": 1 },
+                        "smoothing": { "type": "number", "exclusiveMinimum": 0, "maximum": 1 },
+                        "min_rtt_window": { "type": "integer", "minimum": 1 }
+                    }
+                },
+                "instrumentation": { "type": "boolean" },
+                "tracing": {
+                    "type": "object",
+                    "properties": {
+                        "path": { "type": "string", "minLength": 1 },
+                        "format": { "type": "string", "enum": ["chrome", "otlp"] },
+                        "sample_rate": { "type": "number", "minimum": 0, "maximum": 1 },
+                        "service_name": { "type": "string" },
+                        "flush_interval_ms": { "type": "integer", "minimum": 1 },
+                        "max_pending": { "type": "integer", "minimum": 1 }
+                    },
+                    "required": ["path"]
+                },
+                "buffer_pool": {
+                    "type": "object",
+                    "properties": {
+                        "hugepages": { "type": "boolean" },
+                        "max_cached_bytes": { "type": "integer", "minimum": 0 }
+                    }
                 }
             },
             "required": ["proxy", "direction", "exported_rpcs"]
@@ -136,22 +287,161 @@ class ProviderImpl : public tl::provider<ProviderImpl>, std::enable_shared_from_
         m_is_input = json_config["direction"] == "in" || json_config["direction"] == "inout";
         m_is_output = json_config["direction"] == "out" || json_config["direction"] == "inout";
 
-        if(m_is_input && target.is_null()) {
-            throw Exception("Input proxy needs a provider to redirect input to");
+        m_instrumented = json_config.value("instrumentation", false);
+
+        if(json_config.contains("tracing")) {
+            auto& tracing = json_config["tracing"];
+            m_tracer = std::make_unique<Tracer>(
+                m_engine, m_proxy_pool,
+                tracing["path"].get<std::string>(),
+                tracing.value("format", "chrome") == "otlp" ? Tracer::Format::OTLP
+                                                            : Tracer::Format::Chrome,
+                tracing.value("service_name", "kage"),
+                get_provider_id(),
+                tracing.value("sample_rate", 1.0),
+                tracing.value("flush_interval_ms", uint64_t{1000}),
+                tracing.value("max_pending", size_t{65536}));
+        }
+
+        // Payload buffers are shared by all the providers of the process
+        if(json_config.contains("buffer_pool")) {
+            auto& buffer_pool = json_config["buffer_pool"];
+            BufferPool::Get().configure(
+                buffer_pool.value("hugepages", false),
+                buffer_pool.value("max_cached_bytes", size_t{4} << 20));
+        }
+
+        // Output-side fair queueing
+        if(m_is_output && json_config.contains("fair_queueing")) {
+            auto& fair = json_config["fair_queueing"];
+            m_fair_by_source = fair.value("classify_by", "source") == "source";
+            std::unordered_map<std::string, double> weights;
+            if(fair.contains("weights"))
+                weights = fair["weights"].get<std::unordered_map<std::string, double>>();
+            m_fair_scheduler = std::make_unique<FairScheduler>(
+                fair["max_in_flight"].get<size_t>(),
+                fair.value("max_queued", size_t{1024}),
+                fair.value("quantum", uint64_t{65536}),
+                fair.value("default_weight", 1.0),
+                std::move(weights));
+        }
+
+        // Output-side adaptive concurrency limit
+        if(m_is_output && json_config.contains("adaptive_limit")) {
+            auto& limit = json_config["adaptive_limit"];
+            m_adaptive_limiter = std::make_unique<AdaptiveLimiter>(
+                AdaptiveLimiter::AlgorithmFromString(limit.value("algorithm", "gradient")),
+                limit.value("initial_limit", size_t{20}),
+                limit.value("min_limit", size_t{1}),
+                limit.value("max_limit", size_t{1000}),
+                limit.value("tolerance", 2.0),
+                limit.value("backoff_ratio", 0.9),
+                limit.value("smoothing", 0.2),
+                limit.value("min_rtt_window", uint64_t{1000}));
+            if(m_fair_scheduler)
+                m_fair_scheduler->setSlots(m_adaptive_limiter->limit());
+        }
+
+        // Input-side admission control
+        bool use_priority = false;
+        if(m_is_input && json_config.contains("input")) {
+            auto& input = json_config["input"];
+            use_priority = input.value("queue", "fifo") == "priority";
+            if(input.contains("max_in_flight"))
+                m_input_bulkhead = std::make_unique<Bulkhead>(
+                    input["max_in_flight"].get<size_t>(),
+                    input.value("max_queued", size_t{1024}),
+                    use_priority);
+        }
+        if(m_is_input && !targets.empty()) {
+            auto routing = json_config.contains("input")
+                         ? json_config["input"].value("routing", json::object())
+                         : json::object();
+            m_targets = std::make_shared<TargetGroup>(
+                targets,
+                TargetGroup::PolicyFromString(routing.value("policy", "round_robin")),
+                routing.value("hash_offset", size_t{0}),
+                routing.value("hash_length", size_t{0}));
         }
 
         // Export RPCs
         auto& rpcs = json_config["exported_rpcs"];
-        for(auto& name : rpcs) {
+        for(auto& rpc_config : rpcs) {
+            auto& name = rpc_config.is_string()
+                       ? rpc_config.get_ref<const std::string&>()
+                       : rpc_config["name"].get_ref<const std::string&>();
             auto client_proc = get_engine().define(name);
+            tl::pool rpc_pool;
+            if(rpc_config.is_object() && rpc_config.contains("pool")) {
+                auto& pool_name = rpc_config["pool"].get_ref<const std::string&>();
+                auto pool_it = m_pools.find(pool_name);
+                if(pool_it == m_pools.end())
+                    throw Exception{fmt::format(
+                        "Pool \"{}\" requested by RPC \"{}\" was not provided", pool_name, name)};
+                rpc_pool = pool_it->second;
+            }
             if(m_is_output) {
                 auto rpc = RPC{
-                    define(name, &ProviderImpl::forwardRPCtoOutput, m_rpc_pool),
+                    define(name, &ProviderImpl::forwardRPCtoOutput,
+                           rpc_pool.is_null() ? m_rpc_pool : rpc_pool),
                     name, client_proc.id()};
+                if(rpc_config.is_object()) {
+                    rpc.one_way = rpc_config.value("one_way", false);
+                    rpc.deadline_ns = static_cast<uint64_t>(
+                        rpc_config.value("deadline_ms", 0.0) * 1e6);
+                }
+                if(rpc_config.is_object() && rpc_config.contains("rate_limit")) {
+                    auto& limit = rpc_config["rate_limit"];
+                    auto per_source = limit.value("per_source", false);
+                    rpc.rate_limiter = std::make_unique<RateLimiter>(
+                        m_engine,
+                        limit["rate"].get<double>(),
+                        limit.value("burst", 1),
+                        per_source ? limit.value("source_buckets", 64) : 1,
+                        limit.value("max_queued", 0));
+                }
+                if(m_instrumented)
+                    rpc.stages = std::make_unique<StageStatistics>();
                 m_rpcs.insert(std::make_pair(rpc.proc.id(), std::move(rpc)));
             }
             if(m_is_input) {
                 auto rpc = RPC{std::move(client_proc), name, client_proc.id()};
+                rpc.input_side = true;
+                rpc.pool = rpc_pool;
+                if(rpc_config.is_object() && rpc_config.contains("target")) {
+                    auto& target = rpc_config["target"];
+                    auto& address = target["address"].get_ref<const std::string&>();
+                    tl::endpoint endpoint;
+                    try {
+                        endpoint = m_engine.lookup(address);
+                    } catch(const std::exception& ex) {
+                        throw Exception{fmt::format(
+                            "Could not look up target {} of RPC \"{}\": {}", address, name, ex.what())};
+                    }
+                    rpc.targets = std::make_shared<TargetGroup>(
+                        std::vector<tl::provider_handle>{
+                            tl::provider_handle{endpoint, target["provider_id"].get<uint16_t>()}},
+                        TargetGroup::Policy::RoundRobin);
+                } else if(m_targets) {
+                    rpc.targets = m_targets;
+                } else {
+                    throw Exception("Input proxy needs a provider to redirect input to");
+                }
+                for(size_t i = 0; i < rpc.targets->size(); ++i)
+                    rpc.handles.push_back(std::make_unique<HandlePool>(rpc.proc, (*rpc.targets)[i]));
+                if(rpc_config.is_object() && rpc_config.contains("input")) {
+                    auto& input = rpc_config["input"];
+                    rpc.priority = input.value("priority", int64_t{0});
+                    if(input.contains("max_in_flight"))
+                        rpc.bulkhead = std::make_unique<Bulkhead>(
+                            input["max_in_flight"].get<size_t>(),
+                            input.value("max_queued", size_t{1024}),
+                            use_priority);
+                }
+                if(rpc.bulkhead || m_input_bulkhead)
+                    rpc.queue_wait = std::make_unique<Histogram>();
+                if(m_instrumented)
+                    rpc.stages = std::make_unique<StageStatistics>();
                 m_rpcs.insert(std::make_pair(rpc.proc.id(), std::move(rpc)));
             }
         }
@@ -169,6 +459,7 @@ class ProviderImpl : public tl::provider<ProviderImpl>, std::enable_shared_from_
         if(m_backend) {
             m_backend->destroy();
         }
+        m_tracer.reset();
         if(m_is_output) {
             for(auto& p : m_rpcs) {
                 p.second.proc.deregister();
@@ -194,6 +485,51 @@ class ProviderImpl : public tl::provider<ProviderImpl>, std::enable_shared_from_
         return config.dump();
     }
 
+    Result<bool> waitReady(uint64_t timeout_ns) const {
+        if(!m_backend)
+            return Result<bool>{ErrorCode::Unavailable, "Provider has no backend"};
+        return m_backend->waitReady(timeout_ns);
+    }
+
+    std::string getStatistics() const {
+        auto stats = json::object();
+        auto& rpcs = stats["rpcs"] = json::object();
+        for(auto& p : m_rpcs) {
+            auto& rpc = p.second;
+            // in "inout" mode, an RPC has an entry for each side
+            auto& rpc_stats = rpcs[rpc.name][rpc.input_side ? "input" : "output"];
+            rpc_stats = json::object();
+            if(rpc.rate_limiter)
+                rpc_stats["rate_limit"] = rpc.rate_limiter->statistics();
+            if(rpc.bulkhead)
+                rpc_stats["bulkhead"] = rpc.bulkhead->statistics();
+            if(rpc.queue_wait)
+                rpc_stats["queue_wait"] = rpc.queue_wait->toJson();
+            if(rpc.stages)
+                rpc_stats["stages"] = rpc.stages->toJson();
+            if(rpc.targets && rpc.targets != m_targets)
+                rpc_stats["targets"] = rpc.targets->statistics();
+        }
+        if(m_fair_scheduler)
+            stats["fair_queueing"] = m_fair_scheduler->statistics();
+        if(m_adaptive_limiter)
+            stats["adaptive_limit"] = m_adaptive_limiter->statistics();
+        if(m_input_bulkhead)
+            stats["input"] = m_input_bulkhead->statistics();
+        if(m_targets)
+            stats["targets"] = m_targets->statistics();
+        stats["expired"] = json{
+            {"output", m_expired_output.load(std::memory_order_relaxed)},
+            {"input", m_expired_input.load(std::memory_order_relaxed)}
+        };
+        if(m_backend)
+            stats["proxy"] = json::parse(m_backend->getStatistics());
+        if(m_tracer)
+            stats["tracing"] = m_tracer->statistics();
+        stats["buffer_pool"] = BufferPool::Get().statistics();
+        return stats.dump();
+    }
+
     Result<bool> createProxy(const std::string& proxy_type,
                              const json& proxy_config) {
 
@@ -226,42 +562,227 @@ class ProviderImpl : public tl::provider<ProviderImpl>, std::enable_shared_from_
         auto payload_size = HG_Get_input_payload_size(req.native_handle());
         // find the corresponding client RPC
         auto it = m_rpcs.find(rpc_id);
-        auto client_rpc_id = it->second.client_rpc_id;
+        auto& rpc = it->second;
+        auto client_rpc_id = rpc.client_rpc_id;
+        // the deadline includes the time spent in admission control
+        auto deadline_ns = rpc.deadline_ns ? RequestContext::now() + rpc.deadline_ns : 0;
+        // admission control
+        if(rpc.rate_limiter) {
+            size_t source_hash = 0;
+            if(rpc.rate_limiter->isPerSource())
+                source_hash = std::hash<std::string>{}(
+                    static_cast<std::string>(req.get_endpoint()));
+            if(!rpc.rate_limiter->acquire(source_hash)) {
+                debug("Rate limit exceeded for RPC {}", rpc.name);
+                respondWithError(req);
+                return;
+            }
+        }
+        // fair share of the backend among clients
+        struct FairSlot {
+            FairScheduler* scheduler = nullptr;
+            ~FairSlot() { if(scheduler) scheduler->release(); }
+        } fair_slot;
+        if(m_fair_scheduler) {
+            auto flow = m_fair_by_source ? static_cast<std::string>(req.get_endpoint()) : rpc.name;
+            if(!m_fair_scheduler->acquire(flow, payload_size)) {
+                debug("Fair queue full, rejecting RPC {}", rpc.name);
+                respondWithError(req);
+                return;
+            }
+            fair_slot.scheduler = m_fair_scheduler.get();
+        }
+        // latency-driven limit. With fair queueing, the limit sets the number
+        // of fair slots, so that a request that waited for its turn is not
+        // rejected by the limiter afterwards. Without it, requests above the
+        // limit are rejected rather than queued.
+        struct LimitSlot {
+            AdaptiveLimiter* limiter   = nullptr;
+            FairScheduler*   scheduler = nullptr;
+            uint64_t         rtt_ns    = 0;
+            bool             dropped   = false;
+            ~LimitSlot() {
+                if(!limiter) return;
+                limiter->release(rtt_ns, dropped);
+                if(scheduler) scheduler->setSlots(limiter->limit());
+            }
+        } limit_slot;
+        if(m_adaptive_limiter && m_fair_scheduler) {
+            m_adaptive_limiter->acquire();
+            limit_slot.limiter = m_adaptive_limiter.get();
+            limit_slot.scheduler = m_fair_scheduler.get();
+        } else if(m_adaptive_limiter) {
+            if(!m_adaptive_limiter->tryAcquire()) {
+                debug("Adaptive limit reached, rejecting RPC {}", rpc.name);
+                respondWithError(req);
+                return;
+            }
+            limit_slot.limiter = m_adaptive_limiter.get();
+        }
+        bool responded = false;
+        RequestContext context;
+        context.instrumented = m_instrumented;
+        context.one_way      = rpc.one_way;
+        context.deadline_ns  = deadline_ns;
+        if(context.expired()) {
+            debug("Deadline expired before forwarding RPC {}", rpc.name);
+            m_expired_output.fetch_add(1, std::memory_order_relaxed);
+            respondWithError(req);
+            return;
+        }
+        if(m_tracer && m_tracer->sample()) m_tracer->start(context);
+        context.stamp(RequestContext::HandlerStart);
         Deserializer deserializer{
             payload_size,
-            [this, client_rpc_id, &req](const char* input, size_t input_size) {
-                auto send_response = [&req](const char * output, size_t output_size) {
+            [this, client_rpc_id, &req, &responded, &context, &limit_slot](const char* input, size_t input_size) {
+                auto send_response = [&req, &responded, &context](const char * output, size_t output_size) {
                     Serializer serializer{output, output_size};
                     req.respond(serializer);
+                    responded = true;
+                    context.stamp(RequestContext::Responded);
                 };
-                m_backend->forwardOutput(client_rpc_id, input, input_size, send_response);
+                // an exception from the backend counts as a drop
+                limit_slot.dropped = true;
+                auto t_start = RequestContext::now();
+                auto result = m_backend->forwardOutput(
+                    client_rpc_id, input, input_size, send_response, context);
+                if(!context.one_way) limit_slot.rtt_ns = RequestContext::now() - t_start;
+                limit_slot.dropped = !result.success();
+                if(!result.success())
+                    error("Backend failed to forward RPC: {}", result.error());
             }
         };
         req.get_input().unpack(deserializer);
+        if(rpc.stages) rpc.stages->recordOutput(context);
+        if(!responded) respondWithError(req);
+        if(m_tracer && context.trace_id) m_tracer->recordOutput(rpc.name, context);
+    }
+
+    /**
+     * The client's RPC has no notion of a kage error, so requests that
+     * kage cannot forward are answered with an empty response, which the
+     * client fails to deserialize instead of waiting forever.
+     * One-way RPCs also get this response, once the request is sent.
+     */
+    void respondWithError(const tl::request& req) {
+        Serializer serializer{nullptr, 0};
+        req.respond(serializer);
     }
 
     Result<bool> forwardRPCtoInput(
             hg_id_t client_rpc_id, const char* input, size_t input_size,
-            const std::function<void(const char*, size_t)>& output_cb) {
-        Result<bool> result;
+            OutputCallback output_cb,
+            RequestContext& context) {
         auto rpc_it = m_rpcs.find(client_rpc_id);
-        if(rpc_it == m_rpcs.end()) {
-            result.success() = false;
-            result.error() = "Provider received unknow RPC id";
-            return result;
-        }
+        if(rpc_it == m_rpcs.end())
+            return Result<bool>{ErrorCode::InvalidRPC, "Provider received unknown RPC id"};
         auto& rpc = rpc_it->second;
 
-        Serializer serializer{input, input_size};
-        auto output = rpc.proc.on(m_target)(serializer);
-        auto payload_size = HG_Get_output_payload_size(output.native_handle());
+        // The client no longer waits for requests past their deadline
+        if(context.expired())
+            return expireInput(rpc, output_cb);
+
+        // Bound the number of requests in flight towards the target
+        struct Permits {
+            Bulkhead* rpc_bulkhead    = nullptr;
+            Bulkhead* global_bulkhead = nullptr;
+            ~Permits() {
+                if(global_bulkhead) global_bulkhead->release();
+                if(rpc_bulkhead) rpc_bulkhead->release();
+            }
+        } permits;
+        if(rpc.queue_wait) {
+            auto t_start = std::chrono::steady_clock::now();
+            if(rpc.bulkhead) {
+                if(!rpc.bulkhead->acquire(rpc.priority))
+                    return rejectInput(rpc, output_cb);
+                permits.rpc_bulkhead = rpc.bulkhead.get();
+            }
+            if(m_input_bulkhead) {
+                if(!m_input_bulkhead->acquire(rpc.priority))
+                    return rejectInput(rpc, output_cb);
+                permits.global_bulkhead = m_input_bulkhead.get();
+            }
+            rpc.queue_wait->record(std::chrono::steady_clock::now() - t_start);
+            if(context.expired())
+                return expireInput(rpc, output_cb);
+        }
 
-        Deserializer deserializer{payload_size, output_cb};
-        output.unpack(deserializer);
+        Result<bool> result;
+        if(rpc.pool.is_null()) {
+            result = callTarget(rpc, input, input_size, output_cb, context);
+        } else {
+            // Dispatch the call to the target in the RPC's own pool. The
+            // output callback must run before returning, so the calling ULT
+            // still waits for the call: joining only suspends that ULT, not
+            // its xstream, and the pool isolates the xstreams running target
+            // calls rather than shortening the caller's wait.
+            auto ult = rpc.pool.make_thread([&]() {
+                result = callTarget(rpc, input, input_size, output_cb, context);
+            });
+            ult->join();
+        }
+        if(rpc.stages) rpc.stages->recordInput(context);
+        if(m_tracer && context.trace_id) m_tracer->recordInput(rpc.name, context);
+        return result;
+    }
 
+    Result<bool> callTarget(
+            RPC& rpc, const char* input, size_t input_size,
+            OutputCallback output_cb,
+            RequestContext& context) {
+        Result<bool> result;
+        bool responded = false;
+        auto target = rpc.targets->select(input, input_size);
+        auto ticket = rpc.targets->track(target);
+        auto handle = rpc.handles[target]->acquire();
+        try {
+            Serializer serializer{input, input_size};
+            context.stamp(RequestContext::TargetStart);
+            auto output = (*handle)(serializer);
+            context.stamp(RequestContext::TargetEnd);
+            auto payload_size = HG_Get_output_payload_size(output.native_handle());
+
+            Deserializer deserializer{payload_size,
+                [&output_cb, &responded](const char* data, size_t size) {
+                    responded = true;
+                    output_cb(data, size);
+                }};
+            output.unpack(deserializer);
+        } catch(const std::exception& ex) {
+            error("Error when forwarding RPC {} to target: {}", rpc.name, ex.what());
+            handle.discard();
+            if(!responded) output_cb(nullptr, 0);
+            result.success() = false;
+            result.error() = ex.what();
+        }
         return result;
     }
 
+    /**
+     * The backend waits for a response for each input request,
+     * so a rejected request is still answered, with an empty output.
+     */
+    Result<bool> rejectInput(const RPC& rpc,
+                             OutputCallback output_cb) {
+        debug("Input queue full for RPC {}, rejecting request", rpc.name);
+        output_cb(nullptr, 0);
+        return Result<bool>{ErrorCode::Rejected,
+                            "Too many requests queued towards the target provider"};
+    }
+
+    /**
+     * Requests whose deadline expired are answered with an
+     * empty output too, without calling the target.
+     */
+    Result<bool> expireInput(const RPC& rpc,
+                             OutputCallback output_cb) {
+        debug("Deadline expired before calling the target for RPC {}", rpc.name);
+        m_expired_input.fetch_add(1, std::memory_order_relaxed);
+        output_cb(nullptr, 0);
+        return Result<bool>{ErrorCode::Timeout, "Request deadline expired"};
+    }
+
 };
 
 }
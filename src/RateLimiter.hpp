@@ -0,0 +1,146 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_RATE_LIMITER_HPP
+#define __KAGE_RATE_LIMITER_HPP
+
+#include <thallium.hpp>
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+namespace kage {
+
+namespace tl = thallium;
+
+/**
+ * @brief Token-bucket rate limiter implemented as a GCRA
+ * (generic cell rate algorithm): each bucket is a single atomic
+ * "theoretical arrival time", so admitting a request under the limit
+ * costs one load and one compare-and-swap, without any lock.
+ *
+ * When per-source limiting is enabled, sources are hashed onto a fixed
+ * number of buckets, so that the hot path never has to insert in a map.
+ * Sources that collide share the same bucket.
+ *
+ * Requests above the limit are either rejected immediately or, if
+ * max_queued > 0, delayed until they conform, with at most max_queued
+ * requests waiting at any time.
+ */
+class RateLimiter {
+
+    using clock = std::chrono::steady_clock;
+
+    struct alignas(64) Bucket {
+        std::atomic<int64_t> tat{0};
+    };
+
+    tl::engine            m_engine;
+    int64_t               m_interval;  // ns between two requests
+    int64_t               m_tolerance; // ns of accumulated credit (burst)
+    size_t                m_max_queued;
+    std::vector<Bucket>   m_buckets;
+    std::atomic<size_t>   m_queued{0};
+    std::atomic<uint64_t> m_admitted{0};
+    std::atomic<uint64_t> m_delayed{0};
+    std::atomic<uint64_t> m_rejected{0};
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock::now().time_since_epoch()).count();
+    }
+
+    public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param engine Engine used to sleep delayed requests.
+     * @param rate Number of requests per second.
+     * @param burst Number of requests that can be admitted back to back.
+     * @param num_buckets Number of buckets (1 if not per-source).
+     * @param max_queued Maximum number of delayed requests.
+     */
+    RateLimiter(const tl::engine& engine, double rate, size_t burst,
+                size_t num_buckets, size_t max_queued)
+    : m_engine{engine}
+    , m_interval{static_cast<int64_t>(1e9 / rate)}
+    , m_tolerance{m_interval * static_cast<int64_t>(burst > 0 ? burst - 1 : 0)}
+    , m_max_queued{max_queued}
+    , m_buckets(num_buckets > 0 ? num_buckets : 1) {}
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    /**
+     * @brief Whether the limiter distinguishes sources.
+     */
+    bool isPerSource() const {
+        return m_buckets.size() > 1;
+    }
+
+    /**
+     * @brief Admit a request, possibly after sleeping if it
+     * does not conform yet and there is room in the queue.
+     *
+     * @param source_hash Hash of the source (ignored if not per-source).
+     *
+     * @return false if the request was rejected.
+     */
+    bool acquire(size_t source_hash = 0) {
+        auto& bucket = m_buckets[source_hash % m_buckets.size()];
+        const int64_t max_delay = m_interval * static_cast<int64_t>(m_max_queued);
+        const int64_t t = now();
+        int64_t tat = bucket.tat.load(std::memory_order_relaxed);
+        int64_t delay;
+        // whether this request holds one of the max_queued places, which
+        // is reserved before the bucket is updated so that concurrent
+        // requests cannot all see the queue below its bound
+        bool queued = false;
+        while(true) {
+            const int64_t new_tat = std::max(tat, t) + m_interval;
+            delay = new_tat - t - m_interval - m_tolerance;
+            if(delay > 0 && !queued && delay <= max_delay) {
+                queued = m_queued.fetch_add(1, std::memory_order_relaxed) < m_max_queued;
+                if(!queued) m_queued.fetch_sub(1, std::memory_order_relaxed);
+            }
+            if(delay > 0 && (delay > max_delay || !queued)) {
+                if(queued) m_queued.fetch_sub(1, std::memory_order_relaxed);
+                m_rejected.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if(bucket.tat.compare_exchange_weak(tat, new_tat,
+                    std::memory_order_acq_rel, std::memory_order_relaxed))
+                break;
+        }
+        if(delay <= 0 && queued)
+            m_queued.fetch_sub(1, std::memory_order_relaxed);
+        if(delay > 0) {
+            tl::thread::sleep(m_engine, static_cast<double>(delay) / 1e6);
+            m_queued.fetch_sub(1, std::memory_order_relaxed);
+            m_delayed.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_admitted.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief Return counters as a JSON object.
+     */
+    nlohmann::json statistics() const {
+        return nlohmann::json{
+            {"admitted", m_admitted.load()},
+            {"delayed", m_delayed.load()},
+            {"rejected", m_rejected.load()},
+            {"queued", m_queued.load()}
+        };
+    }
+};
+
+}
+
+#endif
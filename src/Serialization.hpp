@@ -9,7 +9,7 @@
 #include <thallium.hpp>
 #include <mercury_proc.h>
 #include <kage/Backend.hpp>
-#include <functional>
+#include <utility>
 
 namespace kage {
 
@@ -32,14 +32,20 @@ class Serializer {
     }
 };
 
+/**
+ * Deserializer calling a callback on the payload, in place in Mercury's
+ * buffer. It is templated on the type of the callback (usually a lambda)
+ * so that the call is resolved at compile time and can be inlined.
+ */
+template<typename Callback>
 class Deserializer {
 
-    size_t                                   m_data_size;
-    std::function<void(const char*, size_t)> m_callback;
+    size_t   m_data_size;
+    Callback m_callback;
 
     public:
 
-    Deserializer(size_t size, std::function<void(const char*, size_t)> cb)
+    Deserializer(size_t size, Callback cb)
     : m_data_size(size), m_callback{std::move(cb)} {}
 
     template<typename A>
@@ -0,0 +1,177 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_STATISTICS_HPP
+#define __KAGE_STATISTICS_HPP
+
+#include <kage/RequestContext.hpp>
+#include <nlohmann/json.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace kage {
+
+/**
+ * @brief Lock-free latency histogram with power-of-two buckets.
+ * Bucket i counts values in [2^(i-1), 2^i) nanoseconds, so percentiles
+ * reported by toJson() are upper bounds within a factor of 2.
+ */
+class Histogram {
+
+    static constexpr size_t num_buckets = 65;
+
+    std::array<std::atomic<uint64_t>, num_buckets> m_buckets{};
+    std::atomic<uint64_t>                          m_count{0};
+    std::atomic<uint64_t>                          m_sum{0};
+    std::atomic<uint64_t>                          m_max{0};
+
+    static size_t bucketOf(uint64_t value) {
+        return value == 0 ? 0 : 64 - __builtin_clzll(value);
+    }
+
+    uint64_t percentile(double p, uint64_t count) const {
+        auto threshold = static_cast<uint64_t>(p * count);
+        uint64_t seen = 0;
+        for(size_t i = 0; i < num_buckets; ++i) {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if(seen > threshold)
+                return i == 0 ? 0 : (i == 64 ? UINT64_MAX : (uint64_t{1} << i));
+        }
+        return m_max.load(std::memory_order_relaxed);
+    }
+
+    public:
+
+    /**
+     * @brief Record a value in nanoseconds.
+     */
+    void record(uint64_t value) {
+        m_buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+        auto max = m_max.load(std::memory_order_relaxed);
+        while(value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+    }
+
+    /**
+     * @brief Record a duration.
+     */
+    template<typename Rep, typename Period>
+    void record(const std::chrono::duration<Rep, Period>& d) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        record(ns > 0 ? static_cast<uint64_t>(ns) : 0);
+    }
+
+    /**
+     * @brief Number of recorded values.
+     */
+    uint64_t count() const {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Return count, average, maximum and approximate
+     * percentiles, in nanoseconds, as a JSON object.
+     */
+    nlohmann::json toJson() const {
+        auto count = m_count.load(std::memory_order_relaxed);
+        auto sum   = m_sum.load(std::memory_order_relaxed);
+        return nlohmann::json{
+            {"count", count},
+            {"avg_ns", count ? sum / count : 0},
+            {"max_ns", m_max.load(std::memory_order_relaxed)},
+            {"p50_ns", count ? percentile(0.50, count) : 0},
+            {"p90_ns", count ? percentile(0.90, count) : 0},
+            {"p99_ns", count ? percentile(0.99, count) : 0}
+        };
+    }
+};
+
+/**
+ * @brief Per-stage latency histograms of instrumented requests.
+ *
+ * On the output side, the time between the Mercury handler and the backend
+ * (admission), the time spent in the remote provider as reported by the
+ * input side (remote_queue, remote_target, remote_response), what remains
+ * of the round trip (wire, which includes the remote backend's own
+ * queueing, e.g. in its polling loop), and the time to respond to the
+ * client. On the input side, the queueing before calling the target and
+ * the target's latency. Stages a request did not go through are skipped.
+ *
+ * Each side only records its own stages: with a backend that does not
+ * cross a link (e.g. passthrough), both sides stamp the same context.
+ */
+class StageStatistics {
+
+    using Stage = RequestContext::Stage;
+
+    Histogram m_admission;
+    Histogram m_wire;
+    Histogram m_remote_queue;
+    Histogram m_remote_target;
+    Histogram m_remote_response;
+    Histogram m_respond;
+    Histogram m_total;
+    Histogram m_queue;
+    Histogram m_target;
+
+    void recordStage(Histogram& h, const RequestContext& ctx, Stage from, Stage to) {
+        if(ctx.reached(from, to)) h.record(ctx.elapsed(from, to));
+    }
+
+    public:
+
+    /**
+     * @brief Record the output-side stages of a request.
+     */
+    void recordOutput(const RequestContext& ctx) {
+        if(!ctx.instrumented) return;
+        recordStage(m_admission, ctx, RequestContext::HandlerStart, RequestContext::BackendSend);
+        if(ctx.reached(RequestContext::BackendSend, RequestContext::ResponseReceived)) {
+            auto round_trip = ctx.elapsed(RequestContext::BackendSend, RequestContext::ResponseReceived);
+            auto remote = ctx.remote_queue_ns + ctx.remote_target_ns + ctx.remote_response_ns;
+            m_wire.record(round_trip > remote ? round_trip - remote : 0);
+            if(remote) {
+                m_remote_queue.record(ctx.remote_queue_ns);
+                m_remote_target.record(ctx.remote_target_ns);
+                m_remote_response.record(ctx.remote_response_ns);
+            }
+        }
+        recordStage(m_respond, ctx, RequestContext::ResponseReceived, RequestContext::Responded);
+        recordStage(m_total, ctx, RequestContext::HandlerStart, RequestContext::Responded);
+    }
+
+    /**
+     * @brief Record the input-side stages of a request.
+     */
+    void recordInput(const RequestContext& ctx) {
+        if(!ctx.instrumented) return;
+        recordStage(m_queue, ctx, RequestContext::RemoteReceived, RequestContext::TargetStart);
+        recordStage(m_target, ctx, RequestContext::TargetStart, RequestContext::TargetEnd);
+    }
+
+    nlohmann::json toJson() const {
+        auto stats = nlohmann::json::object();
+        auto add = [&stats](const char* name, const Histogram& h) {
+            if(h.count()) stats[name] = h.toJson();
+        };
+        add("admission", m_admission);
+        add("wire", m_wire);
+        add("remote_queue", m_remote_queue);
+        add("remote_target", m_remote_target);
+        add("remote_response", m_remote_response);
+        add("respond", m_respond);
+        add("total", m_total);
+        add("queue", m_queue);
+        add("target", m_target);
+        return stats;
+    }
+};
+
+}
+
+#endif
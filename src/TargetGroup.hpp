@@ -0,0 +1,191 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_TARGET_GROUP_HPP
+#define __KAGE_TARGET_GROUP_HPP
+
+#include "Hash.hpp"
+#include <thallium.hpp>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kage {
+
+namespace tl = thallium;
+
+/**
+ * @brief Set of replicas of the target provider that an input
+ * provider spreads its requests across.
+ *
+ * - round_robin sends each request to the next target in turn.
+ * - least_in_flight sends each request to the target with the fewest
+ *   requests in flight from this provider (ties go to the lowest index).
+ * - hash hashes hash_length bytes of the payload starting at hash_offset
+ *   (see HashPayloadRange) onto a consistent-hash ring, so requests with
+ *   the same key always land on the same target, and adding or removing a
+ *   target only moves the keys of the ring segments it owns.
+ */
+class TargetGroup {
+
+    public:
+
+    enum class Policy { RoundRobin, LeastInFlight, Hash };
+
+    private:
+
+    struct Target {
+        tl::provider_handle   handle;
+        std::atomic<uint64_t> in_flight{0};
+        std::atomic<uint64_t> requests{0};
+
+        explicit Target(tl::provider_handle h)
+        : handle{std::move(h)} {}
+    };
+
+    static constexpr size_t virtual_nodes = 64;
+
+    std::vector<std::unique_ptr<Target>>     m_targets;
+    Policy                                   m_policy;
+    size_t                                   m_hash_offset;
+    size_t                                   m_hash_length;
+    std::vector<std::pair<uint64_t, size_t>> m_ring;
+    std::atomic<size_t>                      m_next{0};
+
+    public:
+
+    /**
+     * @brief RAII ticket counting a request in flight towards a target.
+     */
+    class Ticket {
+
+        Target* m_target;
+
+        public:
+
+        explicit Ticket(Target* target)
+        : m_target{target} {
+            m_target->in_flight.fetch_add(1, std::memory_order_relaxed);
+            m_target->requests.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+
+        ~Ticket() {
+            m_target->in_flight.fetch_sub(1, std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param targets Target providers.
+     * @param policy Routing policy.
+     * @param hash_offset Offset of the hashed bytes in the payload.
+     * @param hash_length Number of hashed bytes (0 means up to the end).
+     */
+    TargetGroup(const std::vector<tl::provider_handle>& targets,
+                Policy policy, size_t hash_offset = 0, size_t hash_length = 0)
+    : m_policy{policy}
+    , m_hash_offset{hash_offset}
+    , m_hash_length{hash_length}
+    {
+        for(auto& target : targets)
+            m_targets.push_back(std::make_unique<Target>(target));
+        if(m_policy != Policy::Hash) return;
+        for(size_t i = 0; i < m_targets.size(); ++i) {
+            auto name = static_cast<std::string>(m_targets[i]->handle)
+                      + ":" + std::to_string(m_targets[i]->handle.provider_id());
+            auto h = FNV1a(name.data(), name.size());
+            for(size_t v = 0; v < virtual_nodes; ++v) {
+                m_ring.emplace_back(FNV1a(reinterpret_cast<const char*>(&v), sizeof(v), h), i);
+            }
+        }
+        std::sort(m_ring.begin(), m_ring.end());
+    }
+
+    TargetGroup(const TargetGroup&) = delete;
+    TargetGroup& operator=(const TargetGroup&) = delete;
+
+    /**
+     * @brief Parses a policy name from the configuration.
+     */
+    static Policy PolicyFromString(const std::string& name) {
+        if(name == "least_in_flight") return Policy::LeastInFlight;
+        if(name == "hash") return Policy::Hash;
+        return Policy::RoundRobin;
+    }
+
+    size_t size() const {
+        return m_targets.size();
+    }
+
+    const tl::provider_handle& operator[](size_t index) const {
+        return m_targets[index]->handle;
+    }
+
+    /**
+     * @brief Index of the target to send the given payload to.
+     */
+    size_t select(const char* data, size_t size) {
+        if(m_targets.size() == 1) return 0;
+        switch(m_policy) {
+        case Policy::LeastInFlight: {
+            size_t best = 0;
+            auto best_count = m_targets[0]->in_flight.load(std::memory_order_relaxed);
+            for(size_t i = 1; i < m_targets.size() && best_count; ++i) {
+                auto count = m_targets[i]->in_flight.load(std::memory_order_relaxed);
+                if(count < best_count) {
+                    best = i;
+                    best_count = count;
+                }
+            }
+            return best;
+        }
+        case Policy::Hash: {
+            auto key = std::make_pair(
+                HashPayloadRange(data, size, m_hash_offset, m_hash_length), size_t{0});
+            auto it = std::lower_bound(m_ring.begin(), m_ring.end(), key);
+            return it == m_ring.end() ? m_ring.front().second : it->second;
+        }
+        default:
+            return m_next.fetch_add(1, std::memory_order_relaxed) % m_targets.size();
+        }
+    }
+
+    /**
+     * @brief Counts a request in flight towards the given target
+     * for as long as the returned ticket lives.
+     */
+    Ticket track(size_t index) {
+        return Ticket{m_targets[index].get()};
+    }
+
+    /**
+     * @brief Number of requests sent to and in flight towards each target.
+     */
+    nlohmann::json statistics() const {
+        auto stats = nlohmann::json::array();
+        for(auto& target : m_targets) {
+            stats.push_back(nlohmann::json{
+                {"address", static_cast<std::string>(target->handle)},
+                {"provider_id", target->handle.provider_id()},
+                {"requests", target->requests.load(std::memory_order_relaxed)},
+                {"in_flight", target->in_flight.load(std::memory_order_relaxed)}
+            });
+        }
+        return stats;
+    }
+};
+
+}
+
+#endif
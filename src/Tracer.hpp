@@ -0,0 +1,355 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_TRACER_HPP
+#define __KAGE_TRACER_HPP
+
+#include <kage/Exception.hpp>
+#include <kage/RequestContext.hpp>
+#include <thallium.hpp>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+#include <fmt/format.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace kage {
+
+namespace tl = thallium;
+
+/**
+ * @brief Writes the spans of sampled requests to a local file.
+ *
+ * The output side of a provider decides whether a request is traced and
+ * assigns it a trace id; the backends propagate the trace id and the id of
+ * the span under which the request crosses the link, so the input side
+ * emits its spans as children of it. Spans are built from the timestamps
+ * of the RequestContext once the request completes, queued in memory, and
+ * written in batches by a ULT every flush_interval_ms, so no I/O happens
+ * on the request path. When max_pending spans are waiting, new spans are
+ * dropped.
+ *
+ * Two formats are supported:
+ * - "chrome": a Chrome trace-event JSON array that Perfetto and
+ *   chrome://tracing can load. The two sides of a request are linked by
+ *   flow events. The files of several providers can be merged with
+ *   jq -s add to see a request cross them on a common time axis.
+ * - "otlp": one OTLP-JSON ExportTraceServiceRequest per line, as produced
+ *   by OpenTelemetry's file exporter.
+ *
+ * Timestamps are converted to wall-clock time, so spans from different
+ * nodes are only as aligned as their clocks.
+ */
+class Tracer {
+
+    public:
+
+    enum class Format { Chrome, OTLP };
+
+    /* Values match OTLP's SpanKind */
+    enum class Kind : uint8_t { Server = 2, Client = 3 };
+
+    struct Span {
+        std::string name;
+        uint64_t    trace_id;
+        uint64_t    span_id;
+        uint64_t    parent_span_id;
+        uint64_t    start_ns;
+        uint64_t    end_ns;
+        Kind        kind;
+        bool        remote_parent;
+    };
+
+    private:
+
+    tl::engine            m_engine;
+    std::string           m_path;
+    Format                m_format;
+    std::string           m_service_name;
+    uint16_t              m_provider_id;
+    double                m_sample_rate;
+    uint64_t              m_flush_interval_ms;
+    size_t                m_max_pending;
+    int64_t               m_wall_offset_ns;
+    std::ofstream         m_file;
+    bool                  m_first_event = true;
+    tl::mutex             m_mutex;
+    std::vector<Span>     m_pending;
+    std::atomic<bool>     m_need_stop{false};
+    std::atomic<uint64_t> m_recorded{0};
+    std::atomic<uint64_t> m_dropped{0};
+    tl::managed<tl::thread> m_writer_ult;
+
+    static std::mt19937_64& Generator() {
+        thread_local std::mt19937_64 generator{
+            std::random_device{}() ^ std::hash<std::thread::id>{}(std::this_thread::get_id())};
+        return generator;
+    }
+
+    public:
+
+    /**
+     * @brief Constructor. Opens (truncates) the file and starts the
+     * writer ULT in the given pool.
+     *
+     * @param engine Engine.
+     * @param pool Pool in which to run the writer ULT.
+     * @param path Path of the output file.
+     * @param format Output format.
+     * @param service_name Name of the process in the trace.
+     * @param provider_id Id of the provider, used as track in Chrome traces.
+     * @param sample_rate Fraction of the requests to trace.
+     * @param flush_interval_ms Interval between writes.
+     * @param max_pending Maximum number of spans waiting to be written.
+     */
+    Tracer(const tl::engine& engine, tl::pool pool,
+           std::string path, Format format, std::string service_name,
+           uint16_t provider_id, double sample_rate,
+           uint64_t flush_interval_ms, size_t max_pending)
+    : m_engine{engine}
+    , m_path{std::move(path)}
+    , m_format{format}
+    , m_service_name{std::move(service_name)}
+    , m_provider_id{provider_id}
+    , m_sample_rate{sample_rate}
+    , m_flush_interval_ms{flush_interval_ms > 0 ? flush_interval_ms : 1}
+    , m_max_pending{max_pending}
+    {
+        auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        m_wall_offset_ns = static_cast<int64_t>(wall) - static_cast<int64_t>(RequestContext::now());
+        m_file.open(m_path, std::ios::out | std::ios::trunc);
+        if(!m_file)
+            throw Exception{fmt::format("Could not open trace file {}", m_path)};
+        if(m_format == Format::Chrome) {
+            m_file << "[\n";
+            writeChromeEvent(nlohmann::json{
+                {"ph", "M"}, {"name", "process_name"}, {"pid", ::getpid()},
+                {"args", {{"name", m_service_name}}}});
+            writeChromeEvent(nlohmann::json{
+                {"ph", "M"}, {"name", "thread_name"}, {"pid", ::getpid()}, {"tid", m_provider_id},
+                {"args", {{"name", fmt::format("kage provider {}", m_provider_id)}}}});
+            m_file.flush();
+        }
+        m_writer_ult = pool.make_thread([this]{ runWriterLoop(); });
+    }
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    /**
+     * @brief Destructor. Writes the remaining spans and closes the file.
+     */
+    ~Tracer() {
+        m_need_stop.store(true);
+        if(m_writer_ult) {
+            m_writer_ult->join();
+            m_writer_ult.release();
+        }
+        if(m_format == Format::Chrome)
+            m_file << "\n]\n";
+        m_file.close();
+    }
+
+    /**
+     * @brief Random non-zero id for a trace or a span.
+     */
+    static uint64_t NewId() {
+        uint64_t id;
+        do { id = Generator()(); } while(id == 0);
+        return id;
+    }
+
+    /**
+     * @brief Whether a new request should be traced.
+     */
+    bool sample() const {
+        if(m_sample_rate >= 1.0) return true;
+        if(m_sample_rate <= 0.0) return false;
+        return std::uniform_real_distribution<double>{0.0, 1.0}(Generator()) < m_sample_rate;
+    }
+
+    /**
+     * @brief Starts tracing a request on the output side.
+     */
+    void start(RequestContext& context) const {
+        context.instrumented = true;
+        context.trace_id     = NewId();
+        context.span_id      = NewId();
+    }
+
+    /**
+     * @brief Emits the spans of a request that completed on the output side:
+     * one for the whole exported RPC and, as its child, one for its round trip
+     * through the backend, whose id was propagated to the input side.
+     */
+    void recordOutput(const std::string& rpc_name, const RequestContext& context) {
+        auto start = context.timestamps[RequestContext::HandlerStart];
+        if(!start) return;
+        auto end = context.timestamps[RequestContext::Responded];
+        if(end < start) end = RequestContext::now();
+        auto root_id = NewId();
+        std::vector<Span> spans;
+        spans.push_back(Span{rpc_name, context.trace_id, root_id, 0,
+                             start, end, Kind::Server, false});
+        if(context.reached(RequestContext::BackendSend, RequestContext::ResponseReceived))
+            spans.push_back(Span{"forward", context.trace_id, context.span_id, root_id,
+                                 context.timestamps[RequestContext::BackendSend],
+                                 context.timestamps[RequestContext::ResponseReceived],
+                                 Kind::Client, false});
+        push(std::move(spans));
+    }
+
+    /**
+     * @brief Emits the spans of a request that completed on the input side:
+     * one for the request's stay in this provider, child of the remote
+     * "forward" span, and, as its child, one for the call to the target.
+     */
+    void recordInput(const std::string& rpc_name, const RequestContext& context) {
+        auto start = context.timestamps[RequestContext::RemoteReceived];
+        if(!start) start = context.timestamps[RequestContext::TargetStart];
+        if(!start) return;
+        auto end = context.timestamps[RequestContext::ResponseSend];
+        if(!end) end = context.timestamps[RequestContext::TargetEnd];
+        if(end < start) end = RequestContext::now();
+        auto server_id = NewId();
+        std::vector<Span> spans;
+        spans.push_back(Span{rpc_name, context.trace_id, server_id, context.span_id,
+                             start, end, Kind::Server, true});
+        if(context.reached(RequestContext::TargetStart, RequestContext::TargetEnd))
+            spans.push_back(Span{"target", context.trace_id, NewId(), server_id,
+                                 context.timestamps[RequestContext::TargetStart],
+                                 context.timestamps[RequestContext::TargetEnd],
+                                 Kind::Client, false});
+        push(std::move(spans));
+    }
+
+    /**
+     * @brief Number of recorded and dropped spans.
+     */
+    nlohmann::json statistics() const {
+        return nlohmann::json{
+            {"path", m_path},
+            {"recorded", m_recorded.load(std::memory_order_relaxed)},
+            {"dropped", m_dropped.load(std::memory_order_relaxed)}
+        };
+    }
+
+    private:
+
+    void push(std::vector<Span>&& spans) {
+        std::unique_lock<tl::mutex> lock{m_mutex};
+        if(m_pending.size() + spans.size() > m_max_pending) {
+            m_dropped.fetch_add(spans.size(), std::memory_order_relaxed);
+            return;
+        }
+        for(auto& span : spans) m_pending.push_back(std::move(span));
+        m_recorded.fetch_add(spans.size(), std::memory_order_relaxed);
+    }
+
+    void runWriterLoop() {
+        std::vector<Span> batch;
+        while(true) {
+            bool stop = m_need_stop.load();
+            if(!stop) tl::thread::sleep(m_engine, m_flush_interval_ms);
+            {
+                std::unique_lock<tl::mutex> lock{m_mutex};
+                batch.swap(m_pending);
+            }
+            if(!batch.empty()) {
+                if(m_format == Format::Chrome)
+                    writeChrome(batch);
+                else
+                    writeOTLP(batch);
+                m_file.flush();
+                if(!m_file)
+                    spdlog::error("[kage] Could not write spans to trace file {}", m_path);
+                batch.clear();
+            }
+            if(stop) break;
+        }
+    }
+
+    uint64_t toWallClock(uint64_t ns) const {
+        return static_cast<uint64_t>(static_cast<int64_t>(ns) + m_wall_offset_ns);
+    }
+
+    static std::string toHex(uint64_t id) {
+        return fmt::format("{:016x}", id);
+    }
+
+    void writeChromeEvent(const nlohmann::json& event) {
+        if(!m_first_event) m_file << ",\n";
+        m_first_event = false;
+        m_file << event.dump();
+    }
+
+    void writeChrome(const std::vector<Span>& batch) {
+        auto pid = ::getpid();
+        for(auto& span : batch) {
+            auto ts = toWallClock(span.start_ns) / 1000.0;
+            writeChromeEvent(nlohmann::json{
+                {"ph", "X"}, {"name", span.name}, {"cat", "kage"},
+                {"pid", pid}, {"tid", m_provider_id},
+                {"ts", ts}, {"dur", (span.end_ns - span.start_ns) / 1000.0},
+                {"args", {
+                    {"trace_id", toHex(span.trace_id)},
+                    {"span_id", toHex(span.span_id)},
+                    {"parent_span_id", toHex(span.parent_span_id)}}}});
+            // Flow events bind the "forward" span to the remote side's span
+            if(span.kind == Kind::Client && span.name == "forward")
+                writeChromeEvent(nlohmann::json{
+                    {"ph", "s"}, {"name", "kage"}, {"cat", "kage"},
+                    {"id", toHex(span.span_id)},
+                    {"pid", pid}, {"tid", m_provider_id}, {"ts", ts}});
+            if(span.remote_parent)
+                writeChromeEvent(nlohmann::json{
+                    {"ph", "f"}, {"bp", "e"}, {"name", "kage"}, {"cat", "kage"},
+                    {"id", toHex(span.parent_span_id)},
+                    {"pid", pid}, {"tid", m_provider_id}, {"ts", ts}});
+        }
+    }
+
+    void writeOTLP(const std::vector<Span>& batch) {
+        auto spans = nlohmann::json::array();
+        for(auto& span : batch) {
+            auto s = nlohmann::json{
+                {"traceId", toHex(0) + toHex(span.trace_id)},
+                {"spanId", toHex(span.span_id)},
+                {"name", span.name},
+                {"kind", static_cast<int>(span.kind)},
+                {"startTimeUnixNano", std::to_string(toWallClock(span.start_ns))},
+                {"endTimeUnixNano", std::to_string(toWallClock(span.end_ns))},
+                {"attributes", {{
+                    {"key", "kage.provider_id"},
+                    {"value", {{"intValue", std::to_string(m_provider_id)}}}}}}
+            };
+            if(span.parent_span_id) s["parentSpanId"] = toHex(span.parent_span_id);
+            spans.push_back(std::move(s));
+        }
+        auto request = nlohmann::json{
+            {"resourceSpans", {{
+                {"resource", {{"attributes", {{
+                    {"key", "service.name"},
+                    {"value", {{"stringValue", m_service_name}}}}}}}},
+                {"scopeSpans", {{
+                    {"scope", {{"name", "kage"}}},
+                    {"spans", std::move(spans)}}}}}}}
+        };
+        m_file << request.dump() << '\n';
+    }
+};
+
+}
+
+#endif
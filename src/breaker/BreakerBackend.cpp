@@ -0,0 +1,212 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include "BreakerBackend.hpp"
+#include <nlohmann/json-schema.hpp>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+
+KAGE_REGISTER_BACKEND(breaker, BreakerProxy);
+
+using nlohmann::json;
+using nlohmann::json_schema::json_validator;
+
+static const char* stateName(BreakerProxy::State state) {
+    switch(state) {
+    case BreakerProxy::State::Open:     return "open";
+    case BreakerProxy::State::HalfOpen: return "half_open";
+    default:                            return "closed";
+    }
+}
+
+BreakerProxy::BreakerProxy(json&& config,
+                           std::shared_ptr<kage::Backend> backend,
+                           const Options& options)
+: m_config(std::move(config))
+, m_backend(std::move(backend))
+, m_options(options)
+, m_outcomes(options.window, false) {}
+
+std::string BreakerProxy::getConfig() const {
+    auto config = m_config;
+    config["backend"]["type"] = m_backend->name();
+    config["backend"]["config"] = json::parse(m_backend->getConfig());
+    return config.dump();
+}
+
+std::string BreakerProxy::getStatistics() const {
+    auto stats = json::object();
+    {
+        std::unique_lock<thallium::mutex> lock{m_mutex};
+        stats["state"] = stateName(m_state);
+        stats["requests"] = m_num_outcomes;
+        stats["failures"] = m_num_failures;
+        stats["opened"] = m_times_opened;
+        stats["fast_failed"] = m_fast_failed;
+    }
+    stats["backend"] = json::parse(m_backend->getStatistics());
+    return stats.dump();
+}
+
+void BreakerProxy::open() {
+    m_state = State::Open;
+    m_opened_at = kage::RequestContext::now();
+    m_times_opened += 1;
+    m_probes_in_flight = 0;
+    m_probes_succeeded = 0;
+    std::fill(m_outcomes.begin(), m_outcomes.end(), false);
+    m_next_outcome = 0;
+    m_num_outcomes = 0;
+    m_num_failures = 0;
+}
+
+bool BreakerProxy::admit(bool& is_probe) {
+    std::unique_lock<thallium::mutex> lock{m_mutex};
+    is_probe = false;
+    if(m_state == State::Open) {
+        if(kage::RequestContext::now() - m_opened_at < m_options.cooldown_ns) {
+            m_fast_failed += 1;
+            return false;
+        }
+        m_state = State::HalfOpen;
+    }
+    if(m_state == State::HalfOpen) {
+        if(m_probes_in_flight + m_probes_succeeded >= m_options.probes) {
+            m_fast_failed += 1;
+            return false;
+        }
+        m_probes_in_flight += 1;
+        is_probe = true;
+    }
+    return true;
+}
+
+void BreakerProxy::record(bool is_probe, bool failed) {
+    std::unique_lock<thallium::mutex> lock{m_mutex};
+    if(is_probe) {
+        // the breaker may have been opened again by another probe
+        if(m_state != State::HalfOpen) return;
+        m_probes_in_flight -= 1;
+        if(failed) {
+            open();
+        } else if(++m_probes_succeeded >= m_options.probes) {
+            m_state = State::Closed;
+            m_probes_succeeded = 0;
+        }
+        return;
+    }
+    // outcome of a request admitted before the breaker opened
+    if(m_state != State::Closed) return;
+    if(m_num_outcomes == m_outcomes.size()) {
+        if(m_outcomes[m_next_outcome]) m_num_failures -= 1;
+    } else {
+        m_num_outcomes += 1;
+    }
+    m_outcomes[m_next_outcome] = failed;
+    if(failed) m_num_failures += 1;
+    m_next_outcome = (m_next_outcome + 1) % m_outcomes.size();
+    if(m_num_outcomes >= m_options.min_requests
+    && m_num_failures >= m_options.failure_rate * m_num_outcomes)
+        open();
+}
+
+kage::Result<bool> BreakerProxy::forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                               kage::OutputCallback output_cb,
+                                               kage::RequestContext& context) {
+    bool is_probe;
+    if(!admit(is_probe))
+        return kage::Result<bool>{kage::ErrorCode::Unavailable, "Circuit breaker is open"};
+    uint64_t timeout_deadline = 0;
+    if(m_options.timeout_ns) {
+        timeout_deadline = kage::RequestContext::now() + m_options.timeout_ns;
+        if(context.deadline_ns == 0 || timeout_deadline < context.deadline_ns)
+            context.deadline_ns = timeout_deadline;
+    }
+    kage::Result<bool> result;
+    try {
+        result = m_backend->forwardOutput(rpc_id, input, input_size, output_cb, context);
+    } catch(...) {
+        record(is_probe, true);
+        throw;
+    }
+    // requests refused by the client's own RPC or by admission
+    // control say nothing about the health of the remote
+    auto code = result.code();
+    bool failed = !result.success()
+               && code != kage::ErrorCode::InvalidRPC
+               && code != kage::ErrorCode::Rejected;
+    // a backend that does not give up at the deadline still
+    // counts as failing if it answers after the timeout
+    if(timeout_deadline && kage::RequestContext::now() > timeout_deadline)
+        failed = true;
+    record(is_probe, failed);
+    return result;
+}
+
+kage::Result<uint64_t> BreakerProxy::ping(uint64_t timeout_ns) {
+    return m_backend->ping(timeout_ns);
+}
+
+kage::Result<bool> BreakerProxy::waitReady(uint64_t timeout_ns) {
+    return m_backend->waitReady(timeout_ns);
+}
+
+void BreakerProxy::setInputProxy(kage::InputProxy proxy) {
+    m_backend->setInputProxy(std::move(proxy));
+}
+
+kage::Result<bool> BreakerProxy::destroy() {
+    return m_backend->destroy();
+}
+
+std::unique_ptr<kage::Backend> BreakerProxy::create(
+        const thallium::engine& engine,
+        const json& config,
+        const thallium::pool& pool) {
+    static const json schema = R"(
+    {
+        "type": "object",
+        "properties": {
+            "backend": {
+                "type": "object",
+                "properties": {
+                    "type": {"type": "string"},
+                    "config": {"type": "object"}
+                },
+                "required": ["type"]
+            },
+            "window": {"type": "integer", "minimum": 1},
+            "min_requests": {"type": "integer", "minimum": 1},
+            "failure_rate": {"type": "number", "exclusiveMinimum": 0, "maximum": 1},
+            "cooldown_ms": {"type": "number", "minimum": 0},
+            "probes": {"type": "integer", "minimum": 1},
+            "timeout_ms": {"type": "number", "minimum": 0}
+        },
+        "required": ["backend"]
+    }
+    )"_json;
+    json_validator validator;
+    validator.set_root_schema(schema);
+    try {
+        validator.validate(config);
+    } catch(const std::exception& ex) {
+        throw kage::Exception{
+                fmt::format("While validating JSON config for breaker backend: {}", ex.what())};
+    }
+
+    Options options;
+    options.window       = config.value("window", size_t{20});
+    options.min_requests = std::min(config.value("min_requests", size_t{10}), options.window);
+    options.failure_rate = config.value("failure_rate", 0.5);
+    options.cooldown_ns  = static_cast<uint64_t>(config.value("cooldown_ms", 5000.0) * 1e6);
+    options.probes       = config.value("probes", size_t{1});
+    options.timeout_ns   = static_cast<uint64_t>(config.value("timeout_ms", 0.0) * 1e6);
+
+    std::shared_ptr<kage::Backend> backend =
+        kage::ProxyFactory::createProxy(config["backend"], engine, pool);
+
+    return std::unique_ptr<kage::Backend>(
+        new BreakerProxy{json(config), std::move(backend), options});
+}
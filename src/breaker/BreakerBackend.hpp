@@ -0,0 +1,161 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __BREAKER_BACKEND_HPP
+#define __BREAKER_BACKEND_HPP
+
+#include <kage/Backend.hpp>
+#include <thallium.hpp>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+ * Circuit breaker wrapping another kage Backend. While the breaker is
+ * closed, requests go through and the outcomes of the last "window" of
+ * them are kept. Once at least "min_requests" of them are known and the
+ * fraction of failures (errors, timeouts and exceptions) reaches
+ * "failure_rate", the breaker opens: requests then fail immediately with
+ * ErrorCode::Unavailable, without reaching the backend, for "cooldown_ms".
+ * The breaker then lets up to "probes" requests through at a time
+ * (half-open). It closes again once that many of them have succeeded, or
+ * opens again on the first failure.
+ *
+ * A "timeout_ms" bounds the time a request may take, by tightening its
+ * deadline, so that a remote that hangs counts as failing: backends that
+ * honor deadlines (e.g. margo, zmq) give up on it, and a request answered
+ * after the timeout by one that does not counts as failed. Wrapping each
+ * backend of a composite backend (e.g. hedge or hybrid) gives one breaker
+ * per endpoint.
+ */
+class BreakerProxy : public kage::Backend {
+
+    public:
+
+    enum class State { Closed, Open, HalfOpen };
+
+    struct Options {
+        size_t   window;
+        size_t   min_requests;
+        double   failure_rate;
+        uint64_t cooldown_ns;
+        size_t   probes;
+        uint64_t timeout_ns;
+    };
+
+    private:
+
+    json                           m_config;
+    std::shared_ptr<kage::Backend> m_backend;
+    Options                        m_options;
+    mutable thallium::mutex        m_mutex;
+    State                          m_state = State::Closed;
+    // Ring buffer of the last outcomes (true for failures)
+    std::vector<bool>              m_outcomes;
+    size_t                         m_next_outcome = 0;
+    size_t                         m_num_outcomes = 0;
+    size_t                         m_num_failures = 0;
+    uint64_t                       m_opened_at = 0;
+    size_t                         m_probes_in_flight = 0;
+    size_t                         m_probes_succeeded = 0;
+    uint64_t                       m_times_opened = 0;
+    uint64_t                       m_fast_failed = 0;
+
+    bool admit(bool& is_probe);
+    void record(bool is_probe, bool failed);
+    void open();
+
+    public:
+
+    /**
+     * @brief Constructor.
+     */
+    BreakerProxy(json&& config,
+                 std::shared_ptr<kage::Backend> backend,
+                 const Options& options);
+
+    /**
+     * @brief Move-constructor.
+     */
+    BreakerProxy(BreakerProxy&&) = delete;
+
+    /**
+     * @brief Copy-constructor.
+     */
+    BreakerProxy(const BreakerProxy&) = delete;
+
+    /**
+     * @brief Move-assignment operator.
+     */
+    BreakerProxy& operator=(BreakerProxy&&) = delete;
+
+    /**
+     * @brief Copy-assignment operator.
+     */
+    BreakerProxy& operator=(const BreakerProxy&) = delete;
+
+    /**
+     * @brief Destructor.
+     */
+    virtual ~BreakerProxy() = default;
+
+    /**
+     * @brief Get the proxy's configuration as a JSON-formatted string.
+     */
+    std::string getConfig() const override;
+
+    /**
+     * @brief Get the state of the breaker, along with
+     * the wrapped backend's own statistics.
+     */
+    std::string getStatistics() const override;
+
+    /**
+     * @see Backend::forward
+     */
+    kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override;
+
+    /**
+     * @brief Pings the wrapped backend.
+     */
+    kage::Result<uint64_t> ping(uint64_t timeout_ns) override;
+
+    /**
+     * @brief Waits for the wrapped backend to be ready.
+     */
+    kage::Result<bool> waitReady(uint64_t timeout_ns) override;
+
+    /**
+     * @see Backend::setInputProxy
+     */
+    void setInputProxy(kage::InputProxy proxy) override;
+
+    /**
+     * @brief Destroys the wrapped backend.
+     *
+     * @return a Result<bool> instance indicating
+     * whether the backend was successfully destroyed.
+     */
+    kage::Result<bool> destroy() override;
+
+    /**
+     * @brief Static factory function used by the ProxyFactory to
+     * create a BreakerProxy.
+     *
+     * @param engine Thallium engine
+     * @param config JSON configuration for the proxy
+     * @param pool Optional pool in which to submit work.
+     *
+     * @return a unique_ptr to a proxy
+     */
+    static std::unique_ptr<kage::Backend> create(
+            const thallium::engine& engine,
+            const json& config,
+            const thallium::pool& pool);
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include "ChainBackend.hpp"
+#include <nlohmann/json-schema.hpp>
+#include <spdlog/spdlog.h>
+
+KAGE_REGISTER_BACKEND(chain, ChainProxy);
+
+using nlohmann::json;
+using nlohmann::json_schema::json_validator;
+
+ChainProxy::ChainProxy(json&& config,
+                       std::vector<std::shared_ptr<kage::Backend>>&& stages)
+: m_config(std::move(config))
+, m_stages(std::move(stages)) {}
+
+std::string ChainProxy::getConfig() const {
+    auto config = m_config;
+    auto& stages = config["stages"];
+    stages = json::array();
+    for(auto& stage : m_stages) {
+        auto stage_config = json::object();
+        stage_config["type"] = stage->name();
+        stage_config["config"] = json::parse(stage->getConfig());
+        stages.push_back(std::move(stage_config));
+    }
+    return config.dump();
+}
+
+std::string ChainProxy::getStatistics() const {
+    auto stats = json::object();
+    auto& stages = stats["stages"] = json::array();
+    for(auto& stage : m_stages)
+        stages.push_back(json::parse(stage->getStatistics()));
+    return stats.dump();
+}
+
+kage::Result<bool> ChainProxy::forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                             kage::OutputCallback output_cb,
+                                             kage::RequestContext& context) {
+    return m_stages.front()->forwardOutput(rpc_id, input, input_size, output_cb, context);
+}
+
+kage::Result<bool> ChainProxy::waitReady(uint64_t timeout_ns) {
+    return WaitAllReady(m_stages, timeout_ns);
+}
+
+void ChainProxy::setInputProxy(kage::InputProxy proxy) {
+    // Input RPCs travel the chain backward: the first stage forwards them
+    // to the Provider, and each following stage forwards them to the
+    // stage that precedes it.
+    for(auto& stage : m_stages) {
+        stage->setInputProxy(proxy);
+        auto middleware = std::dynamic_pointer_cast<kage::Middleware>(stage);
+        if(middleware) proxy = kage::InputProxy{middleware};
+    }
+}
+
+kage::Result<bool> ChainProxy::destroy() {
+    kage::Result<bool> result;
+    for(auto& stage : m_stages) {
+        auto r = stage->destroy();
+        if(!r.success()) {
+            spdlog::error("[kage] Error when destroying stage of type {}: {}",
+                          stage->name(), r.error());
+            result = std::move(r);
+        }
+    }
+    return result;
+}
+
+std::unique_ptr<kage::Backend> ChainProxy::create(
+        const thallium::engine& engine,
+        const json& config,
+        const thallium::pool& pool) {
+    static const json schema = R"(
+    {
+        "type": "object",
+        "properties": {
+            "stages": {
+                "type": "array",
+                "minItems": 1,
+                "items": {
+                    "type": "object",
+                    "properties": {
+                        "type": {"type": "string"},
+                        "config": {"type": "object"}
+                    },
+                    "required": ["type"]
+                }
+            }
+        },
+        "required": ["stages"]
+    }
+    )"_json;
+    json_validator validator;
+    validator.set_root_schema(schema);
+    try {
+        validator.validate(config);
+    } catch(const std::exception& ex) {
+        throw kage::Exception{
+                fmt::format("While validating JSON config for chain backend: {}", ex.what())};
+    }
+
+    auto& stages_config = config["stages"];
+    std::vector<std::shared_ptr<kage::Backend>> stages;
+    stages.reserve(stages_config.size());
+    try {
+        for(auto& stage_config : stages_config)
+            stages.push_back(kage::ProxyFactory::createProxy(stage_config, engine, pool));
+        for(size_t i = 0; i + 1 < stages.size(); ++i) {
+            auto middleware = std::dynamic_pointer_cast<kage::Middleware>(stages[i]);
+            if(!middleware)
+                throw kage::Exception{fmt::format(
+                    "Backend of type {} cannot be followed by another stage in a chain",
+                    stages[i]->name())};
+            middleware->setNext(stages[i+1]);
+        }
+    } catch(...) {
+        for(auto& stage : stages) stage->destroy();
+        throw;
+    }
+
+    return std::unique_ptr<kage::Backend>(
+        new ChainProxy{json(config), std::move(stages)});
+}
@@ -0,0 +1,110 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __CHAIN_BACKEND_HPP
+#define __CHAIN_BACKEND_HPP
+
+#include <kage/Backend.hpp>
+#include <kage/Middleware.hpp>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+ * Chain implementation of a kage Backend. A chain is a list of stages,
+ * each of which wraps the next one. All the stages but the last one must
+ * be Middleware instances; the last one is the backend that actually
+ * sends the RPCs out (e.g. zmq or margo).
+ */
+class ChainProxy : public kage::Backend {
+
+    json                                        m_config;
+    std::vector<std::shared_ptr<kage::Backend>> m_stages;
+
+    public:
+
+    /**
+     * @brief Constructor.
+     */
+    ChainProxy(json&& config,
+               std::vector<std::shared_ptr<kage::Backend>>&& stages);
+
+    /**
+     * @brief Move-constructor.
+     */
+    ChainProxy(ChainProxy&&) = delete;
+
+    /**
+     * @brief Copy-constructor.
+     */
+    ChainProxy(const ChainProxy&) = delete;
+
+    /**
+     * @brief Move-assignment operator.
+     */
+    ChainProxy& operator=(ChainProxy&&) = delete;
+
+    /**
+     * @brief Copy-assignment operator.
+     */
+    ChainProxy& operator=(const ChainProxy&) = delete;
+
+    /**
+     * @brief Destructor.
+     */
+    virtual ~ChainProxy() = default;
+
+    /**
+     * @brief Get the proxy's configuration as a JSON-formatted string.
+     */
+    std::string getConfig() const override;
+
+    /**
+     * @brief Get the statistics of each stage as a JSON-formatted string.
+     */
+    std::string getStatistics() const override;
+
+    /**
+     * @see Backend::forward
+     */
+    kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override;
+
+    /**
+     * @brief Waits for all the stages to be ready.
+     */
+    kage::Result<bool> waitReady(uint64_t timeout_ns) override;
+
+    /**
+     * @see Backend::setInputProxy
+     */
+    void setInputProxy(kage::InputProxy proxy) override;
+
+    /**
+     * @brief Destroys the underlying stages.
+     *
+     * @return a Result<bool> instance indicating
+     * whether all the stages were successfully destroyed.
+     */
+    kage::Result<bool> destroy() override;
+
+    /**
+     * @brief Static factory function used by the ProxyFactory to
+     * create a ChainProxy.
+     *
+     * @param engine Thallium engine
+     * @param config JSON configuration for the proxy
+     * @param pool Optional pool in which to submit work.
+     *
+     * @return a unique_ptr to a proxy
+     */
+    static std::unique_ptr<kage::Backend> create(
+            const thallium::engine& engine,
+            const json& config,
+            const thallium::pool& pool);
+};
+
+#endif
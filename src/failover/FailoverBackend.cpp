@@ -0,0 +1,192 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include "FailoverBackend.hpp"
+#include <nlohmann/json-schema.hpp>
+#include <spdlog/spdlog.h>
+
+KAGE_REGISTER_BACKEND(failover, FailoverProxy);
+
+using nlohmann::json;
+using nlohmann::json_schema::json_validator;
+
+FailoverProxy::FailoverProxy(json&& config,
+                             thallium::engine engine,
+                             thallium::pool pool,
+                             std::vector<std::shared_ptr<kage::Backend>>&& backends,
+                             const Options& options)
+: m_config(std::move(config))
+, m_engine(std::move(engine))
+, m_backends(std::move(backends))
+, m_options(options)
+, m_links(m_backends.size())
+{
+    m_monitor_ult = pool.make_thread([this]{ runMonitorLoop(); });
+}
+
+std::string FailoverProxy::getConfig() const {
+    auto config = m_config;
+    auto& backends = config["backends"] = json::array();
+    for(auto& backend : m_backends) {
+        backends.push_back(json{
+            {"type", backend->name()},
+            {"config", json::parse(backend->getConfig())}
+        });
+    }
+    return config.dump();
+}
+
+std::string FailoverProxy::getStatistics() const {
+    auto stats = json::object();
+    auto& links = stats["links"] = json::array();
+    {
+        std::unique_lock<thallium::mutex> lock{m_mutex};
+        stats["active"] = m_active.load();
+        stats["failovers"] = m_failovers;
+        for(auto& link : m_links) {
+            links.push_back(json{
+                {"healthy", link.healthy},
+                {"missed", link.missed},
+                {"heartbeats", link.heartbeats},
+                {"missed_total", link.missed_total},
+                {"rtt_ms", link.smoothed_rtt_ns / 1e6}
+            });
+        }
+    }
+    for(size_t i = 0; i < m_backends.size(); ++i)
+        links[i]["backend"] = json::parse(m_backends[i]->getStatistics());
+    return stats.dump();
+}
+
+void FailoverProxy::runMonitorLoop() {
+    while(!m_need_stop) {
+        for(size_t i = 0; i < m_backends.size() && !m_need_stop; ++i) {
+            auto result = m_backends[i]->ping(m_options.timeout_ns);
+            std::unique_lock<thallium::mutex> lock{m_mutex};
+            auto& link = m_links[i];
+            link.heartbeats += 1;
+            if(result.success()) {
+                link.missed = 0;
+                link.healthy = true;
+                link.smoothed_rtt_ns = link.smoothed_rtt_ns == 0 ? result.value()
+                    : 0.875 * link.smoothed_rtt_ns + 0.125 * result.value();
+            } else {
+                link.missed += 1;
+                link.missed_total += 1;
+                if(link.missed >= m_options.max_missed)
+                    link.healthy = false;
+            }
+        }
+        {
+            // Elect the active link
+            std::unique_lock<thallium::mutex> lock{m_mutex};
+            auto active = m_active.load();
+            auto next = active;
+            if(m_options.failback || !m_links[active].healthy) {
+                for(size_t i = 0; i < m_links.size(); ++i) {
+                    if(m_links[i].healthy) {
+                        next = i;
+                        break;
+                    }
+                }
+            }
+            if(next != active) {
+                spdlog::warn("[kage] Failover backend switching from link {} to link {}", active, next);
+                m_active.store(next);
+                m_failovers += 1;
+            }
+        }
+        if(!m_need_stop) thallium::thread::sleep(m_engine, m_options.interval_ms);
+    }
+}
+
+kage::Result<bool> FailoverProxy::forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                                kage::OutputCallback output_cb,
+                                                kage::RequestContext& context) {
+    return m_backends[m_active.load()]->forwardOutput(rpc_id, input, input_size, output_cb, context);
+}
+
+kage::Result<uint64_t> FailoverProxy::ping(uint64_t timeout_ns) {
+    return m_backends[m_active.load()]->ping(timeout_ns);
+}
+
+kage::Result<bool> FailoverProxy::waitReady(uint64_t timeout_ns) {
+    return m_backends[m_active.load()]->waitReady(timeout_ns);
+}
+
+void FailoverProxy::setInputProxy(kage::InputProxy proxy) {
+    for(auto& backend : m_backends)
+        backend->setInputProxy(proxy);
+}
+
+kage::Result<bool> FailoverProxy::destroy() {
+    m_need_stop = true;
+    if(m_monitor_ult) {
+        m_monitor_ult->join();
+        m_monitor_ult.release();
+    }
+    kage::Result<bool> result;
+    for(auto& backend : m_backends) {
+        auto r = backend->destroy();
+        if(!r.success()) result = std::move(r);
+    }
+    return result;
+}
+
+std::unique_ptr<kage::Backend> FailoverProxy::create(
+        const thallium::engine& engine,
+        const json& config,
+        const thallium::pool& pool) {
+    static const json schema = R"(
+    {
+        "type": "object",
+        "properties": {
+            "backends": {
+                "type": "array",
+                "minItems": 2,
+                "items": {
+                    "type": "object",
+                    "properties": {
+                        "type": {"type": "string"},
+                        "config": {"type": "object"}
+                    },
+                    "required": ["type"]
+                }
+            },
+            "heartbeat_interval_ms": {"type": "integer", "minimum": 1},
+            "heartbeat_timeout_ms": {"type": "number", "exclusiveMinimum": 0},
+            "max_missed": {"type": "integer", "minimum": 1},
+            "failback": {"type": "boolean"}
+        },
+        "required": ["backends"]
+    }
+    )"_json;
+    json_validator validator;
+    validator.set_root_schema(schema);
+    try {
+        validator.validate(config);
+    } catch(const std::exception& ex) {
+        throw kage::Exception{
+                fmt::format("While validating JSON config for failover backend: {}", ex.what())};
+    }
+
+    Options options;
+    options.interval_ms = config.value("heartbeat_interval_ms", uint64_t{1000});
+    options.timeout_ns  = static_cast<uint64_t>(config.value("heartbeat_timeout_ms", 500.0) * 1e6);
+    options.max_missed  = config.value("max_missed", uint64_t{3});
+    options.failback    = config.value("failback", true);
+
+    std::vector<std::shared_ptr<kage::Backend>> backends;
+    try {
+        for(auto& backend_config : config["backends"])
+            backends.push_back(kage::ProxyFactory::createProxy(backend_config, engine, pool));
+    } catch(...) {
+        for(auto& backend : backends) backend->destroy();
+        throw;
+    }
+
+    return std::unique_ptr<kage::Backend>(
+        new FailoverProxy{json(config), engine, pool, std::move(backends), options});
+}
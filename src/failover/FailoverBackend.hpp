@@ -0,0 +1,154 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __FAILOVER_BACKEND_HPP
+#define __FAILOVER_BACKEND_HPP
+
+#include <kage/Backend.hpp>
+#include <thallium.hpp>
+#include <atomic>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+ * Failover implementation of a kage Backend. The first of its "backends"
+ * is the primary link, the others are backups. A ULT sends a heartbeat
+ * (see Backend::ping) on every link each "heartbeat_interval_ms", and a
+ * link that misses "max_missed" heartbeats in a row is considered down
+ * until it answers again. Requests go through the active link, which is
+ * replaced by the first healthy link of the list when it goes down. With
+ * "failback" (the default), the primary is also promoted back as soon as
+ * it is healthy again. The smoothed RTT of each link is reported in the
+ * statistics.
+ */
+class FailoverProxy : public kage::Backend {
+
+    public:
+
+    struct Options {
+        uint64_t interval_ms;
+        uint64_t timeout_ns;
+        uint64_t max_missed;
+        bool     failback;
+    };
+
+    private:
+
+    struct Link {
+        bool     healthy = true;
+        uint64_t missed = 0;
+        uint64_t heartbeats = 0;
+        uint64_t missed_total = 0;
+        double   smoothed_rtt_ns = 0;
+    };
+
+    json                                        m_config;
+    thallium::engine                            m_engine;
+    std::vector<std::shared_ptr<kage::Backend>> m_backends;
+    Options                                     m_options;
+    mutable thallium::mutex                     m_mutex;
+    std::vector<Link>                           m_links;
+    std::atomic<size_t>                         m_active{0};
+    uint64_t                                    m_failovers = 0;
+    std::atomic<bool>                           m_need_stop{false};
+    thallium::managed<thallium::thread>         m_monitor_ult;
+
+    void runMonitorLoop();
+
+    public:
+
+    /**
+     * @brief Constructor. Starts the heartbeat ULT in the given pool.
+     */
+    FailoverProxy(json&& config,
+                  thallium::engine engine,
+                  thallium::pool pool,
+                  std::vector<std::shared_ptr<kage::Backend>>&& backends,
+                  const Options& options);
+
+    /**
+     * @brief Move-constructor.
+     */
+    FailoverProxy(FailoverProxy&&) = delete;
+
+    /**
+     * @brief Copy-constructor.
+     */
+    FailoverProxy(const FailoverProxy&) = delete;
+
+    /**
+     * @brief Move-assignment operator.
+     */
+    FailoverProxy& operator=(FailoverProxy&&) = delete;
+
+    /**
+     * @brief Copy-assignment operator.
+     */
+    FailoverProxy& operator=(const FailoverProxy&) = delete;
+
+    /**
+     * @brief Destructor.
+     */
+    virtual ~FailoverProxy() = default;
+
+    /**
+     * @brief Get the proxy's configuration as a JSON-formatted string.
+     */
+    std::string getConfig() const override;
+
+    /**
+     * @brief Get the active link and the health of each link,
+     * along with the backends' own statistics.
+     */
+    std::string getStatistics() const override;
+
+    /**
+     * @see Backend::forward
+     */
+    kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override;
+
+    /**
+     * @brief Pings the active link.
+     */
+    kage::Result<uint64_t> ping(uint64_t timeout_ns) override;
+
+    /**
+     * @brief Waits for the active link to be ready.
+     */
+    kage::Result<bool> waitReady(uint64_t timeout_ns) override;
+
+    /**
+     * @see Backend::setInputProxy
+     */
+    void setInputProxy(kage::InputProxy proxy) override;
+
+    /**
+     * @brief Stops the heartbeats and destroys all the backends.
+     *
+     * @return a Result<bool> instance indicating
+     * whether the backends were successfully destroyed.
+     */
+    kage::Result<bool> destroy() override;
+
+    /**
+     * @brief Static factory function used by the ProxyFactory to
+     * create a FailoverProxy.
+     *
+     * @param engine Thallium engine
+     * @param config JSON configuration for the proxy
+     * @param pool Optional pool in which to submit work.
+     *
+     * @return a unique_ptr to a proxy
+     */
+    static std::unique_ptr<kage::Backend> create(
+            const thallium::engine& engine,
+            const json& config,
+            const thallium::pool& pool);
+};
+
+#endif
@@ -0,0 +1,385 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include "HedgeBackend.hpp"
+#include "../BufferPool.hpp"
+#include <nlohmann/json-schema.hpp>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+
+KAGE_REGISTER_BACKEND(hedge, HedgeProxy);
+
+using nlohmann::json;
+using nlohmann::json_schema::json_validator;
+using clock_type = std::chrono::steady_clock;
+
+struct HedgeProxy::Policy {
+
+    std::string name;
+    bool        hedge;
+    double      percentile;
+    double      min_delay_ms;
+    double      max_delay_ms;
+    size_t      max_retries;
+    double      backoff_ms;
+    double      max_backoff_ms;
+
+    // Window of recent latencies from which the hedging delay is derived.
+    // The percentile is only recomputed every few samples, and read lock-free.
+    thallium::mutex      samples_mtx;
+    std::vector<int64_t> samples;
+    size_t               next_sample = 0;
+    uint64_t             num_samples = 0;
+    std::atomic<double>  delay_ms;
+
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> hedges{0};
+    std::atomic<uint64_t> hedge_wins{0};
+    std::atomic<uint64_t> retries{0};
+    std::atomic<uint64_t> failures{0};
+
+    Policy(std::string n, const json& config)
+    : name{std::move(n)}
+    , hedge{config.value("hedge", true)}
+    , percentile{config.value("percentile", 95.0)}
+    , min_delay_ms{config.value("min_delay_ms", 1.0)}
+    , max_delay_ms{config.value("max_delay_ms", 1000.0)}
+    , max_retries{config.value("max_retries", size_t{2})}
+    , backoff_ms{config.value("backoff_ms", 10.0)}
+    , max_backoff_ms{config.value("max_backoff_ms", 1000.0)}
+    , samples(config.value("window", size_t{256}))
+    , delay_ms{config.value("initial_delay_ms", 10.0)} {}
+
+    void recordLatency(clock_type::duration latency) {
+        static constexpr uint64_t update_period = 16;
+        std::unique_lock<thallium::mutex> lock{samples_mtx};
+        samples[next_sample] = std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+        next_sample = (next_sample + 1) % samples.size();
+        num_samples += 1;
+        if(num_samples % update_period != 0) return;
+        auto window = std::vector<int64_t>(
+            samples.begin(), samples.begin() + std::min<uint64_t>(num_samples, samples.size()));
+        auto nth = window.begin() + static_cast<size_t>((window.size() - 1) * percentile / 100.0);
+        std::nth_element(window.begin(), nth, window.end());
+        delay_ms.store(std::clamp(*nth / 1e6, min_delay_ms, max_delay_ms));
+    }
+
+    json statistics() const {
+        return json{
+            {"requests", requests.load()},
+            {"hedges", hedges.load()},
+            {"hedge_wins", hedge_wins.load()},
+            {"retries", retries.load()},
+            {"failures", failures.load()},
+            {"hedge_delay_ms", delay_ms.load()}
+        };
+    }
+};
+
+/**
+ * State shared by the attempts of one request. The first attempt that
+ * produces an output delivers it; the request completes once it has, or
+ * once all the attempts launched so far have failed. Nothing is launched
+ * after completion, and attempts use their own copy of the input, so that
+ * a losing attempt never touches the caller's buffers. The condition
+ * variable is notified on completion, so that a pending hedge timer
+ * stops waiting as soon as the request has completed.
+ */
+struct HedgeProxy::Attempts {
+
+    Policy&                  policy;
+    hg_id_t                  rpc_id;
+    kage::BufferPool::Buffer input;
+    kage::OutputCallback     output_cb;
+    kage::RequestContext&    caller_context;
+    kage::RequestContext     context;
+
+    thallium::mutex              mutex;
+    thallium::condition_variable cv;
+    size_t                       launched = 0;
+    size_t                       finished = 0;
+    bool                         delivered = false;
+    bool                         completed = false;
+    size_t                       winner = 0;
+    kage::Result<bool>           result;
+    thallium::eventual<void>     ev;
+
+    Attempts(Policy& p, hg_id_t id, const char* data, size_t size,
+             kage::OutputCallback cb, kage::RequestContext& ctx)
+    : policy{p}, rpc_id{id}, input{data, size}, output_cb{cb}
+    , caller_context{ctx}, context{ctx} {}
+};
+
+HedgeProxy::HedgeProxy(json&& config,
+                       thallium::engine engine,
+                       thallium::pool pool,
+                       std::vector<std::shared_ptr<kage::Backend>>&& backends,
+                       std::unordered_map<hg_id_t, std::unique_ptr<Policy>>&& policies)
+: m_config(std::move(config))
+, m_engine(std::move(engine))
+, m_pool(std::move(pool))
+, m_backends(std::move(backends))
+, m_policies(std::move(policies)) {}
+
+HedgeProxy::~HedgeProxy() = default;
+
+std::string HedgeProxy::getConfig() const {
+    auto config = m_config;
+    auto& backends = config["backends"] = json::array();
+    for(auto& backend : m_backends) {
+        backends.push_back(json{
+            {"type", backend->name()},
+            {"config", json::parse(backend->getConfig())}
+        });
+    }
+    return config.dump();
+}
+
+std::string HedgeProxy::getStatistics() const {
+    auto stats = json::object();
+    auto& rpcs = stats["rpcs"] = json::object();
+    for(auto& p : m_policies)
+        rpcs[p.second->name] = p.second->statistics();
+    auto& backends = stats["backends"] = json::array();
+    for(auto& backend : m_backends)
+        backends.push_back(json::parse(backend->getStatistics()));
+    return stats.dump();
+}
+
+kage::Result<bool> HedgeProxy::forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                             kage::OutputCallback output_cb,
+                                             kage::RequestContext& context) {
+    // One-way requests have no output to tell whether an attempt succeeded
+    auto it = m_policies.find(rpc_id);
+    if(it == m_policies.end() || context.one_way)
+        return m_backends.front()->forwardOutput(rpc_id, input, input_size, output_cb, context);
+
+    auto& policy = *it->second;
+    policy.requests.fetch_add(1, std::memory_order_relaxed);
+    auto backoff = policy.backoff_ms;
+    for(size_t retry = 0; ; ++retry) {
+        bool delivered = false;
+        auto result = hedgedForward(policy, rpc_id, input, input_size, output_cb, context, delivered);
+        if(result.success() || delivered || retry >= policy.max_retries) {
+            if(!result.success()) policy.failures.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+        spdlog::debug("[kage] Retrying RPC {} after error: {}", policy.name, result.error());
+        policy.retries.fetch_add(1, std::memory_order_relaxed);
+        thallium::thread::sleep(m_engine, backoff);
+        backoff = std::min(backoff * 2, policy.max_backoff_ms);
+    }
+}
+
+kage::Result<bool> HedgeProxy::hedgedForward(
+        Policy& policy, hg_id_t rpc_id, const char* input, size_t input_size,
+        kage::OutputCallback output_cb, kage::RequestContext& context, bool& delivered) {
+    auto attempts = std::make_shared<Attempts>(policy, rpc_id, input, input_size, output_cb, context);
+    auto primary = m_next_backend.fetch_add(1, std::memory_order_relaxed) % m_backends.size();
+
+    attempts->launched = 1;
+    launchAttempt(attempts, primary, 0);
+
+    if(policy.hedge) {
+        auto delay = policy.delay_ms.load();
+        auto hedge_backend = (primary + 1) % m_backends.size();
+        ultStarted();
+        m_pool.make_thread([this, attempts, delay, hedge_backend]() {
+            auto delay_ns = static_cast<uint64_t>(delay * 1e6);
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec  += (deadline.tv_nsec + delay_ns) / 1000000000;
+            deadline.tv_nsec  = (deadline.tv_nsec + delay_ns) % 1000000000;
+            bool launch = false;
+            {
+                std::unique_lock<thallium::mutex> lock{attempts->mutex};
+                while(!attempts->completed) {
+                    if(!attempts->cv.wait_until(lock, &deadline)) break;
+                }
+                if(!attempts->completed && !attempts->delivered) {
+                    attempts->launched += 1;
+                    launch = true;
+                }
+            }
+            if(launch) {
+                attempts->policy.hedges.fetch_add(1, std::memory_order_relaxed);
+                launchAttempt(attempts, hedge_backend, 1);
+            }
+            ultFinished();
+        }, thallium::anonymous());
+    }
+
+    attempts->ev.wait();
+    std::unique_lock<thallium::mutex> lock{attempts->mutex};
+    delivered = attempts->delivered;
+    if(delivered && attempts->winner == 1)
+        policy.hedge_wins.fetch_add(1, std::memory_order_relaxed);
+    return attempts->result;
+}
+
+void HedgeProxy::launchAttempt(const std::shared_ptr<Attempts>& attempts,
+                               size_t backend_index, size_t attempt_index) {
+    ultStarted();
+    m_pool.make_thread([this, attempts, backend_index, attempt_index]() {
+        bool delivered_here = false;
+        kage::Result<bool> result;
+        // Each attempt stamps its own copy of the context, and
+        // only the winner's is handed back to the caller
+        auto context = attempts->context;
+        auto t_start = clock_type::now();
+        try {
+            result = m_backends[backend_index]->forwardOutput(
+                attempts->rpc_id, attempts->input.data(), attempts->input.size(),
+                [&attempts, &delivered_here, &context](const char* output, size_t output_size) {
+                    {
+                        std::unique_lock<thallium::mutex> lock{attempts->mutex};
+                        if(attempts->delivered || attempts->completed) return;
+                        attempts->delivered = true;
+                    }
+                    delivered_here = true;
+                    attempts->caller_context = context;
+                    attempts->output_cb(output, output_size);
+                }, context);
+        } catch(const std::exception& ex) {
+            result.success() = false;
+            result.error() = ex.what();
+        }
+        if(result.success())
+            attempts->policy.recordLatency(clock_type::now() - t_start);
+
+        bool complete = false;
+        {
+            std::unique_lock<thallium::mutex> lock{attempts->mutex};
+            attempts->finished += 1;
+            if(!attempts->completed
+            && (delivered_here || (!attempts->delivered && attempts->finished == attempts->launched))) {
+                attempts->completed = true;
+                attempts->winner = attempt_index;
+                attempts->result = std::move(result);
+                complete = true;
+            }
+        }
+        if(complete) {
+            attempts->cv.notify_all();
+            attempts->ev.set_value();
+        }
+        ultFinished();
+    }, thallium::anonymous());
+}
+
+void HedgeProxy::ultStarted() {
+    std::unique_lock<thallium::mutex> lock{m_ults_mtx};
+    m_active_ults += 1;
+}
+
+void HedgeProxy::ultFinished() {
+    std::unique_lock<thallium::mutex> lock{m_ults_mtx};
+    m_active_ults -= 1;
+    if(m_active_ults == 0) m_ults_cv.notify_all();
+}
+
+kage::Result<bool> HedgeProxy::waitReady(uint64_t timeout_ns) {
+    return WaitAllReady(m_backends, timeout_ns);
+}
+
+void HedgeProxy::setInputProxy(kage::InputProxy proxy) {
+    for(auto& backend : m_backends)
+        backend->setInputProxy(proxy);
+}
+
+kage::Result<bool> HedgeProxy::destroy() {
+    {
+        std::unique_lock<thallium::mutex> lock{m_ults_mtx};
+        while(m_active_ults != 0)
+            m_ults_cv.wait(lock);
+    }
+    kage::Result<bool> result;
+    for(auto& backend : m_backends) {
+        auto r = backend->destroy();
+        if(!r.success()) result = std::move(r);
+    }
+    return result;
+}
+
+std::unique_ptr<kage::Backend> HedgeProxy::create(
+        const thallium::engine& engine,
+        const json& config,
+        const thallium::pool& pool) {
+    static const json schema = R"(
+    {
+        "type": "object",
+        "properties": {
+            "backends": {
+                "type": "array",
+                "minItems": 1,
+                "items": {
+                    "type": "object",
+                    "properties": {
+                        "type": {"type": "string"},
+                        "config": {"type": "object"}
+                    },
+                    "required": ["type"]
+                }
+            },
+            "policies": {
+                "type": "object",
+                "additionalProperties": {
+                    "type": "object",
+                    "properties": {
+                        "hedge": {"type": "boolean"},
+                        "percentile": {"type": "number", "exclusiveMinimum": 0, "maximum": 100},
+                        "initial_delay_ms": {"type": "number", "minimum": 0},
+                        "min_delay_ms": {"type": "number", "minimum": 0},
+                        "max_delay_ms": {"type": "number", "minimum": 0},
+                        "window": {"type": "integer", "minimum": 16},
+                        "max_retries": {"type": "integer", "minimum": 0},
+                        "backoff_ms": {"type": "number", "minimum": 0},
+                        "max_backoff_ms": {"type": "number", "minimum": 0}
+                    }
+                }
+            }
+        },
+        "required": ["backends"]
+    }
+    )"_json;
+    json_validator validator;
+    validator.set_root_schema(schema);
+    try {
+        validator.validate(config);
+    } catch(const std::exception& ex) {
+        throw kage::Exception{
+                fmt::format("While validating JSON config for hedge backend: {}", ex.what())};
+    }
+
+    // Policies are given by RPC name, but backends only see RPC ids
+    auto rpc_engine = engine;
+    std::unordered_map<hg_id_t, std::unique_ptr<Policy>> policies;
+    if(config.contains("policies")) {
+        for(auto& p : config["policies"].items()) {
+            auto id = rpc_engine.define(p.key()).id();
+            auto policy = std::make_unique<Policy>(p.key(), p.value());
+            if(policy->hedge && config["backends"].size() < 2) {
+                spdlog::warn("[kage] Hedge backend has a single backend, "
+                             "RPC {} will only be retried", p.key());
+                policy->hedge = false;
+            }
+            policies.emplace(id, std::move(policy));
+        }
+    }
+
+    std::vector<std::shared_ptr<kage::Backend>> backends;
+    try {
+        for(auto& backend_config : config["backends"])
+            backends.push_back(kage::ProxyFactory::createProxy(backend_config, engine, pool));
+    } catch(...) {
+        for(auto& backend : backends) backend->destroy();
+        throw;
+    }
+
+    return std::unique_ptr<kage::Backend>(
+        new HedgeProxy{json(config), engine, pool, std::move(backends), std::move(policies)});
+}
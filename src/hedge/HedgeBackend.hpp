@@ -0,0 +1,146 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEDGE_BACKEND_HPP
+#define __HEDGE_BACKEND_HPP
+
+#include <kage/Backend.hpp>
+#include <unordered_map>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+ * Hedging implementation of a kage Backend. RPCs listed in the "policies"
+ * field are considered idempotent: if a request has not completed after a
+ * delay derived from the RPC's own latency percentile, a duplicate is sent
+ * through the next backend of the "backends" list and the first response
+ * wins. Requests failing with a transport error are retried with
+ * exponential backoff. RPCs without a policy go through the first backend.
+ * Hedging needs at least two backends: with a single one, the duplicate
+ * would queue behind the slow request, so policies then only retry.
+ */
+class HedgeProxy : public kage::Backend {
+
+    public:
+
+    struct Policy;
+    struct Attempts;
+
+    private:
+
+    json                                                  m_config;
+    thallium::engine                                      m_engine;
+    thallium::pool                                        m_pool;
+    std::vector<std::shared_ptr<kage::Backend>>           m_backends;
+    std::unordered_map<hg_id_t, std::unique_ptr<Policy>>  m_policies;
+    std::atomic<size_t>                                   m_next_backend{0};
+    thallium::mutex                                       m_ults_mtx;
+    thallium::condition_variable                          m_ults_cv;
+    size_t                                                m_active_ults = 0;
+
+    public:
+
+    /**
+     * @brief Constructor.
+     */
+    HedgeProxy(json&& config,
+               thallium::engine engine,
+               thallium::pool pool,
+               std::vector<std::shared_ptr<kage::Backend>>&& backends,
+               std::unordered_map<hg_id_t, std::unique_ptr<Policy>>&& policies);
+
+    /**
+     * @brief Move-constructor.
+     */
+    HedgeProxy(HedgeProxy&&) = delete;
+
+    /**
+     * @brief Copy-constructor.
+     */
+    HedgeProxy(const HedgeProxy&) = delete;
+
+    /**
+     * @brief Move-assignment operator.
+     */
+    HedgeProxy& operator=(HedgeProxy&&) = delete;
+
+    /**
+     * @brief Copy-assignment operator.
+     */
+    HedgeProxy& operator=(const HedgeProxy&) = delete;
+
+    /**
+     * @brief Destructor.
+     */
+    virtual ~HedgeProxy();
+
+    /**
+     * @brief Get the proxy's configuration as a JSON-formatted string.
+     */
+    std::string getConfig() const override;
+
+    /**
+     * @brief Get per-RPC hedging and retry counters as a JSON-formatted string.
+     */
+    std::string getStatistics() const override;
+
+    /**
+     * @see Backend::forward
+     */
+    kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override;
+
+    /**
+     * @brief Waits for all the backends to be ready.
+     */
+    kage::Result<bool> waitReady(uint64_t timeout_ns) override;
+
+    /**
+     * @see Backend::setInputProxy
+     */
+    void setInputProxy(kage::InputProxy proxy) override;
+
+    /**
+     * @brief Waits for pending attempts and destroys the underlying backends.
+     *
+     * @return a Result<bool> instance indicating
+     * whether the backends were successfully destroyed.
+     */
+    kage::Result<bool> destroy() override;
+
+    /**
+     * @brief Static factory function used by the ProxyFactory to
+     * create a HedgeProxy.
+     *
+     * @param engine Thallium engine
+     * @param config JSON configuration for the proxy
+     * @param pool Optional pool in which to submit work.
+     *
+     * @return a unique_ptr to a proxy
+     */
+    static std::unique_ptr<kage::Backend> create(
+            const thallium::engine& engine,
+            const json& config,
+            const thallium::pool& pool);
+
+    private:
+
+    kage::Result<bool> hedgedForward(Policy& policy, hg_id_t rpc_id,
+                                     const char* input, size_t input_size,
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context,
+                                     bool& delivered);
+
+    void launchAttempt(const std::shared_ptr<Attempts>& attempts,
+                       size_t backend_index, size_t attempt_index);
+
+    void ultStarted();
+
+    void ultFinished();
+};
+
+#endif
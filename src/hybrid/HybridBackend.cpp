@@ -0,0 +1,170 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include "HybridBackend.hpp"
+#include <nlohmann/json-schema.hpp>
+#include <spdlog/spdlog.h>
+
+KAGE_REGISTER_BACKEND(hybrid, HybridProxy);
+
+using nlohmann::json;
+using nlohmann::json_schema::json_validator;
+
+HybridProxy::HybridProxy(json&& config,
+                         std::vector<std::shared_ptr<kage::Backend>>&& backends,
+                         Route&& default_route,
+                         std::unordered_map<hg_id_t, Route>&& routes)
+: m_config(std::move(config))
+, m_backends(std::move(backends))
+, m_default_route(std::move(default_route))
+, m_routes(std::move(routes))
+, m_stats(m_backends.size()) {}
+
+std::string HybridProxy::getConfig() const {
+    auto config = m_config;
+    auto& backends = config["backends"] = json::array();
+    for(auto& backend : m_backends) {
+        backends.push_back(json{
+            {"type", backend->name()},
+            {"config", json::parse(backend->getConfig())}
+        });
+    }
+    return config.dump();
+}
+
+std::string HybridProxy::getStatistics() const {
+    auto stats = json::object();
+    auto& backends = stats["backends"] = json::array();
+    for(size_t i = 0; i < m_backends.size(); ++i) {
+        backends.push_back(json{
+            {"requests", m_stats[i].requests.load(std::memory_order_relaxed)},
+            {"bytes", m_stats[i].bytes.load(std::memory_order_relaxed)},
+            {"backend", json::parse(m_backends[i]->getStatistics())}
+        });
+    }
+    return stats.dump();
+}
+
+kage::Result<bool> HybridProxy::forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                              kage::OutputCallback output_cb,
+                                              kage::RequestContext& context) {
+    auto it = m_routes.find(rpc_id);
+    auto& thresholds = it == m_routes.end() ? m_default_route.thresholds : it->second.thresholds;
+    size_t index = 0;
+    while(index < thresholds.size() && input_size >= thresholds[index]) ++index;
+    m_stats[index].requests.fetch_add(1, std::memory_order_relaxed);
+    m_stats[index].bytes.fetch_add(input_size, std::memory_order_relaxed);
+    return m_backends[index]->forwardOutput(rpc_id, input, input_size, output_cb, context);
+}
+
+kage::Result<bool> HybridProxy::waitReady(uint64_t timeout_ns) {
+    return WaitAllReady(m_backends, timeout_ns);
+}
+
+void HybridProxy::setInputProxy(kage::InputProxy proxy) {
+    for(auto& backend : m_backends)
+        backend->setInputProxy(proxy);
+}
+
+kage::Result<bool> HybridProxy::destroy() {
+    kage::Result<bool> result;
+    for(auto& backend : m_backends) {
+        auto r = backend->destroy();
+        if(!r.success()) result = std::move(r);
+    }
+    return result;
+}
+
+static HybridProxy::Route makeRoute(const json& thresholds, size_t num_backends) {
+    HybridProxy::Route route;
+    for(auto& threshold : thresholds) {
+        auto value = threshold.get<size_t>();
+        if(!route.thresholds.empty() && value <= route.thresholds.back())
+            throw kage::Exception{"Hybrid backend thresholds should be strictly increasing"};
+        route.thresholds.push_back(value);
+    }
+    if(route.thresholds.size() != num_backends - 1)
+        throw kage::Exception{fmt::format(
+            "Hybrid backend expects {} thresholds for {} backends, {} given",
+            num_backends - 1, num_backends, route.thresholds.size())};
+    return route;
+}
+
+std::unique_ptr<kage::Backend> HybridProxy::create(
+        const thallium::engine& engine,
+        const json& config,
+        const thallium::pool& pool) {
+    static const json schema = R"(
+    {
+        "type": "object",
+        "properties": {
+            "backends": {
+                "type": "array",
+                "minItems": 2,
+                "items": {
+                    "type": "object",
+                    "properties": {
+                        "type": {"type": "string"},
+                        "config": {"type": "object"}
+                    },
+                    "required": ["type"]
+                }
+            },
+            "thresholds": {
+                "type": "array",
+                "items": {"type": "integer", "minimum": 0}
+            },
+            "rpcs": {
+                "type": "object",
+                "additionalProperties": {
+                    "type": "object",
+                    "properties": {
+                        "thresholds": {
+                            "type": "array",
+                            "items": {"type": "integer", "minimum": 0}
+                        }
+                    },
+                    "required": ["thresholds"]
+                }
+            }
+        },
+        "required": ["backends", "thresholds"]
+    }
+    )"_json;
+    json_validator validator;
+    validator.set_root_schema(schema);
+    try {
+        validator.validate(config);
+    } catch(const std::exception& ex) {
+        throw kage::Exception{
+                fmt::format("While validating JSON config for hybrid backend: {}", ex.what())};
+    }
+
+    auto num_backends = config["backends"].size();
+    auto default_route = makeRoute(config["thresholds"], num_backends);
+
+    // Routes are given by RPC name, but backends only see RPC ids
+    auto rpc_engine = engine;
+    std::unordered_map<hg_id_t, Route> routes;
+    if(config.contains("rpcs")) {
+        for(auto& p : config["rpcs"].items()) {
+            auto id = rpc_engine.define(p.key()).id();
+            routes.emplace(id, makeRoute(p.value()["thresholds"], num_backends));
+        }
+    }
+
+    std::vector<std::shared_ptr<kage::Backend>> backends;
+    try {
+        for(auto& backend_config : config["backends"])
+            backends.push_back(kage::ProxyFactory::createProxy(backend_config, engine, pool));
+    } catch(...) {
+        for(auto& backend : backends) backend->destroy();
+        throw;
+    }
+
+    return std::unique_ptr<kage::Backend>(
+        new HybridProxy{json(config), std::move(backends),
+                        std::move(default_route), std::move(routes)});
+}
@@ -0,0 +1,133 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HYBRID_BACKEND_HPP
+#define __HYBRID_BACKEND_HPP
+
+#include <kage/Backend.hpp>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+ * Hybrid implementation of a kage Backend, routing each request to one
+ * of its backends depending on the size of its payload. With N backends,
+ * N-1 increasing "thresholds" (in bytes) are given: a request goes to the
+ * first backend whose threshold is above its size, or to the last one.
+ * This allows, for instance, sending small requests over a low-latency
+ * link and large ones over a high-bandwidth one. Thresholds can be
+ * overridden per RPC in the "rpcs" field.
+ */
+class HybridProxy : public kage::Backend {
+
+    public:
+
+    struct Route {
+        std::vector<size_t> thresholds;
+    };
+
+    private:
+
+    struct BackendStatistics {
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> bytes{0};
+    };
+
+    json                                        m_config;
+    std::vector<std::shared_ptr<kage::Backend>> m_backends;
+    Route                                       m_default_route;
+    std::unordered_map<hg_id_t, Route>          m_routes;
+    std::vector<BackendStatistics>              m_stats;
+
+    public:
+
+    /**
+     * @brief Constructor.
+     */
+    HybridProxy(json&& config,
+                std::vector<std::shared_ptr<kage::Backend>>&& backends,
+                Route&& default_route,
+                std::unordered_map<hg_id_t, Route>&& routes);
+
+    /**
+     * @brief Move-constructor.
+     */
+    HybridProxy(HybridProxy&&) = delete;
+
+    /**
+     * @brief Copy-constructor.
+     */
+    HybridProxy(const HybridProxy&) = delete;
+
+    /**
+     * @brief Move-assignment operator.
+     */
+    HybridProxy& operator=(HybridProxy&&) = delete;
+
+    /**
+     * @brief Copy-assignment operator.
+     */
+    HybridProxy& operator=(const HybridProxy&) = delete;
+
+    /**
+     * @brief Destructor.
+     */
+    virtual ~HybridProxy() = default;
+
+    /**
+     * @brief Get the proxy's configuration as a JSON-formatted string.
+     */
+    std::string getConfig() const override;
+
+    /**
+     * @brief Get the number of requests and bytes routed to
+     * each backend, along with the backends' own statistics.
+     */
+    std::string getStatistics() const override;
+
+    /**
+     * @see Backend::forward
+     */
+    kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override;
+
+    /**
+     * @brief Waits for all the backends to be ready.
+     */
+    kage::Result<bool> waitReady(uint64_t timeout_ns) override;
+
+    /**
+     * @see Backend::setInputProxy
+     */
+    void setInputProxy(kage::InputProxy proxy) override;
+
+    /**
+     * @brief Destroys all the backends.
+     *
+     * @return a Result<bool> instance indicating
+     * whether the backends were successfully destroyed.
+     */
+    kage::Result<bool> destroy() override;
+
+    /**
+     * @brief Static factory function used by the ProxyFactory to
+     * create a HybridProxy.
+     *
+     * @param engine Thallium engine
+     * @param config JSON configuration for the proxy
+     * @param pool Optional pool in which to submit work.
+     *
+     * @return a unique_ptr to a proxy
+     */
+    static std::unique_ptr<kage::Backend> create(
+            const thallium::engine& engine,
+            const json& config,
+            const thallium::pool& pool);
+};
+
+#endif
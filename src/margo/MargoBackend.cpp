@@ -7,32 +7,180 @@
 #include <nlohmann/json-schema.hpp>
 #include <spdlog/spdlog.h>
 #include <iostream>
-#include <thallium/serialization/stl/string.hpp>
 
 KAGE_REGISTER_BACKEND(margo, MargoProxy);
 
 using nlohmann::json;
 using nlohmann::json_schema::json_validator;
 
-MargoProxy::MargoProxy(json&& config, thallium::engine internal_engine, thallium::endpoint remote_endpoint)
+/**
+ * Input of the kage_forward RPC: the id of the forwarded RPC, whether
+ * it is instrumented, its trace and span ids and its remaining budget,
+ * followed by its raw payload, written directly into Mercury's buffer.
+ */
+struct ForwardedInput {
+
+    hg_id_t                     rpc_id;
+    const kage::RequestContext& context;
+    const char*                 data;
+    size_t                      size;
+
+    static constexpr size_t header_size =
+        sizeof(hg_id_t) + sizeof(uint8_t) + 3 * sizeof(uint64_t);
+
+    template<typename A>
+    void save(A& ar) const {
+        uint8_t  instrumented = context.instrumented;
+        uint64_t budget = context.remainingBudget();
+        ar.write(&rpc_id, 1);
+        ar.write(&instrumented, 1);
+        ar.write(&context.trace_id, 1);
+        ar.write(&context.span_id, 1);
+        ar.write(&budget, 1);
+        ar.write(data, size);
+    }
+};
+
+/**
+ * Reads a ForwardedInput into the RequestContext and invokes
+ * the callback on the payload, in place in Mercury's buffer.
+ */
+template<typename Callback>
+struct ForwardedInputReader {
+
+    size_t                payload_size;
+    kage::RequestContext& context;
+    Callback              callback;
+
+    template<typename A>
+    void load(A& ar) {
+        hg_id_t  rpc_id;
+        uint8_t  instrumented;
+        uint64_t budget;
+        ar.read(&rpc_id, 1);
+        ar.read(&instrumented, 1);
+        ar.read(&context.trace_id, 1);
+        ar.read(&context.span_id, 1);
+        ar.read(&budget, 1);
+        context.instrumented = instrumented != 0;
+        context.setBudget(budget);
+        auto size = payload_size - ForwardedInput::header_size;
+        auto proc = ar.get_proc();
+        auto data = static_cast<char*>(hg_proc_save_ptr(proc, size));
+        callback(rpc_id, data, size);
+        hg_proc_restore_ptr(proc, data, size);
+    }
+};
+
+/**
+ * Output of the kage_forward RPC: the durations measured on the
+ * input side (zero if the request is not instrumented), followed
+ * by the raw output of the target.
+ */
+struct ForwardedOutput {
+
+    const kage::RequestContext& context;
+    const char*                 data;
+    size_t                      size;
+
+    static constexpr size_t header_size = 3 * sizeof(uint64_t);
+
+    template<typename A>
+    void save(A& ar) const {
+        ar.write(&context.remote_queue_ns, 1);
+        ar.write(&context.remote_target_ns, 1);
+        ar.write(&context.remote_response_ns, 1);
+        ar.write(data, size);
+    }
+};
+
+/**
+ * Reads a ForwardedOutput into the RequestContext and
+ * invokes the callback on the output.
+ */
+template<typename Callback>
+struct ForwardedOutputReader {
+
+    size_t                payload_size;
+    kage::RequestContext& context;
+    Callback              callback;
+
+    template<typename A>
+    void load(A& ar) {
+        ar.read(&context.remote_queue_ns, 1);
+        ar.read(&context.remote_target_ns, 1);
+        ar.read(&context.remote_response_ns, 1);
+        auto size = payload_size - ForwardedOutput::header_size;
+        auto proc = ar.get_proc();
+        auto data = static_cast<char*>(hg_proc_save_ptr(proc, size));
+        callback(data, size);
+        hg_proc_restore_ptr(proc, data, size);
+    }
+};
+
+MargoProxy::MargoProxy(json&& config, thallium::engine internal_engine, std::string remote_address)
 : m_config(std::move(config))
 , m_internal_engine(std::move(internal_engine))
-, m_remote_endpoint(std::move(remote_endpoint))
+, m_remote_address(std::move(remote_address))
 {
-    // FIXME: this can be improved with callback-driven piping of input and output
-    // instead of converting to intermediate std::strings.
     if(m_internal_engine.is_listening()) {
-        std::function<void(const thallium::request&, hg_id_t, const std::string&)> rpc =
-            [this](const thallium::request& req, hg_id_t rpc_id, const std::string& input) {
-                auto output_cb = [&](const char* output, size_t output_size) {
-                    req.respond(std::string{output, output_size});
-                };
-                m_input_proxy.forwardInput(rpc_id, input.data(), input.size(), output_cb);
-            };
-        m_rpc = m_internal_engine.define("kage_forward", rpc);
+        // kage_forward_oneway carries one-way requests, to which no response is sent
+        auto make_handler = [this](bool one_way) {
+            return std::function<void(const thallium::request&)>{
+                [this, one_way](const thallium::request& req) {
+                    kage::RequestContext context;
+                    context.one_way = one_way;
+                    bool responded = one_way;
+                    auto output_cb = [&req, &responded, &context](const char* output, size_t output_size) {
+                        if(context.one_way) return;
+                        context.stamp(kage::RequestContext::ResponseSend);
+                        context.computeRemoteDurations();
+                        req.respond(ForwardedOutput{context, output, output_size});
+                        responded = true;
+                    };
+                    auto payload_size = HG_Get_input_payload_size(req.native_handle());
+                    if(payload_size >= ForwardedInput::header_size) {
+                        auto forward = [this, &context, &output_cb](
+                                hg_id_t rpc_id, const char* input, size_t input_size) {
+                            context.stamp(kage::RequestContext::RemoteReceived);
+                            m_input_proxy.forwardInput(rpc_id, input, input_size, output_cb, context);
+                        };
+                        auto reader = ForwardedInputReader<decltype(forward)>{payload_size, context, forward};
+                        req.get_input().unpack(reader);
+                    }
+                    if(!responded) output_cb(nullptr, 0);
+                }};
+        };
+        m_rpc = m_internal_engine.define("kage_forward", make_handler(false));
+        m_oneway_rpc = m_internal_engine.define("kage_forward_oneway", make_handler(true));
+        m_heartbeat_rpc = m_internal_engine.define("kage_heartbeat",
+            [](const thallium::request& req) { req.respond(); });
     } else {
         m_rpc = m_internal_engine.define("kage_forward");
+        m_oneway_rpc = m_internal_engine.define("kage_forward_oneway");
+        m_heartbeat_rpc = m_internal_engine.define("kage_heartbeat");
+    }
+    m_oneway_rpc.disable_response();
+}
+
+kage::Result<bool> MargoProxy::connect() {
+    if(m_connected.load()) return kage::Result<bool>{};
+    std::unique_lock<thallium::mutex> lock{m_connect_mutex};
+    if(m_connected.load()) return kage::Result<bool>{};
+    try {
+        m_remote_endpoint = m_internal_engine.lookup(m_remote_address);
+    } catch(const std::exception& ex) {
+        kage::Result<bool> result;
+        result.success() = false;
+        result.error() = fmt::format("Could not look up {}: {}", m_remote_address, ex.what());
+        return result;
     }
+    m_handles = std::make_unique<kage::HandlePool>(
+        m_rpc, thallium::provider_handle{m_remote_endpoint, 0});
+    m_oneway_handles = std::make_unique<kage::HandlePool>(
+        m_oneway_rpc, thallium::provider_handle{m_remote_endpoint, 0});
+    m_connected.store(true);
+    return kage::Result<bool>{};
 }
 
 std::string MargoProxy::getConfig() const {
@@ -40,20 +188,82 @@ std::string MargoProxy::getConfig() const {
 }
 
 kage::Result<bool> MargoProxy::forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
-                                             const std::function<void(const char*, size_t)>& output_cb) {
-    // FIXME: this can be improved with callback-driven piping of input and output
-    // instead of converting to intermediate std::strings.
-    std::string output = m_rpc.on(m_remote_endpoint)(rpc_id, std::string{input, input_size});
-    output_cb(output.data(), output.size());
+                                             kage::OutputCallback output_cb,
+                                             kage::RequestContext& context) {
+    auto connected = connect();
+    if(!connected.success()) return connected;
+    if(context.one_way) {
+        // Returns as soon as Mercury has sent the request
+        auto handle = m_oneway_handles->acquire();
+        try {
+            context.stamp(kage::RequestContext::BackendSend);
+            (*handle)(ForwardedInput{rpc_id, context, input, input_size});
+        } catch(...) {
+            handle.discard();
+            throw;
+        }
+        return kage::Result<bool>{};
+    }
+    auto handle = m_handles->acquire();
+    try {
+        context.stamp(kage::RequestContext::BackendSend);
+        // Stop waiting for the response once the client has stopped waiting for it
+        auto budget = context.remainingBudget();
+        auto output = budget
+            ? (*handle).timed(std::chrono::nanoseconds{budget},
+                              ForwardedInput{rpc_id, context, input, input_size})
+            : (*handle)(ForwardedInput{rpc_id, context, input, input_size});
+        context.stamp(kage::RequestContext::ResponseReceived);
+        auto payload_size = HG_Get_output_payload_size(output.native_handle());
+        if(payload_size < ForwardedOutput::header_size) {
+            output_cb(nullptr, 0);
+        } else {
+            auto reader = ForwardedOutputReader<kage::OutputCallback>{payload_size, context, output_cb};
+            output.unpack(reader);
+        }
+    } catch(const thallium::timeout&) {
+        handle.discard();
+        return kage::Result<bool>{kage::ErrorCode::Timeout, "Request deadline expired"};
+    } catch(...) {
+        handle.discard();
+        throw;
+    }
     return kage::Result<bool>{};
 }
 
+kage::Result<uint64_t> MargoProxy::ping(uint64_t timeout_ns) {
+    kage::Result<uint64_t> result;
+    auto connected = connect();
+    if(!connected.success()) {
+        result.success() = false;
+        result.error() = connected.error();
+        return result;
+    }
+    auto t_start = kage::RequestContext::now();
+    try {
+        m_heartbeat_rpc.on(m_remote_endpoint).timed(std::chrono::nanoseconds{timeout_ns});
+        result.value() = kage::RequestContext::now() - t_start;
+    } catch(const thallium::timeout&) {
+        result.success() = false;
+        result.error() = "Heartbeat timed out";
+    } catch(const std::exception& ex) {
+        result.success() = false;
+        result.error() = ex.what();
+    }
+    return result;
+}
+
 void MargoProxy::setInputProxy(kage::InputProxy proxy) {
     m_input_proxy = std::move(proxy);
 }
 
 kage::Result<bool> MargoProxy::destroy() {
+    m_connected.store(false);
+    m_handles.reset();
+    m_oneway_handles.reset();
     m_rpc.deregister();
+    m_oneway_rpc.deregister();
+    m_heartbeat_rpc.deregister();
     m_remote_endpoint = thallium::endpoint{};
     m_internal_engine.finalize();
     m_internal_engine = thallium::engine{};
@@ -106,18 +316,16 @@ std::unique_ptr<kage::Backend> MargoProxy::create(
             address,
             listening ? THALLIUM_SERVER_MODE : THALLIUM_CLIENT_MODE,
             &info};
-        auto remote_endpoint = internal_engine.lookup(remote_address);
-
         auto final_config = json::object();
         final_config["address"] = static_cast<std::string>(internal_engine.self());
-        final_config["remote_address"] = static_cast<std::string>(remote_endpoint);
+        final_config["remote_address"] = remote_address;
         final_config["listening"] = listening;
 
         return std::unique_ptr<kage::Backend>(
             new MargoProxy{
                 std::move(final_config),
                 std::move(internal_engine),
-                std::move(remote_endpoint)});
+                remote_address});
     } catch(const std::exception& ex) {
         throw kage::Exception{fmt::format("While initializing Margo: {}", ex.what())};
     }
@@ -8,19 +8,36 @@
 
 #include <zmq.hpp>
 #include <kage/Backend.hpp>
+#include "../HandlePool.hpp"
+#include <atomic>
 
 using json = nlohmann::json;
 
 /**
  * Margo implementation of an kage Backend.
+ *
+ * The remote address is looked up lazily, by the first request or
+ * heartbeat, so that the backend can be created before its peer is up.
  */
 class MargoProxy : public kage::Backend {
 
-    json                       m_config;
-    kage::InputProxy           m_input_proxy;
-    thallium::engine           m_internal_engine;
-    thallium::endpoint         m_remote_endpoint;
-    thallium::remote_procedure m_rpc;
+    json                              m_config;
+    kage::InputProxy                  m_input_proxy;
+    thallium::engine                  m_internal_engine;
+    std::string                       m_remote_address;
+    thallium::endpoint                m_remote_endpoint;
+    std::atomic<bool>                 m_connected{false};
+    thallium::mutex                   m_connect_mutex;
+    thallium::remote_procedure        m_rpc;
+    thallium::remote_procedure        m_oneway_rpc;
+    thallium::remote_procedure        m_heartbeat_rpc;
+    std::unique_ptr<kage::HandlePool> m_handles;
+    std::unique_ptr<kage::HandlePool> m_oneway_handles;
+
+    /**
+     * @brief Looks up the remote address if it has not been yet.
+     */
+    kage::Result<bool> connect();
 
     public:
 
@@ -29,7 +46,7 @@ class MargoProxy : public kage::Backend {
      */
     MargoProxy(json&& config,
                thallium::engine internal_engine,
-               thallium::endpoint remote_endpoint);
+               std::string remote_address);
 
     /**
      * @brief Move-constructor.
@@ -65,7 +82,13 @@ class MargoProxy : public kage::Backend {
      * @see Backend::forward
      */
     kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
-                                     const std::function<void(const char*, size_t)>& output_cb) override;
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override;
+
+    /**
+     * @see Backend::ping
+     */
+    kage::Result<uint64_t> ping(uint64_t timeout_ns) override;
 
     /**
      * @see Backend::setInputProxy
@@ -0,0 +1,117 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include "RecordBackend.hpp"
+#include <nlohmann/json-schema.hpp>
+#include <spdlog/spdlog.h>
+#include <chrono>
+
+KAGE_REGISTER_BACKEND(record, RecordProxy);
+
+using nlohmann::json;
+using nlohmann::json_schema::json_validator;
+
+RecordProxy::RecordProxy(json&& config, std::shared_ptr<kage::RecordLogWriter> log)
+: m_config(std::move(config))
+, m_log(std::move(log)) {}
+
+std::string RecordProxy::getConfig() const {
+    return m_config.dump();
+}
+
+std::string RecordProxy::getStatistics() const {
+    auto stats = json::object();
+    auto log = std::atomic_load(&m_log);
+    if(log) {
+        stats["recorded"] = log->recorded();
+        stats["dropped"] = log->dropped();
+        stats["used_bytes"] = log->used();
+    }
+    return stats.dump();
+}
+
+kage::Result<bool> RecordProxy::forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                              kage::OutputCallback output_cb,
+                                              kage::RequestContext& context) {
+    auto log = std::atomic_load(&m_log);
+    if(!m_next || !log)
+        return kage::Middleware::forwardOutput(rpc_id, input, input_size, output_cb, context);
+    auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    // a one-way request gets no response to wait for: record it
+    // before the next stage, which may return as soon as it is sent
+    if(context.one_way) {
+        log->append(timestamp, rpc_id, input, input_size, nullptr, 0, 0);
+        return m_next->forwardOutput(rpc_id, input, input_size, output_cb, context);
+    }
+    auto t_start = std::chrono::steady_clock::now();
+    auto elapsed = [&t_start]() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - t_start).count();
+    };
+    bool recorded = false;
+    auto record_unanswered = [&]() {
+        if(!recorded)
+            log->append(timestamp, rpc_id, input, input_size, nullptr, 0, elapsed());
+    };
+    kage::Result<bool> result;
+    try {
+        result = m_next->forwardOutput(rpc_id, input, input_size,
+            [&](const char* output, size_t output_size) {
+                auto latency = elapsed();
+                output_cb(output, output_size);
+                log->append(timestamp, rpc_id, input, input_size,
+                            output, output_size, latency);
+                recorded = true;
+            }, context);
+    } catch(...) {
+        record_unanswered();
+        throw;
+    }
+    record_unanswered();
+    return result;
+}
+
+kage::Result<bool> RecordProxy::destroy() {
+    std::atomic_store(&m_log, std::shared_ptr<kage::RecordLogWriter>{});
+    return kage::Result<bool>{};
+}
+
+std::unique_ptr<kage::Backend> RecordProxy::create(
+        const thallium::engine& engine,
+        const json& config,
+        const thallium::pool& pool) {
+    (void)engine;
+    (void)pool;
+    static const json schema = R"(
+    {
+        "type": "object",
+        "properties": {
+            "path": {"type": "string", "minLength": 1},
+            "capacity": {"type": "integer", "minimum": 4096}
+        },
+        "required": ["path"]
+    }
+    )"_json;
+    json_validator validator;
+    validator.set_root_schema(schema);
+    try {
+        validator.validate(config);
+    } catch(const std::exception& ex) {
+        throw kage::Exception{
+                fmt::format("While validating JSON config for record backend: {}", ex.what())};
+    }
+
+    auto final_config = json::object();
+    final_config["path"] = config["path"];
+    final_config["capacity"] = config.value("capacity", size_t{1} << 30);
+
+    auto log = std::make_shared<kage::RecordLogWriter>(
+        final_config["path"].get<std::string>(),
+        final_config["capacity"].get<size_t>());
+
+    return std::unique_ptr<kage::Backend>(
+        new RecordProxy{std::move(final_config), std::move(log)});
+}
@@ -0,0 +1,99 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __RECORD_BACKEND_HPP
+#define __RECORD_BACKEND_HPP
+
+#include <kage/Middleware.hpp>
+#include "RecordLog.hpp"
+
+using json = nlohmann::json;
+
+/**
+ * Record stage of a chain backend. Each request forwarded through this stage
+ * is appended, along with its output and latency, to a memory-mapped
+ * capture log that the kage-replay tool can replay later. Requests that get
+ * no response (failed or timed out) are recorded with an empty output.
+ *
+ * Forwards hold their own reference to the log writer, so that destroy()
+ * can close the log while requests are still in flight: the log is then
+ * unmapped once the last of them has been recorded.
+ */
+class RecordProxy : public kage::Middleware {
+
+    json                                   m_config;
+    std::shared_ptr<kage::RecordLogWriter> m_log;
+
+    public:
+
+    /**
+     * @brief Constructor.
+     */
+    RecordProxy(json&& config, std::shared_ptr<kage::RecordLogWriter> log);
+
+    /**
+     * @brief Move-constructor.
+     */
+    RecordProxy(RecordProxy&&) = delete;
+
+    /**
+     * @brief Copy-constructor.
+     */
+    RecordProxy(const RecordProxy&) = delete;
+
+    /**
+     * @brief Move-assignment operator.
+     */
+    RecordProxy& operator=(RecordProxy&&) = delete;
+
+    /**
+     * @brief Copy-assignment operator.
+     */
+    RecordProxy& operator=(const RecordProxy&) = delete;
+
+    /**
+     * @brief Destructor.
+     */
+    virtual ~RecordProxy() = default;
+
+    /**
+     * @brief Get the proxy's configuration as a JSON-formatted string.
+     */
+    std::string getConfig() const override;
+
+    /**
+     * @brief Get the number of recorded and dropped requests.
+     */
+    std::string getStatistics() const override;
+
+    /**
+     * @see Backend::forward
+     */
+    kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override;
+
+    /**
+     * @brief Closes the capture log.
+     */
+    kage::Result<bool> destroy() override;
+
+    /**
+     * @brief Static factory function used by the ProxyFactory to
+     * create a RecordProxy.
+     *
+     * @param engine Thallium engine
+     * @param config JSON configuration for the proxy
+     * @param pool Optional pool in which to submit work.
+     *
+     * @return a unique_ptr to a proxy
+     */
+    static std::unique_ptr<kage::Backend> create(
+            const thallium::engine& engine,
+            const json& config,
+            const thallium::pool& pool);
+};
+
+#endif
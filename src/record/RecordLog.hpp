@@ -0,0 +1,207 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_RECORD_LOG_HPP
+#define __KAGE_RECORD_LOG_HPP
+
+#include <kage/Exception.hpp>
+#include <mercury_proc.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace kage {
+
+/**
+ * Layout of a capture log: a LogHeader followed by a sequence of records,
+ * each made of a RecordHeader, the input bytes and the output bytes,
+ * padded to a multiple of 8 bytes. A record is complete once its size
+ * field is non-zero; readers stop at the first record of size 0. Requests
+ * that got no response, and one-way requests, have an output_size of 0.
+ */
+struct LogHeader {
+    char     magic[8];
+    uint64_t version;
+    uint64_t data_offset;
+    uint64_t reserved[5];
+};
+
+struct RecordHeader {
+    uint64_t size;         // total size of the record, written last
+    uint64_t timestamp_ns; // wall-clock time at which the request arrived
+    uint64_t rpc_id;
+    uint64_t input_size;
+    uint64_t output_size;
+    uint64_t latency_ns;
+
+    const char* input() const {
+        return reinterpret_cast<const char*>(this + 1);
+    }
+
+    const char* output() const {
+        return input() + input_size;
+    }
+};
+
+static constexpr char     RecordLogMagic[8] = {'K','A','G','E','R','E','C','1'};
+static constexpr uint64_t RecordLogVersion  = 1;
+
+/**
+ * @brief Append-only writer for a memory-mapped capture log.
+ * Writers reserve space with a single atomic fetch_add, then fill
+ * their record in place, so concurrent appends never take a lock.
+ * Records that do not fit in the remaining capacity are dropped.
+ */
+class RecordLogWriter {
+
+    int                   m_fd = -1;
+    char*                 m_base = nullptr;
+    size_t                m_capacity;
+    std::atomic<size_t>   m_offset{sizeof(LogHeader)};
+    std::atomic<uint64_t> m_recorded{0};
+    std::atomic<uint64_t> m_dropped{0};
+
+    public:
+
+    RecordLogWriter(const std::string& path, size_t capacity)
+    : m_capacity{capacity} {
+        m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(m_fd < 0)
+            throw Exception{"Could not open " + path + ": " + std::strerror(errno)};
+        if(::ftruncate(m_fd, m_capacity) != 0) {
+            auto err = errno;
+            ::close(m_fd);
+            throw Exception{"Could not resize " + path + ": " + std::strerror(err)};
+        }
+        void* addr = ::mmap(nullptr, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if(addr == MAP_FAILED) {
+            auto err = errno;
+            ::close(m_fd);
+            throw Exception{"Could not map " + path + ": " + std::strerror(err)};
+        }
+        m_base = static_cast<char*>(addr);
+        auto header = reinterpret_cast<LogHeader*>(m_base);
+        std::memcpy(header->magic, RecordLogMagic, sizeof(header->magic));
+        header->version     = RecordLogVersion;
+        header->data_offset = sizeof(LogHeader);
+    }
+
+    RecordLogWriter(const RecordLogWriter&) = delete;
+    RecordLogWriter& operator=(const RecordLogWriter&) = delete;
+
+    ~RecordLogWriter() {
+        auto used = std::min(m_offset.load(), m_capacity);
+        ::msync(m_base, used, MS_SYNC);
+        ::munmap(m_base, m_capacity);
+        if(::ftruncate(m_fd, used) != 0) {}
+        ::close(m_fd);
+    }
+
+    /**
+     * @brief Append a record.
+     *
+     * @return false if the log is full and the record was dropped.
+     */
+    bool append(uint64_t timestamp_ns, hg_id_t rpc_id,
+                const char* input, size_t input_size,
+                const char* output, size_t output_size,
+                uint64_t latency_ns) {
+        size_t size = (sizeof(RecordHeader) + input_size + output_size + 7) & ~size_t{7};
+        size_t offset = m_offset.fetch_add(size, std::memory_order_relaxed);
+        if(offset + size > m_capacity) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        auto record = reinterpret_cast<RecordHeader*>(m_base + offset);
+        record->timestamp_ns = timestamp_ns;
+        record->rpc_id       = rpc_id;
+        record->input_size   = input_size;
+        record->output_size  = output_size;
+        record->latency_ns   = latency_ns;
+        std::memcpy(m_base + offset + sizeof(RecordHeader), input, input_size);
+        if(output_size)
+            std::memcpy(m_base + offset + sizeof(RecordHeader) + input_size, output, output_size);
+        __atomic_store_n(&record->size, size, __ATOMIC_RELEASE);
+        m_recorded.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    uint64_t recorded() const { return m_recorded.load(); }
+    uint64_t dropped() const { return m_dropped.load(); }
+    size_t used() const { return std::min(m_offset.load(), m_capacity); }
+    size_t capacity() const { return m_capacity; }
+};
+
+/**
+ * @brief Read-only view of a capture log.
+ */
+class RecordLogReader {
+
+    int         m_fd = -1;
+    const char* m_base = nullptr;
+    size_t      m_size = 0;
+
+    public:
+
+    RecordLogReader(const std::string& path) {
+        m_fd = ::open(path.c_str(), O_RDONLY);
+        if(m_fd < 0)
+            throw Exception{"Could not open " + path + ": " + std::strerror(errno)};
+        struct stat st;
+        if(::fstat(m_fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(LogHeader)) {
+            ::close(m_fd);
+            throw Exception{path + " is not a kage capture log"};
+        }
+        m_size = st.st_size;
+        void* addr = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+        if(addr == MAP_FAILED) {
+            auto err = errno;
+            ::close(m_fd);
+            throw Exception{"Could not map " + path + ": " + std::strerror(err)};
+        }
+        m_base = static_cast<const char*>(addr);
+        auto header = reinterpret_cast<const LogHeader*>(m_base);
+        if(std::memcmp(header->magic, RecordLogMagic, sizeof(header->magic)) != 0
+        || header->version != RecordLogVersion) {
+            ::munmap(const_cast<char*>(m_base), m_size);
+            ::close(m_fd);
+            throw Exception{path + " is not a kage capture log"};
+        }
+    }
+
+    RecordLogReader(const RecordLogReader&) = delete;
+    RecordLogReader& operator=(const RecordLogReader&) = delete;
+
+    ~RecordLogReader() {
+        ::munmap(const_cast<char*>(m_base), m_size);
+        ::close(m_fd);
+    }
+
+    /**
+     * @brief Call f(const RecordHeader&) on each complete record, in log order.
+     */
+    template<typename F>
+    void forEach(F&& f) const {
+        size_t offset = reinterpret_cast<const LogHeader*>(m_base)->data_offset;
+        while(offset + sizeof(RecordHeader) <= m_size) {
+            auto record = reinterpret_cast<const RecordHeader*>(m_base + offset);
+            auto size = __atomic_load_n(&record->size, __ATOMIC_ACQUIRE);
+            if(size == 0 || offset + size > m_size) break;
+            f(*record);
+            offset += size;
+        }
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KAGE_RECORD_REPLAY_HPP
+#define __KAGE_RECORD_REPLAY_HPP
+
+#include "RecordLog.hpp"
+#include "../Statistics.hpp"
+#include <thallium.hpp>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace kage {
+
+/**
+ * @brief Replays the records of a capture log, issuing each of them in its
+ * own ULT of the engine's handler pool at its original time offset divided
+ * by speedup. send(const RecordHeader&) sends a request and returns false
+ * (or throws) if it failed.
+ *
+ * Records are appended when their request completes, so the log is not in
+ * arrival order when requests overlap; they are replayed in the order of
+ * their arrival time, relative to the earliest one.
+ *
+ * @return a JSON report with the number of requests and errors, the time
+ * the replay took, and the latency of the requests that succeeded.
+ */
+template<typename Send>
+nlohmann::json ReplayLog(const thallium::engine& engine, const RecordLogReader& log,
+                         double speedup, Send&& send) {
+    namespace tl = thallium;
+    Histogram latency;
+    std::atomic<uint64_t> errors{0};
+    std::vector<tl::managed<tl::thread>> ults;
+
+    auto replay = [&](const RecordHeader& record) {
+        auto t_start = std::chrono::steady_clock::now();
+        try {
+            if(!send(record)) {
+                errors++;
+                return;
+            }
+        } catch(const std::exception& ex) {
+            spdlog::debug("Replayed request failed: {}", ex.what());
+            errors++;
+            return;
+        }
+        latency.record(std::chrono::steady_clock::now() - t_start);
+    };
+
+    std::vector<const RecordHeader*> records;
+    log.forEach([&records](const RecordHeader& record) { records.push_back(&record); });
+    std::stable_sort(records.begin(), records.end(),
+        [](const RecordHeader* a, const RecordHeader* b) {
+            return a->timestamp_ns < b->timestamp_ns;
+        });
+
+    auto replay_start = std::chrono::steady_clock::now();
+    auto pool = engine.get_handler_pool();
+    for(auto record_ptr : records) {
+        auto& record = *record_ptr;
+        auto delta_ns = static_cast<int64_t>(record.timestamp_ns - records.front()->timestamp_ns);
+        auto offset = std::chrono::nanoseconds{static_cast<int64_t>(
+            std::max<int64_t>(delta_ns, 0) / speedup)};
+        auto deadline = replay_start + offset;
+        while(true) {
+            auto remaining = deadline - std::chrono::steady_clock::now();
+            if(remaining <= std::chrono::nanoseconds::zero()) break;
+            if(remaining > std::chrono::milliseconds{1})
+                tl::thread::sleep(engine,
+                    std::chrono::duration<double, std::milli>(remaining).count());
+            else
+                tl::thread::yield();
+        }
+        ults.push_back(pool.make_thread([&replay, &record]() { replay(record); }));
+    }
+    for(auto& ult : ults) ult->join();
+
+    auto report = nlohmann::json::object();
+    report["requests"] = latency.count() + errors.load();
+    report["errors"] = errors.load();
+    report["elapsed_s"] = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - replay_start).count();
+    report["latency"] = latency.toJson();
+    return report;
+}
+
+}
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include "TeeBackend.hpp"
+#include <nlohmann/json-schema.hpp>
+#include <spdlog/spdlog.h>
+#include <string_view>
+
+KAGE_REGISTER_BACKEND(tee, TeeProxy);
+
+using nlohmann::json;
+using nlohmann::json_schema::json_validator;
+using clock_type = std::chrono::steady_clock;
+
+static size_t hashOutput(const char* output, size_t output_size) {
+    return std::hash<std::string_view>{}(std::string_view{output, output_size});
+}
+
+TeeProxy::TeeProxy(json&& config,
+                   thallium::pool pool,
+                   std::shared_ptr<kage::Backend> primary,
+                   std::shared_ptr<kage::Backend> shadow)
+: m_config(std::move(config))
+, m_pool(std::move(pool))
+, m_primary(std::move(primary))
+, m_shadow(std::move(shadow))
+, m_max_queued(m_config.value("max_queued", size_t{128}))
+, m_max_in_flight(m_config.value("max_in_flight", size_t{4}))
+, m_compare(m_config.value("compare", true))
+{
+    for(size_t i = 0; i < m_max_in_flight; ++i)
+        m_shadow_ults.push_back(m_pool.make_thread([this]{ runShadowLoop(); }));
+}
+
+std::string TeeProxy::getConfig() const {
+    auto config = m_config;
+    config["primary"]["type"] = m_primary->name();
+    config["primary"]["config"] = json::parse(m_primary->getConfig());
+    config["shadow"]["type"] = m_shadow->name();
+    config["shadow"]["config"] = json::parse(m_shadow->getConfig());
+    return config.dump();
+}
+
+std::string TeeProxy::getStatistics() const {
+    auto stats = json::object();
+    stats["primary"] = json::parse(m_primary->getStatistics());
+    stats["primary"]["latency"] = m_primary_latency.toJson();
+    stats["shadow"] = json::parse(m_shadow->getStatistics());
+    stats["shadow"]["latency"] = m_shadow_latency.toJson();
+    stats["shadow"]["dropped"] = m_dropped.load();
+    stats["shadow"]["errors"] = m_shadow_errors.load();
+    if(m_compare) {
+        stats["shadow"]["matches"] = m_matches.load();
+        stats["shadow"]["mismatches"] = m_mismatches.load();
+    }
+    return stats.dump();
+}
+
+kage::Result<bool> TeeProxy::forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                           kage::OutputCallback output_cb,
+                                           kage::RequestContext& context) {
+    bool   has_output  = false;
+    size_t output_hash = 0;
+    auto t_start = clock_type::now();
+    auto result = m_primary->forwardOutput(rpc_id, input, input_size,
+        [this, &output_cb, &has_output, &output_hash](const char* output, size_t output_size) {
+            has_output = true;
+            if(m_compare) output_hash = hashOutput(output, output_size);
+            output_cb(output, output_size);
+        }, context);
+    m_primary_latency.record(clock_type::now() - t_start);
+
+    {
+        std::unique_lock<thallium::mutex> lock{m_queue_mtx};
+        if(m_queue.size() >= m_max_queued || m_need_stop) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+        m_queue.push_back(ShadowRequest{
+            rpc_id, context.one_way, kage::BufferPool::Buffer{input, input_size},
+            has_output, output_hash});
+    }
+    m_queue_cv.notify_one();
+    return result;
+}
+
+void TeeProxy::runShadowLoop() {
+    while(true) {
+        ShadowRequest request;
+        {
+            std::unique_lock<thallium::mutex> lock{m_queue_mtx};
+            while(m_queue.empty() && !m_need_stop)
+                m_queue_cv.wait(lock);
+            if(m_need_stop) break;
+            request = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        bool   has_output  = false;
+        size_t output_hash = 0;
+        auto t_start = clock_type::now();
+        kage::RequestContext context;
+        context.one_way = request.one_way;
+        try {
+            auto result = m_shadow->forwardOutput(
+                request.rpc_id, request.input.data(), request.input.size(),
+                [this, &has_output, &output_hash](const char* output, size_t output_size) {
+                    has_output = true;
+                    if(m_compare) output_hash = hashOutput(output, output_size);
+                }, context);
+            if(!result.success()) {
+                m_shadow_errors.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+        } catch(const std::exception& ex) {
+            spdlog::debug("[kage] Shadow backend failed to forward RPC: {}", ex.what());
+            m_shadow_errors.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        m_shadow_latency.record(clock_type::now() - t_start);
+        if(!m_compare || !request.has_primary_output) continue;
+        if(has_output && output_hash == request.primary_output_hash)
+            m_matches.fetch_add(1, std::memory_order_relaxed);
+        else
+            m_mismatches.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+kage::Result<bool> TeeProxy::waitReady(uint64_t timeout_ns) {
+    return WaitAllReady({m_primary, m_shadow}, timeout_ns);
+}
+
+void TeeProxy::setInputProxy(kage::InputProxy proxy) {
+    m_primary->setInputProxy(proxy);
+    m_shadow->setInputProxy(std::move(proxy));
+}
+
+kage::Result<bool> TeeProxy::destroy() {
+    {
+        std::unique_lock<thallium::mutex> lock{m_queue_mtx};
+        m_need_stop = true;
+        m_queue.clear();
+    }
+    m_queue_cv.notify_all();
+    for(auto& ult : m_shadow_ults) {
+        ult->join();
+        ult.release();
+    }
+    m_shadow_ults.clear();
+    auto result = m_primary->destroy();
+    auto shadow_result = m_shadow->destroy();
+    if(!shadow_result.success()) result = std::move(shadow_result);
+    return result;
+}
+
+std::unique_ptr<kage::Backend> TeeProxy::create(
+        const thallium::engine& engine,
+        const json& config,
+        const thallium::pool& pool) {
+    static const json schema = R"(
+    {
+        "type": "object",
+        "properties": {
+            "primary": {
+                "type": "object",
+                "properties": {
+                    "type": {"type": "string"},
+                    "config": {"type": "object"}
+                },
+                "required": ["type"]
+            },
+            "shadow": {
+                "type": "object",
+                "properties": {
+                    "type": {"type": "string"},
+                    "config": {"type": "object"}
+                },
+                "required": ["type"]
+            },
+            "max_queued": {"type": "integer", "minimum": 0},
+            "max_in_flight": {"type": "integer", "minimum": 1},
+            "compare": {"type": "boolean"}
+        },
+        "required": ["primary", "shadow"]
+    }
+    )"_json;
+    json_validator validator;
+    validator.set_root_schema(schema);
+    try {
+        validator.validate(config);
+    } catch(const std::exception& ex) {
+        throw kage::Exception{
+                fmt::format("While validating JSON config for tee backend: {}", ex.what())};
+    }
+
+    std::shared_ptr<kage::Backend> primary =
+        kage::ProxyFactory::createProxy(config["primary"], engine, pool);
+    std::shared_ptr<kage::Backend> shadow;
+    try {
+        shadow = kage::ProxyFactory::createProxy(config["shadow"], engine, pool);
+    } catch(...) {
+        primary->destroy();
+        throw;
+    }
+
+    return std::unique_ptr<kage::Backend>(
+        new TeeProxy{json(config), pool, std::move(primary), std::move(shadow)});
+}
@@ -0,0 +1,147 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __TEE_BACKEND_HPP
+#define __TEE_BACKEND_HPP
+
+#include <kage/Backend.hpp>
+#include "../BufferPool.hpp"
+#include "../Statistics.hpp"
+#include <deque>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+ * Tee implementation of a kage Backend. Each request is forwarded to
+ * a primary backend, whose output is the only one the client sees, and
+ * is then queued to be replayed asynchronously on a shadow backend by
+ * max_in_flight ULTs, so that up to that many shadow requests are sent
+ * concurrently. Shadow requests are dropped when the queue is full, so
+ * that the shadow never slows down the primary path.
+ */
+class TeeProxy : public kage::Backend {
+
+    struct ShadowRequest {
+        hg_id_t                  rpc_id;
+        bool                     one_way;
+        kage::BufferPool::Buffer input;
+        bool                     has_primary_output;
+        size_t                   primary_output_hash;
+    };
+
+    json                           m_config;
+    thallium::pool                 m_pool;
+    std::shared_ptr<kage::Backend> m_primary;
+    std::shared_ptr<kage::Backend> m_shadow;
+    size_t                         m_max_queued;
+    size_t                         m_max_in_flight;
+    bool                           m_compare;
+
+    thallium::mutex                                  m_queue_mtx;
+    thallium::condition_variable                     m_queue_cv;
+    std::deque<ShadowRequest>                        m_queue;
+    bool                                             m_need_stop = false;
+    std::vector<thallium::managed<thallium::thread>> m_shadow_ults;
+
+    kage::Histogram       m_primary_latency;
+    kage::Histogram       m_shadow_latency;
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<uint64_t> m_shadow_errors{0};
+    std::atomic<uint64_t> m_matches{0};
+    std::atomic<uint64_t> m_mismatches{0};
+
+    public:
+
+    /**
+     * @brief Constructor.
+     */
+    TeeProxy(json&& config,
+             thallium::pool pool,
+             std::shared_ptr<kage::Backend> primary,
+             std::shared_ptr<kage::Backend> shadow);
+
+    /**
+     * @brief Move-constructor.
+     */
+    TeeProxy(TeeProxy&&) = delete;
+
+    /**
+     * @brief Copy-constructor.
+     */
+    TeeProxy(const TeeProxy&) = delete;
+
+    /**
+     * @brief Move-assignment operator.
+     */
+    TeeProxy& operator=(TeeProxy&&) = delete;
+
+    /**
+     * @brief Copy-assignment operator.
+     */
+    TeeProxy& operator=(const TeeProxy&) = delete;
+
+    /**
+     * @brief Destructor.
+     */
+    virtual ~TeeProxy() = default;
+
+    /**
+     * @brief Get the proxy's configuration as a JSON-formatted string.
+     */
+    std::string getConfig() const override;
+
+    /**
+     * @brief Get latency and response-equality statistics
+     * for the primary and the shadow as a JSON-formatted string.
+     */
+    std::string getStatistics() const override;
+
+    /**
+     * @see Backend::forward
+     */
+    kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override;
+
+    /**
+     * @brief Waits for the primary and shadow backends to be ready.
+     */
+    kage::Result<bool> waitReady(uint64_t timeout_ns) override;
+
+    /**
+     * @see Backend::setInputProxy
+     */
+    void setInputProxy(kage::InputProxy proxy) override;
+
+    /**
+     * @brief Stops the shadow ULTs and destroys both backends.
+     *
+     * @return a Result<bool> instance indicating
+     * whether the backends were successfully destroyed.
+     */
+    kage::Result<bool> destroy() override;
+
+    /**
+     * @brief Static factory function used by the ProxyFactory to
+     * create a TeeProxy.
+     *
+     * @param engine Thallium engine
+     * @param config JSON configuration for the proxy
+     * @param pool Optional pool in which to submit work.
+     *
+     * @return a unique_ptr to a proxy
+     */
+    static std::unique_ptr<kage::Backend> create(
+            const thallium::engine& engine,
+            const json& config,
+            const thallium::pool& pool);
+
+    private:
+
+    void runShadowLoop();
+};
+
+#endif
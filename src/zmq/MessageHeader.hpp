@@ -0,0 +1,46 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __ZMQ_MESSAGE_HEADER_HPP
+#define __ZMQ_MESSAGE_HEADER_HPP
+
+#include <thallium.hpp>
+#include <cstdint>
+
+/**
+ * Each message is a single frame made of this header followed by the payload.
+ * A request that expects a response has a non-zero request_id, which the
+ * input side echoes back in the response. The remote_*_ns fields are
+ * filled by the input side in its response when the request is
+ * instrumented, and trace_id and span_id propagate the request's trace,
+ * if any, and remaining_ns the time left before the request's deadline,
+ * if any (see kage::RequestContext). Heartbeats are messages without
+ * payload whose heartbeat field is their sequence number (0 for other
+ * messages); the input side echoes them back right away.
+ *
+ * Payloads larger than the configured chunk size are sent as several
+ * messages sharing a non-zero message_id, each holding total_size bytes
+ * from chunk_offset onward, so that other messages can be interleaved
+ * with them. Other messages have a message_id of 0.
+ */
+struct __attribute__ ((packed)) MessageHeader {
+    uint64_t        request_id;
+    hg_id_t         rpc_id;
+    bool            is_forward;
+    bool            instrumented;
+    bool            one_way;
+    uint64_t        remote_queue_ns;
+    uint64_t        remote_target_ns;
+    uint64_t        remote_response_ns;
+    uint64_t        trace_id;
+    uint64_t        span_id;
+    uint64_t        remaining_ns;
+    uint64_t        heartbeat;
+    uint64_t        message_id;
+    uint64_t        total_size;
+    uint64_t        chunk_offset;
+};
+
+#endif
@@ -4,28 +4,49 @@
  * See COPYRIGHT in top-level directory.
  */
 #include "ZMQBackend.hpp"
+#include "MessageHeader.hpp"
+#include "../BufferPool.hpp"
+#include "../Hash.hpp"
 #include <nlohmann/json-schema.hpp>
 #include <spdlog/spdlog.h>
 #include <zmq.hpp>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
 #include <iostream>
+#include <memory>
 
 KAGE_REGISTER_BACKEND(zmq, ZMQProxy);
 
+/**
+ * State of a request waiting for its response. The response is delivered
+ * (callback called, result set) by the polling ULT, which then sets done
+ * under the proxy's m_pending_mutex and notifies cv.
+ */
 struct MessageContext {
 
-    thallium::eventual<void>                        ev;
-    const std::function<void(const char*, size_t)>& callback;
-    kage::Result<bool>                              result;
+    thallium::condition_variable cv;
+    bool                         done = false;
+    kage::OutputCallback         callback;
+    kage::RequestContext&        request_context;
+    kage::Result<bool>           result;
 
-    MessageContext(const std::function<void(const char*, size_t)>& cb)
-    : callback{cb} {}
+    MessageContext(kage::OutputCallback cb, kage::RequestContext& ctx)
+    : callback{cb}, request_context{ctx} {}
 };
 
-struct __attribute__ ((packed)) MessageHeader {
-    MessageContext* sender_ctx;
-    hg_id_t         rpc_id;
-    bool            is_forward;
-};
+/**
+ * Copies the header and the payload into a pooled buffer that ZMQ
+ * releases once it has been sent. The payload is copied because a message
+ * is a single frame, and because the caller's buffer may be gone by the
+ * time ZMQ's I/O thread sends it (e.g. for one-way requests).
+ */
+static zmq::message_t makeMessage(const MessageHeader& header, const char* data, size_t size) {
+    auto buffer = kage::BufferPool::Get().acquire(sizeof(header) + size);
+    std::memcpy(buffer, &header, sizeof(header));
+    if(size) std::memcpy(buffer + sizeof(header), data, size);
+    return zmq::message_t{buffer, sizeof(header) + size, &kage::BufferPool::Release};
+}
 
 using nlohmann::json;
 using nlohmann::json_schema::json_validator;
@@ -40,6 +61,26 @@ ZMQProxy::ZMQProxy(json&& config, thallium::pool pool,
 , m_pub_socket(std::move(pub_socket))
 , m_sub_socket(std::move(sub_socket))
 {
+    if(m_config.contains("dispatch")) {
+        auto& dispatch = m_config["dispatch"];
+        m_ordering_key = dispatch.value("key", "rpc_id") == "payload"
+                       ? OrderingKey::Payload : OrderingKey::RpcId;
+        m_key_offset = dispatch.value("key_offset", size_t{0});
+        m_key_length = dispatch.value("key_length", size_t{0});
+        m_dispatcher = std::make_unique<kage::OrderedDispatcher<InboundMessage>>(
+            m_pool,
+            dispatch.value("shards", size_t{16}),
+            dispatch.value("max_queued", size_t{1024}),
+            [this](InboundMessage& inbound) { handleForward(inbound); });
+    }
+    if(m_config.contains("chunking")) {
+        auto& chunking = m_config["chunking"];
+        m_chunk_size = chunking.value("chunk_size", size_t{1} << 20);
+        m_max_queued_chunks = chunking.value("max_queued_chunks", size_t{16});
+        m_max_reassembly_bytes = chunking.value("max_reassembly_bytes", m_max_reassembly_bytes);
+        m_reassembly_timeout_ns = static_cast<uint64_t>(
+            chunking.value("reassembly_timeout_ms", 10000.0) * 1e6);
+    }
     m_polling_ult = m_pool.make_thread([this]{ runPollingLoop(); });
 }
 
@@ -47,20 +88,115 @@ std::string ZMQProxy::getConfig() const {
     return m_config.dump();
 }
 
+std::string ZMQProxy::getStatistics() const {
+    auto stats = json::object();
+    if(m_dispatcher) stats["dispatch"] = m_dispatcher->statistics();
+    stats["timed_out"] = m_timed_out.load(std::memory_order_relaxed);
+    stats["late_responses"] = m_late_responses.load(std::memory_order_relaxed);
+    stats["chunking"] = json{
+        {"chunk_size", m_chunk_size},
+        {"chunked_messages", m_chunked_messages.load(std::memory_order_relaxed)},
+        {"sent_chunks", m_sent_chunks.load(std::memory_order_relaxed)},
+        {"reassembled_messages", m_reassembled_messages.load(std::memory_order_relaxed)},
+        {"dropped_messages", m_dropped_messages.load(std::memory_order_relaxed)},
+        {"expired_messages", m_expired_messages.load(std::memory_order_relaxed)}
+    };
+    return stats.dump();
+}
+
+void ZMQProxy::send(zmq::message_t& msg) {
+    std::unique_lock<thallium::mutex> lock{m_send_mutex};
+    m_pub_socket.send(msg, zmq::send_flags::none);
+}
+
 kage::Result<bool> ZMQProxy::forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
-                                           const std::function<void(const char*, size_t)>& output_cb) {
-    auto context = MessageContext{output_cb};
-    auto header = MessageHeader{&context, rpc_id, true};
+                                           kage::OutputCallback output_cb,
+                                           kage::RequestContext& context) {
+    MessageContext msg_context{output_cb, context};
+    uint64_t request_id = 0;
+    if(!context.one_way) {
+        std::unique_lock<thallium::mutex> lock{m_pending_mutex};
+        request_id = m_next_request_id++;
+        m_pending.emplace(request_id, &msg_context);
+    }
+    auto header = MessageHeader{
+        request_id, rpc_id, true,
+        context.instrumented, context.one_way, 0, 0, 0,
+        context.trace_id, context.span_id, context.remainingBudget(), 0, 0, 0, 0};
 
-    zmq::message_t header_msg{&header, sizeof(header)};
-    zmq::message_t input_msg{input, input_size};
+    context.stamp(kage::RequestContext::BackendSend);
+    sendPayload(header, input, input_size);
 
-    m_pub_socket.send(header_msg, zmq::send_flags::sndmore);
-    m_pub_socket.send(input_msg, zmq::send_flags::none);
+    // No response will come back for a one-way request
+    if(context.one_way) return msg_context.result;
 
-    context.ev.wait();
+    std::unique_lock<thallium::mutex> lock{m_pending_mutex};
+    if(context.deadline_ns) {
+        auto remaining_ns = context.remainingBudget();
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec  += (deadline.tv_nsec + remaining_ns) / 1000000000;
+        deadline.tv_nsec  = (deadline.tv_nsec + remaining_ns) % 1000000000;
+        while(!msg_context.done) {
+            if(!msg_context.cv.wait_until(lock, &deadline)) break;
+        }
+        // If the entry is gone, the polling ULT is delivering
+        // the response and msg_context must outlive it
+        if(!msg_context.done && m_pending.erase(request_id)) {
+            m_timed_out.fetch_add(1, std::memory_order_relaxed);
+            return kage::Result<bool>{kage::ErrorCode::Timeout, "Request deadline expired"};
+        }
+    }
+    while(!msg_context.done) msg_context.cv.wait(lock);
+
+    return msg_context.result;
+}
 
-    return context.result;
+MessageContext* ZMQProxy::takePending(uint64_t request_id) {
+    std::unique_lock<thallium::mutex> lock{m_pending_mutex};
+    auto it = m_pending.find(request_id);
+    if(it == m_pending.end()) {
+        m_late_responses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    auto msg_context = it->second;
+    m_pending.erase(it);
+    return msg_context;
+}
+
+void ZMQProxy::completePending(MessageContext* msg_context) {
+    std::unique_lock<thallium::mutex> lock{m_pending_mutex};
+    msg_context->done = true;
+    msg_context->cv.notify_one();
+}
+
+kage::Result<uint64_t> ZMQProxy::ping(uint64_t timeout_ns) {
+    kage::Result<uint64_t> result;
+    auto header = MessageHeader{};
+    header.is_forward = true;
+    {
+        std::unique_lock<thallium::mutex> lock{m_heartbeat_mutex};
+        header.heartbeat = ++m_heartbeat_sent;
+    }
+    auto t_start = kage::RequestContext::now();
+    auto msg = makeMessage(header, nullptr, 0);
+    send(msg);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += (deadline.tv_nsec + timeout_ns) / 1000000000;
+    deadline.tv_nsec  = (deadline.tv_nsec + timeout_ns) % 1000000000;
+    std::unique_lock<thallium::mutex> lock{m_heartbeat_mutex};
+    while(m_heartbeat_acked < header.heartbeat) {
+        if(!m_heartbeat_cv.wait_until(lock, &deadline)) break;
+    }
+    if(m_heartbeat_acked < header.heartbeat) {
+        result.success() = false;
+        result.error() = "Heartbeat timed out";
+    } else {
+        result.value() = kage::RequestContext::now() - t_start;
+    }
+    return result;
 }
 
 void ZMQProxy::setInputProxy(kage::InputProxy proxy) {
@@ -72,6 +208,22 @@ kage::Result<bool> ZMQProxy::destroy() {
     m_need_stop.store(true);
     m_polling_ult->join();
     m_polling_ult.release();
+    if(m_dispatcher) m_dispatcher->stop();
+    {
+        std::unique_lock<thallium::mutex> lock{m_forward_mutex};
+        while(m_forwards_in_flight) m_forward_cv.wait(lock);
+    }
+    {
+        // Drop the chunks ZMQ has not sent, so that their callbacks,
+        // which use m_chunk_mutex, have all run once the proxy is gone
+        m_pub_socket.set(zmq::sockopt::linger, 0);
+        m_pub_socket.close();
+        std::unique_lock<thallium::mutex> lock{m_chunk_mutex};
+        while(m_queued_chunks) m_chunk_cv.wait(lock);
+    }
+    for(auto& p : m_reassemblies)
+        kage::BufferPool::Get().release(p.second.buffer);
+    m_reassemblies.clear();
     result.value() = true;
     return result;
 }
@@ -86,7 +238,26 @@ std::unique_ptr<kage::Backend> ZMQProxy::create(
         "type": "object",
         "properties": {
             "pub_address": {"type": "string"},
-            "sub_address": {"type": "string"}
+            "sub_address": {"type": "string"},
+            "dispatch": {
+                "type": "object",
+                "properties": {
+                    "key": {"type": "string", "enum": ["rpc_id", "payload"]},
+                    "key_offset": {"type": "integer", "minimum": 0},
+                    "key_length": {"type": "integer", "minimum": 0},
+                    "shards": {"type": "integer", "minimum": 1},
+                    "max_queued": {"type": "integer", "minimum": 1}
+                }
+            },
+            "chunking": {
+                "type": "object",
+                "properties": {
+                    "chunk_size": {"type": "integer", "minimum": 1},
+                    "max_queued_chunks": {"type": "integer", "minimum": 1},
+                    "max_reassembly_bytes": {"type": "integer", "minimum": 0},
+                    "reassembly_timeout_ms": {"type": "number", "exclusiveMinimum": 0}
+                }
+            }
         },
         "required": ["pub_address", "sub_address"]
     }
@@ -106,6 +277,10 @@ std::unique_ptr<kage::Backend> ZMQProxy::create(
     auto final_config = json::object();
     final_config["pub_address"] = pub_address;
     final_config["sub_address"] = sub_address;
+    if(config.contains("dispatch"))
+        final_config["dispatch"] = config["dispatch"];
+    if(config.contains("chunking"))
+        final_config["chunking"] = config["chunking"];
 
     bool pub_bind = pub_address.find('*') != std::string::npos;
     bool sub_bind = sub_address.find('*') != std::string::npos;
@@ -142,6 +317,8 @@ void ZMQProxy::runPollingLoop() {
         thallium::thread::yield();
         // Poll the socket with a timeout
         int rc = zmq::poll(items, 1, std::chrono::milliseconds(100));
+        if(!m_reassemblies.empty())
+            expireReassemblies(kage::RequestContext::now());
 
         if (rc == -1) {
             spdlog::error("ZMQ's zmq::poll failed with error code {}", rc);
@@ -158,34 +335,252 @@ void ZMQProxy::runPollingLoop() {
 
             // Receive message from the other endpoint
             m_sub_socket.recv(msg, zmq::recv_flags::none);
-            MessageHeader header;
-            memcpy(&header, msg.data(), sizeof(header));
+            handleMessage(std::move(msg), kage::RequestContext::now());
+        }
+    }
+}
 
-            m_sub_socket.recv(msg, zmq::recv_flags::none);
-            const char* data      = static_cast<const char*>(msg.data());
-            size_t      data_size = msg.size();
-
-            if(header.is_forward) {
-                // Received a "forward" request from other endpoint
-                auto output_cb = [this, &header](const char* output, size_t output_size) {
-                    // We are supposed to "echo" the header with "is_forward" set to false,
-                    // alontg with our output data.
-                    header.is_forward = false;
-
-                    zmq::message_t header_msg{&header, sizeof(header)};
-                    zmq::message_t output_msg{output, output_size};
-                    m_pub_socket.send(header_msg, zmq::send_flags::sndmore);
-                    m_pub_socket.send(output_msg, zmq::send_flags::none);
-
-                    // FIXME: the above call is blocking, maybe find a way to make it not block
-                };
-                m_input_proxy.forwardInput(header.rpc_id, data, data_size, output_cb);
-            } else {
-                // Received the response for an RPC we have forwarded
-                MessageContext* sender_ctx = header.sender_ctx;
-                sender_ctx->callback(data, data_size);
-                sender_ctx->ev.set_value();
+void ZMQProxy::handleMessage(zmq::message_t&& msg, uint64_t received_ns) {
+    if(msg.size() < sizeof(MessageHeader)) {
+        spdlog::error("[kage] ZMQ backend received a message without header");
+        return;
+    }
+    MessageHeader header;
+    memcpy(&header, msg.data(), sizeof(header));
+
+    const char* data      = static_cast<const char*>(msg.data()) + sizeof(header);
+    size_t      data_size = msg.size() - sizeof(header);
+
+    if(header.message_id) {
+        reassemble(header, data, data_size, received_ns);
+        return;
+    }
+
+    if(header.heartbeat) {
+        if(header.is_forward) {
+            // Echo heartbeats from the polling ULT,
+            // which never waits on requests
+            header.is_forward = false;
+            auto pong = makeMessage(header, nullptr, 0);
+            send(pong);
+        } else {
+            std::unique_lock<thallium::mutex> lock{m_heartbeat_mutex};
+            m_heartbeat_acked = std::max(m_heartbeat_acked, header.heartbeat);
+            m_heartbeat_cv.notify_all();
+        }
+        return;
+    }
+
+    if(header.is_forward) {
+        // Received a "forward" request from other endpoint
+        if(!m_dispatcher) {
+            {
+                std::unique_lock<thallium::mutex> lock{m_forward_mutex};
+                ++m_forwards_in_flight;
             }
+            auto inbound = std::make_shared<InboundMessage>(
+                InboundMessage{std::move(msg), received_ns});
+            m_pool.make_thread([this, inbound]() {
+                handleForward(*inbound);
+                std::unique_lock<thallium::mutex> lock{m_forward_mutex};
+                if(--m_forwards_in_flight == 0) m_forward_cv.notify_all();
+            }, thallium::anonymous());
+            return;
+        }
+        auto key = m_ordering_key == OrderingKey::RpcId
+                 ? static_cast<uint64_t>(header.rpc_id)
+                 : kage::HashPayloadRange(data, data_size, m_key_offset, m_key_length);
+        auto inbound = InboundMessage{std::move(msg), received_ns};
+        if(!m_dispatcher->tryPush(key, inbound)) {
+            spdlog::debug("[kage] ZMQ backend dispatch queue full, rejecting request");
+            respondEmpty(header);
+        }
+    } else {
+        // Received the response for an RPC we have forwarded,
+        // unless the request has already given up on it
+        auto sender_ctx = takePending(header.request_id);
+        if(!sender_ctx) {
+            spdlog::debug("[kage] ZMQ backend dropping late response to request {}",
+                          static_cast<uint64_t>(header.request_id));
+            return;
+        }
+        auto& request_context = sender_ctx->request_context;
+        request_context.stamp(kage::RequestContext::ResponseReceived);
+        request_context.remote_queue_ns    = header.remote_queue_ns;
+        request_context.remote_target_ns   = header.remote_target_ns;
+        request_context.remote_response_ns = header.remote_response_ns;
+        sender_ctx->callback(data, data_size);
+        completePending(sender_ctx);
+    }
+}
+
+void ZMQProxy::reassemble(const MessageHeader& header, const char* data, size_t size,
+                          uint64_t received_ns) {
+    auto it = m_reassemblies.find(header.message_id);
+    if(it == m_reassemblies.end()) {
+        Reassembly reassembly;
+        reassembly.total_size  = header.total_size;
+        reassembly.received_ns = received_ns;
+        if(m_reassembly_bytes + header.total_size <= m_max_reassembly_bytes) {
+            // Header first, so that the reassembled payload can take
+            // the same path as a message that was sent in one piece
+            auto chunk_header = header;
+            chunk_header.message_id   = 0;
+            chunk_header.total_size   = 0;
+            chunk_header.chunk_offset = 0;
+            reassembly.buffer = kage::BufferPool::Get().acquire(sizeof(header) + header.total_size);
+            std::memcpy(reassembly.buffer, &chunk_header, sizeof(header));
+            m_reassembly_bytes += header.total_size;
+        } else {
+            spdlog::error("[kage] ZMQ backend cannot reassemble a {} bytes message "
+                          "without exceeding max_reassembly_bytes", header.total_size);
+            m_dropped_messages.fetch_add(1, std::memory_order_relaxed);
+            rejectChunked(header, "Response too large to reassemble");
+        }
+        it = m_reassemblies.emplace(header.message_id, reassembly).first;
+    }
+    auto& reassembly = it->second;
+    if(header.chunk_offset + size > reassembly.total_size) {
+        spdlog::error("[kage] ZMQ backend received a chunk outside of its message");
+        return;
+    }
+    if(reassembly.buffer)
+        std::memcpy(reassembly.buffer + sizeof(header) + header.chunk_offset, data, size);
+    reassembly.received += size;
+    reassembly.last_chunk_ns = received_ns;
+    if(reassembly.received < reassembly.total_size) return;
+
+    auto complete = reassembly;
+    m_reassemblies.erase(it);
+    if(!complete.buffer) return;
+    m_reassembly_bytes -= complete.total_size;
+    m_reassembled_messages.fetch_add(1, std::memory_order_relaxed);
+    handleMessage(
+        zmq::message_t{complete.buffer, sizeof(header) + complete.total_size,
+                       &kage::BufferPool::Release},
+        complete.received_ns);
+}
+
+void ZMQProxy::respondEmpty(MessageHeader header) {
+    // An empty output, which the client sees as an error
+    if(header.one_way) return;
+    header.is_forward   = false;
+    header.message_id   = 0;
+    header.total_size   = 0;
+    header.chunk_offset = 0;
+    auto msg = makeMessage(header, nullptr, 0);
+    send(msg);
+}
+
+void ZMQProxy::rejectChunked(MessageHeader header, const char* error) {
+    if(header.is_forward) {
+        respondEmpty(header);
+    } else {
+        auto sender_ctx = takePending(header.request_id);
+        if(!sender_ctx) return;
+        sender_ctx->result = kage::Result<bool>{kage::ErrorCode::Transport, error};
+        completePending(sender_ctx);
+    }
+}
+
+void ZMQProxy::expireReassemblies(uint64_t now_ns) {
+    for(auto it = m_reassemblies.begin(); it != m_reassemblies.end();) {
+        auto& reassembly = it->second;
+        if(now_ns - reassembly.last_chunk_ns < m_reassembly_timeout_ns) {
+            ++it;
+            continue;
+        }
+        // Dropped messages were answered when their first chunk came
+        if(reassembly.buffer) {
+            spdlog::error("[kage] ZMQ backend gave up reassembling a {} bytes message "
+                          "after receiving {} bytes", reassembly.total_size, reassembly.received);
+            MessageHeader header;
+            std::memcpy(&header, reassembly.buffer, sizeof(header));
+            kage::BufferPool::Get().release(reassembly.buffer);
+            m_reassembly_bytes -= reassembly.total_size;
+            m_expired_messages.fetch_add(1, std::memory_order_relaxed);
+            rejectChunked(header, "Response not fully received in time");
+        }
+        it = m_reassemblies.erase(it);
+    }
+}
+
+/**
+ * Same as makeMessage for a chunk of a larger payload: the counter of
+ * chunks queued in ZMQ is decremented once ZMQ has sent the chunk.
+ */
+zmq::message_t ZMQProxy::makeChunk(const MessageHeader& header, const char* data, size_t size) {
+    auto buffer = kage::BufferPool::Get().acquire(sizeof(header) + size);
+    std::memcpy(buffer, &header, sizeof(header));
+    std::memcpy(buffer + sizeof(header), data, size);
+    return zmq::message_t{buffer, sizeof(header) + size,
+        [](void* data, void* hint) {
+            kage::BufferPool::Release(data, nullptr);
+            static_cast<ZMQProxy*>(hint)->chunkSent();
+        }, this};
+}
+
+void ZMQProxy::chunkSent() {
+    std::unique_lock<thallium::mutex> lock{m_chunk_mutex};
+    --m_queued_chunks;
+    m_chunk_cv.notify_one();
+}
+
+void ZMQProxy::sendPayload(MessageHeader& header, const char* data, size_t size) {
+    if(m_chunk_size == 0 || size <= m_chunk_size) {
+        auto msg = makeMessage(header, data, size);
+        send(msg);
+        return;
+    }
+    header.message_id = m_next_message_id.fetch_add(1, std::memory_order_relaxed);
+    header.total_size = size;
+    for(size_t offset = 0; offset < size; offset += m_chunk_size) {
+        {
+            // Bound the memory held by chunks that ZMQ has not sent yet
+            std::unique_lock<thallium::mutex> lock{m_chunk_mutex};
+            while(m_queued_chunks >= m_max_queued_chunks)
+                m_chunk_cv.wait(lock);
+            ++m_queued_chunks;
         }
+        header.chunk_offset = offset;
+        auto chunk_size = std::min(m_chunk_size, size - offset);
+        auto msg = makeChunk(header, data + offset, chunk_size);
+        send(msg);
+        m_sent_chunks.fetch_add(1, std::memory_order_relaxed);
+        // Let other ULTs send their messages between two chunks
+        thallium::thread::yield();
     }
+    m_chunked_messages.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ZMQProxy::handleForward(InboundMessage& inbound) {
+    MessageHeader header;
+    memcpy(&header, inbound.msg.data(), sizeof(header));
+
+    const char* data      = static_cast<const char*>(inbound.msg.data()) + sizeof(header);
+    size_t      data_size = inbound.msg.size() - sizeof(header);
+
+    // Queueing in the dispatcher counts against the deadline
+    kage::RequestContext context;
+    context.instrumented = header.instrumented;
+    context.one_way      = header.one_way;
+    context.trace_id     = header.trace_id;
+    context.span_id      = header.span_id;
+    context.deadline_ns  = header.remaining_ns ? inbound.received_ns + header.remaining_ns : 0;
+    if(context.instrumented)
+        context.timestamps[kage::RequestContext::RemoteReceived] = inbound.received_ns;
+    auto output_cb = [this, &header, &context](const char* output, size_t output_size) {
+        if(context.one_way) return;
+        // We are supposed to "echo" the header with "is_forward" set to false,
+        // alontg with our output data.
+        header.is_forward = false;
+        context.stamp(kage::RequestContext::ResponseSend);
+        context.computeRemoteDurations();
+        header.remote_queue_ns    = context.remote_queue_ns;
+        header.remote_target_ns   = context.remote_target_ns;
+        header.remote_response_ns = context.remote_response_ns;
+
+        sendPayload(header, output, output_size);
+    };
+    m_input_proxy.forwardInput(header.rpc_id, data, data_size, output_cb, context);
 }
@@ -8,11 +8,44 @@
 
 #include <zmq.hpp>
 #include <kage/Backend.hpp>
+#include "../OrderedDispatcher.hpp"
+#include <atomic>
+#include <unordered_map>
 
 using json = nlohmann::json;
 
+struct MessageHeader;
+struct MessageContext;
+
 /**
  * ZMQ implementation of an kage Backend.
+ *
+ * The polling ULT only reads messages, answers heartbeats and delivers
+ * responses; it never waits on a request's target, so that a slow target
+ * does not make the remote miss heartbeats. By default, each request
+ * received from the remote is forwarded to the input side in its own ULT
+ * of the proxy's pool, in no particular order. With a "dispatch"
+ * configuration, they are instead handed to an OrderedDispatcher keyed on
+ * the rpc_id or on a byte range of the payload: requests with the same
+ * key are forwarded in order, requests with different keys in parallel in
+ * the proxy's pool. A request whose shard already holds "max_queued"
+ * requests is answered with an error right away, so that a slow key does
+ * not stall the polling ULT, and with it the other keys, responses and
+ * heartbeats.
+ *
+ * With a "chunking" configuration, payloads (requests and responses) larger
+ * than "chunk_size" are sent as a series of chunks, between which other
+ * messages can be sent, and at most "max_queued_chunks" chunks wait in ZMQ's
+ * queue at any time. The receiver reassembles chunks into a single buffer,
+ * holding at most "max_reassembly_bytes" of incomplete messages; messages
+ * beyond that bound are dropped and answered with an error, and so are
+ * incomplete messages that received no chunk for "reassembly_timeout_ms"
+ * (e.g. because the sender died), which frees their buffer. A transfer
+ * that keeps making progress is never expired, however long it takes.
+ *
+ * Requests wait for their response until their deadline, if any. Each of
+ * them is registered under a request id, which the response carries back;
+ * a response that comes after its request gave up is dropped.
  */
 class ZMQProxy : public kage::Backend {
 
@@ -22,6 +55,67 @@ class ZMQProxy : public kage::Backend {
     zmq::context_t   m_zmq_context;
     zmq::socket_t    m_pub_socket;
     zmq::socket_t    m_sub_socket;
+    // ZMQ sockets are not thread-safe, and ULTs
+    // of several execution streams send on m_pub_socket
+    thallium::mutex  m_send_mutex;
+
+    // Heartbeats are numbered, and the polling ULT records
+    // the highest number the remote has echoed back
+    thallium::mutex              m_heartbeat_mutex;
+    thallium::condition_variable m_heartbeat_cv;
+    uint64_t                     m_heartbeat_sent = 0;
+    uint64_t                     m_heartbeat_acked = 0;
+
+    // Requests waiting for their response, by request id
+    thallium::mutex                               m_pending_mutex;
+    std::unordered_map<uint64_t, MessageContext*> m_pending;
+    uint64_t                                      m_next_request_id = 1;
+    std::atomic<uint64_t>                         m_timed_out{0};
+    std::atomic<uint64_t>                         m_late_responses{0};
+
+    struct InboundMessage {
+        zmq::message_t msg;
+        uint64_t       received_ns = 0;
+    };
+
+    enum class OrderingKey { RpcId, Payload };
+
+    std::unique_ptr<kage::OrderedDispatcher<InboundMessage>> m_dispatcher;
+    OrderingKey                                              m_ordering_key = OrderingKey::RpcId;
+    size_t                                                   m_key_offset = 0;
+    size_t                                                   m_key_length = 0;
+
+    // Chunked sends. ZMQ's I/O thread, an external thread to Argobots,
+    // decrements m_queued_chunks once it has sent a chunk
+    size_t                       m_chunk_size = 0;
+    size_t                       m_max_queued_chunks = 16;
+    thallium::mutex              m_chunk_mutex;
+    thallium::condition_variable m_chunk_cv;
+    size_t                       m_queued_chunks = 0;
+    std::atomic<uint64_t>        m_next_message_id{1};
+    std::atomic<uint64_t>        m_chunked_messages{0};
+    std::atomic<uint64_t>        m_sent_chunks{0};
+
+    // Reassembly of chunked messages, done by the polling ULT
+    struct Reassembly {
+        char*    buffer = nullptr; // header and payload, nullptr if dropped
+        size_t   total_size = 0;
+        size_t   received = 0;
+        uint64_t received_ns = 0;   // arrival of the first chunk
+        uint64_t last_chunk_ns = 0; // arrival of the latest chunk
+    };
+    std::unordered_map<uint64_t, Reassembly> m_reassemblies;
+    size_t                                   m_reassembly_bytes = 0;
+    size_t                                   m_max_reassembly_bytes = size_t{1} << 30;
+    uint64_t                                 m_reassembly_timeout_ns = 10000000000;
+    std::atomic<uint64_t>                    m_reassembled_messages{0};
+    std::atomic<uint64_t>                    m_dropped_messages{0};
+    std::atomic<uint64_t>                    m_expired_messages{0};
+
+    // Requests being forwarded in their own ULT (without "dispatch")
+    thallium::mutex              m_forward_mutex;
+    thallium::condition_variable m_forward_cv;
+    size_t                       m_forwards_in_flight = 0;
 
     std::atomic<bool>                   m_need_stop{false};
     thallium::managed<thallium::thread> m_polling_ult;
@@ -67,11 +161,24 @@ class ZMQProxy : public kage::Backend {
      */
     std::string getConfig() const override;
 
+    /**
+     * @brief Get the dispatcher's statistics, if any, the number of requests
+     * that timed out and of responses that came too late, and the chunking
+     * counters.
+     */
+    std::string getStatistics() const override;
+
     /**
      * @see Backend::forward
      */
     kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
-                                     const std::function<void(const char*, size_t)>& output_cb) override;
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override;
+
+    /**
+     * @see Backend::ping
+     */
+    kage::Result<uint64_t> ping(uint64_t timeout_ns) override;
 
     /**
      * @see Backend::setInputProxy
@@ -104,6 +211,31 @@ class ZMQProxy : public kage::Backend {
     private:
 
     void runPollingLoop();
+
+    void send(zmq::message_t& msg);
+
+    void sendPayload(MessageHeader& header, const char* data, size_t size);
+
+    zmq::message_t makeChunk(const MessageHeader& header, const char* data, size_t size);
+
+    void chunkSent();
+
+    void handleMessage(zmq::message_t&& msg, uint64_t received_ns);
+
+    void reassemble(const MessageHeader& header, const char* data, size_t size,
+                    uint64_t received_ns);
+
+    void rejectChunked(MessageHeader header, const char* error);
+
+    void expireReassemblies(uint64_t now_ns);
+
+    void respondEmpty(MessageHeader header);
+
+    MessageContext* takePending(uint64_t request_id);
+
+    void completePending(MessageContext* msg_context);
+
+    void handleForward(InboundMessage& inbound);
 };
 
 #endif
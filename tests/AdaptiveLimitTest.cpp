@@ -0,0 +1,171 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
+#include "AdaptiveLimiter.hpp"
+#include <algorithm>
+
+class my_input_provider : public thallium::provider<my_input_provider> {
+
+    thallium::auto_remote_procedure m_hello;
+
+    public:
+
+    my_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id)
+    : thallium::provider<my_input_provider>{engine, provider_id}
+    , m_hello{define("hello", &my_input_provider::hello)}
+    {}
+
+    void hello(const thallium::request& req, const std::string& name) {
+        std::string result = "Hello " + name;
+        req.respond(result);
+    }
+};
+
+TEST_CASE("Adaptive limit test", "[adaptive_limit]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "inout",
+        "fair_queueing": {
+            "max_in_flight": 8
+        },
+        "adaptive_limit": {
+            "algorithm": "gradient",
+            "initial_limit": 4,
+            "min_limit": 1,
+            "max_limit": 16
+        },
+        "proxy": {
+            "type": "passthrough",
+            "config": {}
+        }
+    }
+    )";
+
+    auto input_provider = new my_input_provider{engine, 33};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    kage::Provider provider{
+        engine, 42, "kage", provider_config,
+        thallium::provider_handle{engine.self(), 33}
+    };
+
+    auto hello = engine.define("hello");
+
+    std::string input = "Matthieu Dorier";
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    for(int i = 0; i < 5; ++i) {
+        std::string output = hello.on(ph)(input);
+        REQUIRE(output == "Hello Matthieu Dorier");
+    }
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    auto& limit = stats["adaptive_limit"];
+    REQUIRE(limit["algorithm"] == "gradient");
+    REQUIRE(limit["accepted"] == 5);
+    REQUIRE(limit["rejected"] == 0);
+    REQUIRE(limit["in_flight"] == 0);
+    REQUIRE(limit["min_rtt_ms"].get<double>() > 0);
+    // with fair queueing, the limit sets the number of fair slots
+    // (bounded by max_in_flight) instead of rejecting requests
+    auto& fair = stats["fair_queueing"];
+    REQUIRE(fair["slots"].get<size_t>()
+            == std::min<size_t>(limit["limit"].get<size_t>(), 8));
+    REQUIRE(fair["in_flight"] == 0);
+}
+
+static size_t currentLimit(const kage::AdaptiveLimiter& limiter) {
+    return limiter.statistics()["limit"].get<size_t>();
+}
+
+TEST_CASE("AIMD limiter test", "[adaptive_limit]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    kage::AdaptiveLimiter limiter{
+        kage::AdaptiveLimiter::Algorithm::AIMD, 4, 1, 16, 2.0, 0.5, 0.2, 1000};
+    const uint64_t base_rtt_ns = 1000000;
+
+    // requests above the limit are rejected right away
+    for(int i = 0; i < 4; ++i) REQUIRE(limiter.tryAcquire());
+    REQUIRE(!limiter.tryAcquire());
+    REQUIRE(limiter.statistics()["rejected"] == 1);
+
+    // at the base RTT, the limit grows by 1 per request
+    // that kept at least half of it in use
+    for(int i = 0; i < 4; ++i) limiter.release(base_rtt_ns, false);
+    REQUIRE(currentLimit(limiter) == 6);
+
+    // a request that queued (RTT above tolerance * min RTT) backs off
+    REQUIRE(limiter.tryAcquire());
+    limiter.release(10 * base_rtt_ns, false);
+    REQUIRE(currentLimit(limiter) == 3);
+
+    // so does a dropped request, down to min_limit
+    REQUIRE(limiter.tryAcquire());
+    limiter.release(0, true);
+    REQUIRE(currentLimit(limiter) == 1);
+    REQUIRE(limiter.tryAcquire());
+    limiter.release(0, true);
+    REQUIRE(currentLimit(limiter) == 1);
+
+    auto stats = limiter.statistics();
+    REQUIRE(stats["dropped"] == 2);
+    REQUIRE(stats["in_flight"] == 0);
+    REQUIRE(stats["min_rtt_ms"].get<double>() == 1.0);
+}
+
+TEST_CASE("Gradient limiter test", "[adaptive_limit]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    kage::AdaptiveLimiter limiter{
+        kage::AdaptiveLimiter::Algorithm::Gradient, 4, 1, 64, 2.0, 0.5, 0.5, 1000};
+    const uint64_t base_rtt_ns = 1000000;
+
+    // one sample with more than half of the limit in flight: the other
+    // requests are released without an RTT, which leaves the limit as is
+    auto sample = [&limiter](uint64_t rtt_ns) {
+        auto in_flight = currentLimit(limiter) / 2 + 1;
+        for(size_t i = 0; i < in_flight; ++i) REQUIRE(limiter.tryAcquire());
+        limiter.release(rtt_ns, false);
+        for(size_t i = 1; i < in_flight; ++i) limiter.release(0, false);
+    };
+
+    // with a single request in flight, the limit does not grow
+    for(int i = 0; i < 10; ++i) {
+        REQUIRE(limiter.tryAcquire());
+        limiter.release(base_rtt_ns, false);
+    }
+    REQUIRE(currentLimit(limiter) == 4);
+
+    // at the base RTT and with the limit in use, the gradient
+    // is 1 and the limit grows by the sqrt(limit) headroom
+    for(int i = 0; i < 10; ++i) sample(base_rtt_ns);
+    auto grown = currentLimit(limiter);
+    REQUIRE(grown > 12);
+
+    // when the RTT reaches 20 times its minimum, the gradient bottoms
+    // out at 0.5 and the limit shrinks towards 4, where the headroom
+    // makes up for the gradient
+    for(int i = 0; i < 20; ++i) sample(20 * base_rtt_ns);
+    auto shrunk = currentLimit(limiter);
+    REQUIRE(shrunk < grown);
+    REQUIRE(shrunk <= 5);
+
+    // a dropped request multiplies the limit by backoff_ratio
+    REQUIRE(limiter.tryAcquire());
+    limiter.release(0, true);
+    REQUIRE(currentLimit(limiter) == shrunk / 2);
+    REQUIRE(limiter.statistics()["dropped"] == 1);
+}
@@ -0,0 +1,133 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
+
+TEST_CASE("BreakerProxy test", "[breaker]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "breaker",
+            "config": {
+                "backend": {"type": "echo", "config": {}},
+                "window": 4,
+                "min_requests": 2
+            }
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto my_rpc = engine.define("my_rpc");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+
+    std::string input = "Matthieu Dorier";
+    std::string output = my_rpc.on(ph)(input);
+    REQUIRE(output == input);
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    REQUIRE(stats["proxy"]["state"] == "closed");
+    REQUIRE(stats["proxy"]["requests"] == 1);
+    REQUIRE(stats["proxy"]["failures"] == 0);
+}
+
+TEST_CASE("BreakerProxy opens on failures test", "[breaker]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "breaker",
+            "config": {
+                "backend": {"type": "echo", "config": {"fail": true}},
+                "window": 4,
+                "min_requests": 2,
+                "failure_rate": 0.5,
+                "cooldown_ms": 100,
+                "probes": 1
+            }
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto my_rpc = engine.define("my_rpc");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string input = "Matthieu Dorier";
+
+    // two failures open the breaker, the third request fails fast
+    for(int i = 0; i < 3; ++i)
+        REQUIRE_THROWS([&]() { std::string o = my_rpc.on(ph)(input); }());
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    REQUIRE(stats["proxy"]["state"] == "open");
+    REQUIRE(stats["proxy"]["opened"] == 1);
+    REQUIRE(stats["proxy"]["fast_failed"] == 1);
+
+    // after the cool-down, the failing probe opens the breaker again
+    thallium::thread::sleep(engine, 200);
+    REQUIRE_THROWS([&]() { std::string o = my_rpc.on(ph)(input); }());
+
+    stats = nlohmann::json::parse(provider.getStatistics());
+    REQUIRE(stats["proxy"]["state"] == "open");
+    REQUIRE(stats["proxy"]["opened"] == 2);
+    REQUIRE(stats["proxy"]["fast_failed"] == 1);
+}
+
+TEST_CASE("BreakerProxy opens on timeouts test", "[breaker]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "breaker",
+            "config": {
+                "backend": {"type": "echo", "config": {"delay_ms": 100}},
+                "window": 4,
+                "min_requests": 2,
+                "failure_rate": 0.5,
+                "cooldown_ms": 10000,
+                "timeout_ms": 20
+            }
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto my_rpc = engine.define("my_rpc");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string input = "Matthieu Dorier";
+
+    // the echo backend ignores the deadline and answers after 100ms,
+    // so both requests count as failures despite their output
+    for(int i = 0; i < 2; ++i) {
+        std::string output = my_rpc.on(ph)(input);
+        REQUIRE(output == input);
+    }
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    REQUIRE(stats["proxy"]["state"] == "open");
+    REQUIRE(stats["proxy"]["opened"] == 1);
+
+    // the hanging backend is no longer waited for
+    auto t_start = std::chrono::steady_clock::now();
+    REQUIRE_THROWS([&]() { std::string o = my_rpc.on(ph)(input); }());
+    REQUIRE(std::chrono::steady_clock::now() - t_start < std::chrono::milliseconds{100});
+    stats = nlohmann::json::parse(provider.getStatistics());
+    REQUIRE(stats["proxy"]["fast_failed"] == 1);
+}
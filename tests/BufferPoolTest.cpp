@@ -0,0 +1,46 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "BufferPool.hpp"
+#include <thread>
+
+TEST_CASE("BufferPool test", "[buffer_pool]") {
+    auto& pool = kage::BufferPool::Get();
+
+    SECTION("Release on the acquiring thread") {
+        auto data = pool.acquire(1000);
+        pool.release(data);
+        auto hits = pool.statistics()["hits"].get<uint64_t>();
+        auto again = pool.acquire(1000);
+        REQUIRE(again == data);
+        REQUIRE(pool.statistics()["hits"].get<uint64_t>() == hits + 1);
+        pool.release(again);
+    }
+
+    SECTION("Release on another thread") {
+        // the way ZMQ's I/O thread releases the buffers it has sent
+        auto data = pool.acquire(100000);
+        std::thread other{[&pool, data]() { pool.release(data); }};
+        other.join();
+        auto stats = pool.statistics();
+        auto hits = stats["hits"].get<uint64_t>();
+        auto misses = stats["misses"].get<uint64_t>();
+        auto again = pool.acquire(100000);
+        REQUIRE(again == data);
+        stats = pool.statistics();
+        REQUIRE(stats["hits"].get<uint64_t>() == hits + 1);
+        REQUIRE(stats["misses"].get<uint64_t>() == misses);
+        pool.release(again);
+    }
+
+    SECTION("Oversized buffers") {
+        auto oversized = pool.statistics()["oversized"].get<uint64_t>();
+        auto data = pool.acquire(size_t{8} << 20);
+        pool.release(data);
+        REQUIRE(pool.statistics()["oversized"].get<uint64_t>() == oversized + 1);
+    }
+}
@@ -0,0 +1,236 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+
+class my_input_provider : public thallium::provider<my_input_provider> {
+
+    thallium::auto_remote_procedure m_hello;
+
+    public:
+
+    my_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id)
+    : thallium::provider<my_input_provider>{engine, provider_id}
+    , m_hello{define("hello", &my_input_provider::hello)}
+    {}
+
+    void hello(const thallium::request& req, const std::string& name) {
+        std::string result = "Hello " + name;
+        req.respond(result);
+    }
+};
+
+class slow_input_provider : public thallium::provider<slow_input_provider> {
+
+    thallium::auto_remote_procedure m_hello;
+    thallium::auto_remote_procedure m_urgent;
+
+    public:
+
+    thallium::mutex          m_mutex;
+    std::vector<std::string> m_handled;
+
+    slow_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id)
+    : thallium::provider<slow_input_provider>{engine, provider_id}
+    , m_hello{define("hello", &slow_input_provider::hello)}
+    , m_urgent{define("urgent", &slow_input_provider::hello)}
+    {}
+
+    void hello(const thallium::request& req, const std::string& name) {
+        {
+            std::unique_lock<thallium::mutex> lock{m_mutex};
+            m_handled.push_back(name);
+        }
+        thallium::thread::sleep(get_engine(), 100);
+        std::string result = "Hello " + name;
+        req.respond(result);
+    }
+};
+
+/**
+ * Polls the provider's statistics until the predicate holds.
+ */
+static bool waitForStats(thallium::engine& engine, kage::Provider& provider,
+                         const std::function<bool(const nlohmann::json&)>& predicate) {
+    for(int i = 0; i < 200; ++i) {
+        if(predicate(nlohmann::json::parse(provider.getStatistics()))) return true;
+        thallium::thread::sleep(engine, 1);
+    }
+    return false;
+}
+
+TEST_CASE("Bulkhead test", "[bulkhead]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": [
+            { "name": "hello", "input": { "max_in_flight": 1, "priority": 2 } }
+        ],
+        "direction": "inout",
+        "input": { "max_in_flight": 4, "max_queued": 16, "queue": "priority" },
+        "proxy": {
+            "type": "passthrough",
+            "config": {}
+        }
+    }
+    )";
+
+    auto input_provider = new my_input_provider{engine, 33};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    kage::Provider provider{
+        engine, 42, "kage", provider_config,
+        thallium::provider_handle{engine.self(), 33}
+    };
+
+    auto hello = engine.define("hello");
+
+    std::string input = "Matthieu Dorier";
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string output = hello.on(ph)(input);
+    REQUIRE(output == "Hello Matthieu Dorier");
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    auto& rpc_stats = stats["rpcs"]["hello"]["input"];
+    REQUIRE(rpc_stats["queue_wait"]["count"] == 1);
+    REQUIRE(rpc_stats["bulkhead"]["in_flight"] == 0);
+    REQUIRE(stats["input"]["in_flight"] == 0);
+}
+
+TEST_CASE("Bulkhead rejection test", "[bulkhead]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": [
+            { "name": "hello", "input": { "max_in_flight": 1, "max_queued": 1 } }
+        ],
+        "direction": "inout",
+        "proxy": {
+            "type": "passthrough",
+            "config": {}
+        }
+    }
+    )";
+
+    auto input_provider = new slow_input_provider{engine, 33};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    kage::Provider provider{
+        engine, 42, "kage", provider_config,
+        thallium::provider_handle{engine.self(), 33}
+    };
+
+    auto hello = engine.define("hello");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    auto bulkhead = [](const nlohmann::json& stats) {
+        return stats["rpcs"]["hello"]["input"]["bulkhead"];
+    };
+
+    std::vector<std::string> outputs(2);
+    std::vector<thallium::managed<thallium::thread>> clients;
+    // the first request takes the only slot, the second one waits for it
+    clients.push_back(engine.get_handler_pool().make_thread([&]() {
+        outputs[0] = static_cast<std::string>(hello.on(ph)(std::string{"first"}));
+    }));
+    REQUIRE(waitForStats(engine, provider, [&](const nlohmann::json& stats) {
+        return bulkhead(stats)["in_flight"] == 1;
+    }));
+    clients.push_back(engine.get_handler_pool().make_thread([&]() {
+        outputs[1] = static_cast<std::string>(hello.on(ph)(std::string{"second"}));
+    }));
+    REQUIRE(waitForStats(engine, provider, [&](const nlohmann::json& stats) {
+        return bulkhead(stats)["queued"] == 1;
+    }));
+
+    // the queue is full: the third request is rejected
+    REQUIRE_THROWS([&]() { std::string o = hello.on(ph)(std::string{"third"}); }());
+
+    for(auto& client : clients) client->join();
+    REQUIRE(outputs[0] == "Hello first");
+    REQUIRE(outputs[1] == "Hello second");
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    auto& rpc_stats = stats["rpcs"]["hello"]["input"];
+    REQUIRE(rpc_stats["bulkhead"]["rejected"] == 1);
+    REQUIRE(rpc_stats["bulkhead"]["in_flight"] == 0);
+    REQUIRE(rpc_stats["bulkhead"]["queued"] == 0);
+    // rejected requests do not count in the queue wait
+    REQUIRE(rpc_stats["queue_wait"]["count"] == 2);
+}
+
+TEST_CASE("Bulkhead priority test", "[bulkhead]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": [
+            { "name": "hello", "input": { "priority": 1 } },
+            { "name": "urgent", "input": { "priority": 5 } }
+        ],
+        "direction": "inout",
+        "input": { "max_in_flight": 1, "max_queued": 2, "queue": "priority" },
+        "proxy": {
+            "type": "passthrough",
+            "config": {}
+        }
+    }
+    )";
+
+    auto input_provider = new slow_input_provider{engine, 33};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    kage::Provider provider{
+        engine, 42, "kage", provider_config,
+        thallium::provider_handle{engine.self(), 33}
+    };
+
+    auto hello = engine.define("hello");
+    auto urgent = engine.define("urgent");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+
+    std::vector<thallium::managed<thallium::thread>> clients;
+    auto send = [&](thallium::remote_procedure& rpc, const std::string& name) {
+        clients.push_back(engine.get_handler_pool().make_thread([&rpc, &ph, name]() {
+            std::string output = rpc.on(ph)(name);
+        }));
+    };
+    auto queued = [&](size_t count) {
+        return waitForStats(engine, provider, [count](const nlohmann::json& stats) {
+            return stats["input"]["in_flight"] == 1 && stats["input"]["queued"] == count;
+        });
+    };
+
+    // a low-priority request holds the slot, then a low-priority
+    // and a high-priority request wait for it, in that order
+    send(hello, "first");
+    REQUIRE(queued(0));
+    send(hello, "low");
+    REQUIRE(queued(1));
+    send(urgent, "high");
+    REQUIRE(queued(2));
+    for(auto& client : clients) client->join();
+
+    // the high-priority request is admitted first
+    REQUIRE(input_provider->m_handled == std::vector<std::string>{"first", "high", "low"});
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    REQUIRE(stats["input"]["rejected"] == 0);
+    REQUIRE(stats["rpcs"]["hello"]["input"]["queue_wait"]["count"] == 2);
+    REQUIRE(stats["rpcs"]["urgent"]["input"]["queue_wait"]["count"] == 1);
+}
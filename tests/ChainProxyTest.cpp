@@ -0,0 +1,188 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <kage/Middleware.hpp>
+#include <cstring>
+
+/**
+ * Middleware appending "+<tag>" to the requests going out, "-<tag>" to
+ * the requests coming in, and "=<tag>" to the responses of the requests
+ * going out, so that the test can check the order in which stages run.
+ * Payloads are thallium-serialized std::strings (size, then characters).
+ */
+class TagMiddleware : public kage::Middleware {
+
+    nlohmann::json m_config;
+
+    static std::string append(const char* data, size_t size, const std::string& suffix) {
+        uint64_t length;
+        std::memcpy(&length, data, sizeof(length));
+        std::string payload{data, size};
+        payload += suffix;
+        length += suffix.size();
+        std::memcpy(payload.data(), &length, sizeof(length));
+        return payload;
+    }
+
+    public:
+
+    TagMiddleware(const nlohmann::json& config)
+    : m_config(config) {}
+
+    std::string getConfig() const override {
+        return m_config.dump();
+    }
+
+    kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override {
+        auto tag = m_config["tag"].get<std::string>();
+        auto request = append(input, input_size, "+" + tag);
+        auto tagged_cb = [&](const char* output, size_t output_size) {
+            if(output_size == 0) return output_cb(output, output_size);
+            auto response = append(output, output_size, "=" + tag);
+            output_cb(response.data(), response.size());
+        };
+        return kage::Middleware::forwardOutput(
+            rpc_id, request.data(), request.size(), tagged_cb, context);
+    }
+
+    kage::Result<bool> forwardInput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                    kage::OutputCallback output_cb,
+                                    kage::RequestContext& context) override {
+        auto request = append(input, input_size, "-" + m_config["tag"].get<std::string>());
+        return kage::Middleware::forwardInput(
+            rpc_id, request.data(), request.size(), output_cb, context);
+    }
+
+    static std::unique_ptr<kage::Backend> create(
+            const thallium::engine& engine,
+            const nlohmann::json& config,
+            const thallium::pool& pool) {
+        (void)engine;
+        (void)pool;
+        return std::unique_ptr<kage::Backend>(new TagMiddleware(config));
+    }
+};
+
+KAGE_REGISTER_BACKEND(tag, TagMiddleware);
+
+class my_input_provider : public thallium::provider<my_input_provider> {
+
+    thallium::auto_remote_procedure m_hello;
+
+    public:
+
+    my_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id)
+    : thallium::provider<my_input_provider>{engine, provider_id}
+    , m_hello{define("hello", &my_input_provider::hello)}
+    {}
+
+    void hello(const thallium::request& req, const std::string& name) {
+        std::string result = "Hello " + name;
+        req.respond(result);
+    }
+};
+
+TEST_CASE("ChainProxy test", "[chain]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+
+    SECTION("Chain with a single stage") {
+        const auto provider_config = R"(
+        {
+            "exported_rpcs": ["hello"],
+            "direction": "inout",
+            "proxy": {
+                "type": "chain",
+                "config": {
+                    "stages": [
+                        {"type": "passthrough", "config": {}}
+                    ]
+                }
+            }
+        }
+        )";
+
+        auto input_provider = new my_input_provider{engine, 33};
+        engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+        kage::Provider provider{
+            engine, 42, "kage", provider_config,
+            thallium::provider_handle{engine.self(), 33}
+        };
+
+        auto hello = engine.define("hello");
+
+        std::string input = "Matthieu Dorier";
+        auto ph = thallium::provider_handle{engine.self(), 42};
+        std::string output = hello.on(ph)(input);
+        REQUIRE(output == "Hello Matthieu Dorier");
+    }
+
+    SECTION("Chain with two middleware stages") {
+        const auto provider_config = R"(
+        {
+            "exported_rpcs": ["hello"],
+            "direction": "inout",
+            "proxy": {
+                "type": "chain",
+                "config": {
+                    "stages": [
+                        {"type": "tag", "config": {"tag": "A"}},
+                        {"type": "tag", "config": {"tag": "B"}},
+                        {"type": "passthrough", "config": {}}
+                    ]
+                }
+            }
+        }
+        )";
+
+        auto input_provider = new my_input_provider{engine, 33};
+        engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+        kage::Provider provider{
+            engine, 42, "kage", provider_config,
+            thallium::provider_handle{engine.self(), 33}
+        };
+
+        auto hello = engine.define("hello");
+
+        std::string input = "Matthieu Dorier";
+        auto ph = thallium::provider_handle{engine.self(), 42};
+        std::string output = hello.on(ph)(input);
+        // requests go out through A then B and come back in through B then A,
+        // responses go back out through B then A
+        REQUIRE(output == "Hello Matthieu Dorier+A+B-B-A=B=A");
+    }
+
+    SECTION("Chain with a non-middleware stage before the last one") {
+        const auto provider_config = R"(
+        {
+            "exported_rpcs": ["hello"],
+            "direction": "out",
+            "proxy": {
+                "type": "chain",
+                "config": {
+                    "stages": [
+                        {"type": "echo", "config": {}},
+                        {"type": "echo", "config": {}}
+                    ]
+                }
+            }
+        }
+        )";
+        REQUIRE_THROWS_AS(
+            kage::Provider(engine, 42, "kage", provider_config),
+            kage::Exception);
+    }
+}
@@ -0,0 +1,164 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
+#include <memory>
+
+class my_input_provider : public thallium::provider<my_input_provider> {
+
+    thallium::auto_remote_procedure m_hello;
+
+    public:
+
+    my_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id)
+    : thallium::provider<my_input_provider>{engine, provider_id}
+    , m_hello{define("hello", &my_input_provider::hello)}
+    {}
+
+    void hello(const thallium::request& req, const std::string& name) {
+        auto provider_id = get_provider_id();
+        std::string result = "Hello " + name + " from provider " + std::to_string(provider_id);
+        req.respond(result);
+    }
+};
+
+TEST_CASE("FailoverProxy test", "[failover]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "failover",
+            "config": {
+                "backends": [
+                    {"type": "echo", "config": {"fail": true}},
+                    {"type": "echo", "config": {}}
+                ],
+                "heartbeat_interval_ms": 20,
+                "heartbeat_timeout_ms": 10,
+                "max_missed": 2
+            }
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    // the primary misses its heartbeats and the backup gets promoted
+    thallium::thread::sleep(engine, 300);
+
+    auto my_rpc = engine.define("my_rpc");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string input = "Matthieu Dorier";
+    std::string output = my_rpc.on(ph)(input);
+    REQUIRE(output == input);
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    auto& proxy = stats["proxy"];
+    REQUIRE(proxy["active"] == 1);
+    REQUIRE(proxy["failovers"] == 1);
+    REQUIRE(proxy["links"][0]["healthy"] == false);
+    REQUIRE(proxy["links"][1]["healthy"] == true);
+    REQUIRE(proxy["links"][1]["missed_total"] == 0);
+}
+
+TEST_CASE("FailoverProxy over ZMQ test", "[failover]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+
+    // the output side has a link to each of two input-side peers
+    const auto output_config = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "out",
+        "proxy": {
+            "type": "failover",
+            "config": {
+                "backends": [
+                    {"type": "zmq", "config": {"pub_address": "tcp://*:4591",
+                                               "sub_address": "tcp://*:4592"}},
+                    {"type": "zmq", "config": {"pub_address": "tcp://*:4593",
+                                               "sub_address": "tcp://*:4594"}}
+                ],
+                "heartbeat_interval_ms": 50,
+                "heartbeat_timeout_ms": 500,
+                "max_missed": 2
+            }
+        }
+    }
+    )";
+
+    const auto primary_config = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "in",
+        "proxy": {
+            "type": "zmq",
+            "config": {"pub_address": "tcp://localhost:4592",
+                       "sub_address": "tcp://localhost:4591"}
+        }
+    }
+    )";
+
+    const auto backup_config = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "in",
+        "proxy": {
+            "type": "zmq",
+            "config": {"pub_address": "tcp://localhost:4594",
+                       "sub_address": "tcp://localhost:4593"}
+        }
+    }
+    )";
+
+    auto input_provider_1 = new my_input_provider{engine, 33};
+    engine.push_finalize_callback([input_provider_1]() { delete input_provider_1; });
+    auto input_provider_2 = new my_input_provider{engine, 34};
+    engine.push_finalize_callback([input_provider_2]() { delete input_provider_2; });
+
+    kage::Provider provider{engine, 42, "kage", output_config};
+    auto primary = std::make_unique<kage::Provider>(
+        engine, 43, "kage", primary_config,
+        thallium::provider_handle{engine.self(), 33});
+    kage::Provider backup{
+        engine, 44, "kage", backup_config,
+        thallium::provider_handle{engine.self(), 34}};
+
+    REQUIRE(primary->waitReady(std::chrono::seconds{5}).success());
+    REQUIRE(backup.waitReady(std::chrono::seconds{5}).success());
+    REQUIRE(provider.waitReady(std::chrono::seconds{5}).success());
+
+    auto hello = engine.define("hello");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string input = "Matthieu Dorier";
+    std::string output = hello.on(ph)(input);
+    REQUIRE(output == "Hello Matthieu Dorier from provider 33");
+
+    // the primary's peer dies: its link misses its heartbeats
+    // and the backup gets promoted
+    primary.reset();
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    for(int i = 0; i < 300 && stats["proxy"]["failovers"] == 0; ++i) {
+        thallium::thread::sleep(engine, 10);
+        stats = nlohmann::json::parse(provider.getStatistics());
+    }
+    auto& proxy = stats["proxy"];
+    REQUIRE(proxy["failovers"] == 1);
+    REQUIRE(proxy["active"] == 1);
+    REQUIRE(proxy["links"][0]["healthy"] == false);
+    REQUIRE(proxy["links"][1]["healthy"] == true);
+
+    output = static_cast<std::string>(hello.on(ph)(input));
+    REQUIRE(output == "Hello Matthieu Dorier from provider 34");
+}
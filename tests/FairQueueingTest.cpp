@@ -0,0 +1,125 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
+#include "FairScheduler.hpp"
+#include <algorithm>
+#include <vector>
+
+class my_input_provider : public thallium::provider<my_input_provider> {
+
+    thallium::auto_remote_procedure m_hello;
+
+    public:
+
+    my_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id)
+    : thallium::provider<my_input_provider>{engine, provider_id}
+    , m_hello{define("hello", &my_input_provider::hello)}
+    {}
+
+    void hello(const thallium::request& req, const std::string& name) {
+        std::string result = "Hello " + name;
+        req.respond(result);
+    }
+};
+
+TEST_CASE("Fair queueing test", "[fair_queueing]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    auto provider_config = nlohmann::json::parse(R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "inout",
+        "fair_queueing": {
+            "classify_by": "source",
+            "max_in_flight": 2,
+            "max_queued": 8,
+            "quantum": 1024
+        },
+        "proxy": {
+            "type": "passthrough",
+            "config": {}
+        }
+    }
+    )");
+    // flows are named after the client's address
+    provider_config["fair_queueing"]["weights"][static_cast<std::string>(engine.self())] = 2.0;
+
+    auto input_provider = new my_input_provider{engine, 33};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    kage::Provider provider{
+        engine, 42, "kage", provider_config.dump(),
+        thallium::provider_handle{engine.self(), 33}
+    };
+
+    auto hello = engine.define("hello");
+
+    std::string input = "Matthieu Dorier";
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string output = hello.on(ph)(input);
+    REQUIRE(output == "Hello Matthieu Dorier");
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    REQUIRE(stats["fair_queueing"]["immediate"] == 1);
+    REQUIRE(stats["fair_queueing"]["in_flight"] == 0);
+    REQUIRE(stats["fair_queueing"]["rejected"] == 0);
+}
+
+TEST_CASE("Fair scheduler weights test", "[fair_queueing]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+
+    // a single slot, and requests costing exactly one quantum,
+    // so that a flow of weight w gets w slots per round
+    kage::FairScheduler scheduler{1, 64, 1024, 1.0, {{"heavy", 2.0}, {"light", 1.0}}};
+
+    // hold the slot until both flows are backlogged
+    REQUIRE(scheduler.acquire("other", 1024));
+
+    thallium::mutex mutex;
+    std::vector<std::string> grants;
+    std::vector<thallium::managed<thallium::thread>> ults;
+    auto pool = engine.get_handler_pool();
+    for(int i = 0; i < 6; ++i) {
+        for(auto flow : {"heavy", "light"}) {
+            ults.push_back(pool.make_thread([&scheduler, &mutex, &grants, flow]() {
+                if(!scheduler.acquire(flow, 1024)) return;
+                {
+                    std::unique_lock<thallium::mutex> lock{mutex};
+                    grants.push_back(flow);
+                }
+                scheduler.release();
+            }));
+        }
+    }
+    for(int i = 0; i < 100 && scheduler.statistics()["queued"] != 12; ++i)
+        thallium::thread::sleep(engine, 10);
+    REQUIRE(scheduler.statistics()["queued"] == 12);
+
+    scheduler.release();
+    for(auto& ult : ults) ult->join();
+
+    REQUIRE(grants.size() == 12);
+    // while both flows are backlogged, "heavy" gets twice as
+    // many slots as "light": 6 and 3 of the first 9 slots
+    auto heavy = std::count(grants.begin(), grants.begin() + 9, std::string{"heavy"});
+    auto light = std::count(grants.begin(), grants.begin() + 9, std::string{"light"});
+    REQUIRE(heavy == 6);
+    REQUIRE(light == 3);
+
+    auto stats = scheduler.statistics();
+    REQUIRE(stats["immediate"] == 1);
+    REQUIRE(stats["delayed"] == 12);
+    REQUIRE(stats["in_flight"] == 0);
+    REQUIRE(stats["backlogged_flows"] == 0);
+}
@@ -0,0 +1,175 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
+#include <chrono>
+
+TEST_CASE("HedgeProxy test", "[hedge]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc", "other_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "hedge",
+            "config": {
+                "backends": [
+                    {"type": "echo", "config": {}},
+                    {"type": "echo", "config": {}}
+                ],
+                "policies": {
+                    "my_rpc": {"percentile": 90, "initial_delay_ms": 0, "max_retries": 1}
+                }
+            }
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto my_rpc = engine.define("my_rpc");
+    auto other_rpc = engine.define("other_rpc");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+
+    std::string input = "Matthieu Dorier";
+    for(int i = 0; i < 4; ++i) {
+        std::string output = my_rpc.on(ph)(input);
+        REQUIRE(input == output);
+    }
+    std::string output = other_rpc.on(ph)(input);
+    REQUIRE(input == output);
+
+    // let hedged attempts that lost the race finish
+    thallium::thread::sleep(engine, 100);
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    auto& hedge_stats = stats["proxy"]["rpcs"];
+    REQUIRE(hedge_stats.contains("my_rpc"));
+    REQUIRE(!hedge_stats.contains("other_rpc"));
+    REQUIRE(hedge_stats["my_rpc"]["requests"] == 4);
+    REQUIRE(hedge_stats["my_rpc"]["failures"] == 0);
+    REQUIRE(hedge_stats["my_rpc"]["retries"] == 0);
+}
+
+TEST_CASE("HedgeProxy slow backend test", "[hedge]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "hedge",
+            "config": {
+                "backends": [
+                    {"type": "echo", "config": {"delay_ms": 200}},
+                    {"type": "echo", "config": {}}
+                ],
+                "policies": {
+                    "my_rpc": {"initial_delay_ms": 5, "max_retries": 0}
+                }
+            }
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto my_rpc = engine.define("my_rpc");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+
+    // the primary alternates between the backends: requests whose primary
+    // is the slow one are hedged to the fast one after 5ms, which wins,
+    // while the others complete before their hedge would be sent
+    std::string input = "Matthieu Dorier";
+    for(int i = 0; i < 4; ++i) {
+        auto t_start = std::chrono::steady_clock::now();
+        std::string output = my_rpc.on(ph)(input);
+        REQUIRE(input == output);
+        REQUIRE(std::chrono::steady_clock::now() - t_start < std::chrono::milliseconds{150});
+    }
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    auto& hedge_stats = stats["proxy"]["rpcs"]["my_rpc"];
+    REQUIRE(hedge_stats["requests"] == 4);
+    REQUIRE(hedge_stats["hedges"] == 2);
+    REQUIRE(hedge_stats["hedge_wins"] == 2);
+    REQUIRE(hedge_stats["failures"] == 0);
+}
+
+TEST_CASE("HedgeProxy single backend test", "[hedge]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "hedge",
+            "config": {
+                "backends": [
+                    {"type": "echo", "config": {"delay_ms": 20}}
+                ],
+                "policies": {
+                    "my_rpc": {"initial_delay_ms": 1}
+                }
+            }
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto my_rpc = engine.define("my_rpc");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+
+    std::string input = "Matthieu Dorier";
+    std::string output = my_rpc.on(ph)(input);
+    REQUIRE(input == output);
+
+    // no duplicate is sent to the backend that is already slow
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    REQUIRE(stats["proxy"]["rpcs"]["my_rpc"]["hedges"] == 0);
+}
+
+TEST_CASE("HedgeProxy early completion test", "[hedge]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "hedge",
+            "config": {
+                "backends": [
+                    {"type": "echo", "config": {}},
+                    {"type": "echo", "config": {}}
+                ],
+                "policies": {
+                    "my_rpc": {"initial_delay_ms": 1000}
+                }
+            }
+        }
+    }
+    )";
+    auto t_start = std::chrono::steady_clock::now();
+    {
+        kage::Provider provider(engine, 42, "kage", provider_config);
+
+        auto my_rpc = engine.define("my_rpc");
+        auto ph = thallium::provider_handle{engine.self(), 42};
+
+        std::string input = "Matthieu Dorier";
+        std::string output = my_rpc.on(ph)(input);
+        REQUIRE(input == output);
+    }
+    // the hedge timer stops when the primary answers, so destroying
+    // the proxy does not wait for the 1s hedge delay to elapse
+    REQUIRE(std::chrono::steady_clock::now() - t_start < std::chrono::milliseconds{500});
+}
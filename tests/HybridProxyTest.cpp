@@ -0,0 +1,77 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
+
+TEST_CASE("HybridProxy test", "[hybrid]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc", "other_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "hybrid",
+            "config": {
+                "backends": [
+                    {"type": "echo", "config": {}},
+                    {"type": "echo", "config": {}}
+                ],
+                "thresholds": [256],
+                "rpcs": {
+                    "other_rpc": {"thresholds": [0]}
+                }
+            }
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto my_rpc = engine.define("my_rpc");
+    auto other_rpc = engine.define("other_rpc");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+
+    std::string small_input = "Matthieu Dorier";
+    std::string large_input(1024, 'x');
+    std::string small_output = my_rpc.on(ph)(small_input);
+    REQUIRE(small_output == small_input);
+    std::string large_output = my_rpc.on(ph)(large_input);
+    REQUIRE(large_output == large_input);
+    std::string other_output = other_rpc.on(ph)(small_input);
+    REQUIRE(other_output == small_input);
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    auto& backends = stats["proxy"]["backends"];
+    REQUIRE(backends.size() == 2);
+    REQUIRE(backends[0]["requests"] == 1);
+    REQUIRE(backends[1]["requests"] == 2);
+}
+
+TEST_CASE("HybridProxy invalid thresholds test", "[hybrid]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "hybrid",
+            "config": {
+                "backends": [
+                    {"type": "echo", "config": {}},
+                    {"type": "echo", "config": {}}
+                ],
+                "thresholds": [256, 1024]
+            }
+        }
+    }
+    )";
+    REQUIRE_THROWS_AS(kage::Provider(engine, 42, "kage", provider_config), kage::Exception);
+}
@@ -82,9 +82,10 @@ TEST_CASE("MargoProxy test", "[margo]") {
         thallium::provider_handle{engine.self(), 34}
     };
 
-    // sleep a bit to allow the providers to connect to each other
+    // wait for the providers to connect to each other
     // before we start sending things
-    thallium::thread::sleep(engine, 200);
+    REQUIRE(provider1.waitReady(std::chrono::seconds{5}).success());
+    REQUIRE(provider2.waitReady(std::chrono::seconds{5}).success());
 
     // with the setup above, RPCs sent to Kage provider 42 will end up
     // forwarded to my_input_provider 34, and RPCs sent to Kage provider
@@ -0,0 +1,143 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
+#include <vector>
+
+class my_input_provider : public thallium::provider<my_input_provider> {
+
+    thallium::auto_remote_procedure m_hello;
+
+    public:
+
+    my_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id)
+    : thallium::provider<my_input_provider>{engine, provider_id}
+    , m_hello{define("hello", &my_input_provider::hello)}
+    {}
+
+    void hello(const thallium::request& req, const std::string& name) {
+        std::string result = "Hello " + name;
+        req.respond(result);
+    }
+};
+
+static nlohmann::json runRouting(const char* policy, const std::vector<std::string>& inputs) {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    auto provider_config = nlohmann::json::parse(R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "inout",
+        "input": { "routing": { "hash_offset": 8 } },
+        "proxy": {
+            "type": "passthrough",
+            "config": {}
+        }
+    }
+    )");
+    provider_config["input"]["routing"]["policy"] = policy;
+
+    auto input_provider_1 = new my_input_provider{engine, 33};
+    auto input_provider_2 = new my_input_provider{engine, 34};
+    engine.push_finalize_callback([input_provider_1, input_provider_2]() {
+        delete input_provider_1;
+        delete input_provider_2;
+    });
+
+    kage::Provider provider{
+        engine, 42, "kage", provider_config.dump(),
+        std::vector<thallium::provider_handle>{
+            thallium::provider_handle{engine.self(), 33},
+            thallium::provider_handle{engine.self(), 34}}
+    };
+
+    auto hello = engine.define("hello");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    for(auto& input : inputs) {
+        std::string output = hello.on(ph)(input);
+        REQUIRE(output == "Hello " + input);
+    }
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    return stats["targets"];
+}
+
+TEST_CASE("Multi-target round-robin test", "[targets]") {
+    auto targets = runRouting("round_robin", {"A", "B", "C", "D"});
+    REQUIRE(targets.size() == 2);
+    REQUIRE(targets[0]["requests"] == 2);
+    REQUIRE(targets[1]["requests"] == 2);
+    REQUIRE(targets[0]["in_flight"] == 0);
+}
+
+TEST_CASE("Multi-target hash test", "[targets]") {
+    // The hash skips the 8-byte size prefix of the serialized string
+    auto targets = runRouting("hash", {"same key", "same key", "same key", "same key"});
+    REQUIRE(targets.size() == 2);
+    auto requests_1 = targets[0]["requests"].get<uint64_t>();
+    auto requests_2 = targets[1]["requests"].get<uint64_t>();
+    REQUIRE(((requests_1 == 4 && requests_2 == 0) || (requests_1 == 0 && requests_2 == 4)));
+}
+
+TEST_CASE("Per-RPC target test", "[targets]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    auto provider_config = nlohmann::json::parse(R"(
+    {
+        "exported_rpcs": [
+            { "name": "hello", "target": { "provider_id": 34 } }
+        ],
+        "direction": "inout",
+        "proxy": {
+            "type": "passthrough",
+            "config": {}
+        }
+    }
+    )");
+    provider_config["exported_rpcs"][0]["target"]["address"] =
+        static_cast<std::string>(engine.self());
+
+    auto input_provider = new my_input_provider{engine, 34};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    // No provider-level target: the RPC's own target is used
+    kage::Provider provider{engine, 42, "kage", provider_config.dump()};
+
+    auto hello = engine.define("hello");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string input = "Matthieu Dorier";
+    std::string output = hello.on(ph)(input);
+    REQUIRE(output == "Hello Matthieu Dorier");
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    REQUIRE(!stats.contains("targets"));
+    auto& targets = stats["rpcs"]["hello"]["input"]["targets"];
+    REQUIRE(targets.size() == 1);
+    REQUIRE(targets[0]["provider_id"] == 34);
+    REQUIRE(targets[0]["requests"] == 1);
+}
+
+TEST_CASE("Missing target test", "[targets]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "in",
+        "proxy": {
+            "type": "passthrough",
+            "config": {}
+        }
+    }
+    )";
+    REQUIRE_THROWS_AS(kage::Provider(engine, 42, "kage", provider_config), kage::Exception);
+}
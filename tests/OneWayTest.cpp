@@ -0,0 +1,91 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <atomic>
+
+class my_input_provider : public thallium::provider<my_input_provider> {
+
+    thallium::auto_remote_procedure m_notify;
+
+    public:
+
+    std::atomic<int> notifications{0};
+
+    my_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id)
+    : thallium::provider<my_input_provider>{engine, provider_id}
+    , m_notify{define("notify", &my_input_provider::notify)}
+    {}
+
+    void notify(const thallium::request& req, const std::string& name) {
+        (void)name;
+        notifications += 1;
+        req.respond();
+    }
+};
+
+TEST_CASE("One-way RPC test", "[one_way]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+
+    const auto provider_config_1 = R"(
+    {
+        "exported_rpcs": [{"name": "notify", "one_way": true}],
+        "direction": "out",
+        "proxy": {
+            "type": "margo",
+            "config": {
+                "listening": true,
+                "address": "tcp://127.0.0.1:4557",
+                "remote_address": "tcp://127.0.0.1:4558"
+            }
+        }
+    }
+    )";
+
+    const auto provider_config_2 = R"(
+    {
+        "exported_rpcs": ["notify"],
+        "direction": "in",
+        "proxy": {
+            "type": "margo",
+            "config": {
+                "listening": true,
+                "address": "tcp://127.0.0.1:4558",
+                "remote_address": "tcp://127.0.0.1:4557"
+            }
+        }
+    }
+    )";
+
+    auto input_provider = new my_input_provider{engine, 33};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    kage::Provider provider1{engine, 42, "kage", provider_config_1};
+
+    kage::Provider provider2{
+        engine, 43, "kage", provider_config_2,
+        thallium::provider_handle{engine.self(), 33}
+    };
+
+    REQUIRE(provider1.waitReady(std::chrono::seconds{5}).success());
+    REQUIRE(provider2.waitReady(std::chrono::seconds{5}).success());
+
+    // The client gets an empty response as soon as the request is sent
+    auto notify = engine.define("notify");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    for(int i = 0; i < 4; ++i)
+        notify.on(ph)(std::string{"Matthieu Dorier"});
+
+    for(int i = 0; i < 100 && input_provider->notifications < 4; ++i)
+        thallium::thread::sleep(engine, 10);
+    REQUIRE(input_provider->notifications == 4);
+}
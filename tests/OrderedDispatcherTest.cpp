@@ -0,0 +1,109 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium.hpp>
+#include "OrderedDispatcher.hpp"
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+struct TestItem {
+    uint64_t key = 0;
+    int      seq = 0;
+};
+
+TEST_CASE("OrderedDispatcher ordering test", "[dispatch]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+
+    thallium::mutex mutex;
+    std::vector<TestItem> handled;
+    std::chrono::steady_clock::duration elapsed;
+    {
+        // a slow handler: each item takes 100ms
+        kage::OrderedDispatcher<TestItem> dispatcher{
+            engine.get_handler_pool(), 2, 16,
+            [&](TestItem& item) {
+                thallium::thread::sleep(engine, 100);
+                std::unique_lock<thallium::mutex> lock{mutex};
+                handled.push_back(item);
+            }};
+
+        // keys 0 and 1 go to different shards
+        auto t_start = std::chrono::steady_clock::now();
+        for(int seq = 0; seq < 2; ++seq) {
+            for(uint64_t key = 0; key < 2; ++key) {
+                auto item = TestItem{key, seq};
+                REQUIRE(dispatcher.tryPush(key, item));
+            }
+        }
+        for(int i = 0; i < 100; ++i) {
+            {
+                std::unique_lock<thallium::mutex> lock{mutex};
+                if(handled.size() == 4) break;
+            }
+            thallium::thread::sleep(engine, 10);
+        }
+        elapsed = std::chrono::steady_clock::now() - t_start;
+        REQUIRE(dispatcher.statistics()["dispatched"] == 4);
+    }
+
+    REQUIRE(handled.size() == 4);
+    // items with the same key are handled in the order they were pushed
+    for(uint64_t key = 0; key < 2; ++key) {
+        int expected_seq = 0;
+        for(auto& item : handled) {
+            if(item.key != key) continue;
+            REQUIRE(item.seq == expected_seq);
+            expected_seq += 1;
+        }
+        REQUIRE(expected_seq == 2);
+    }
+    // the two keys are handled concurrently: about 200ms instead of 400ms
+    REQUIRE(elapsed < std::chrono::milliseconds{350});
+}
+
+TEST_CASE("OrderedDispatcher full shard test", "[dispatch]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+
+    std::atomic<int> started{0};
+    std::atomic<int> done{0};
+    {
+        kage::OrderedDispatcher<TestItem> dispatcher{
+            engine.get_handler_pool(), 1, 1,
+            [&](TestItem&) {
+                started++;
+                thallium::thread::sleep(engine, 100);
+                done++;
+            }};
+
+        auto first = TestItem{0, 0};
+        REQUIRE(dispatcher.tryPush(0, first));
+        for(int i = 0; i < 100 && started == 0; ++i)
+            thallium::thread::sleep(engine, 1);
+        REQUIRE(started == 1);
+
+        // the first item is being handled, the second one fills
+        // the queue, and the third one is refused without blocking
+        auto second = TestItem{0, 1};
+        auto third = TestItem{0, 2};
+        REQUIRE(dispatcher.tryPush(0, second));
+        auto t_start = std::chrono::steady_clock::now();
+        REQUIRE(!dispatcher.tryPush(0, third));
+        REQUIRE(std::chrono::steady_clock::now() - t_start < std::chrono::milliseconds{50});
+
+        auto stats = dispatcher.statistics();
+        REQUIRE(stats["dispatched"] == 2);
+        REQUIRE(stats["rejected"] == 1);
+
+        for(int i = 0; i < 100 && done < 2; ++i)
+            thallium::thread::sleep(engine, 10);
+        REQUIRE(done == 2);
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <kage/Backend.hpp>
+#include <abt.h>
+
+/**
+ * Pass-through backend recording the pool in which the output side
+ * forwards requests, and the pool in which the input side calls the
+ * target (which is where it invokes the output callback).
+ */
+class PoolProbeProxy : public kage::Backend {
+
+    kage::InputProxy m_input_proxy;
+
+    public:
+
+    static ABT_pool output_pool;
+    static ABT_pool input_pool;
+
+    std::string getConfig() const override {
+        return "{}";
+    }
+
+    kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override {
+        ABT_self_get_last_pool(&output_pool);
+        auto probe_cb = [&](const char* output, size_t output_size) {
+            ABT_self_get_last_pool(&input_pool);
+            output_cb(output, output_size);
+        };
+        return m_input_proxy.forwardInput(rpc_id, input, input_size, probe_cb, context);
+    }
+
+    void setInputProxy(kage::InputProxy proxy) override {
+        m_input_proxy = std::move(proxy);
+    }
+
+    kage::Result<bool> destroy() override {
+        return kage::Result<bool>{};
+    }
+
+    static std::unique_ptr<kage::Backend> create(
+            const thallium::engine& engine,
+            const nlohmann::json& config,
+            const thallium::pool& pool) {
+        (void)engine;
+        (void)config;
+        (void)pool;
+        return std::unique_ptr<kage::Backend>(new PoolProbeProxy);
+    }
+};
+
+ABT_pool PoolProbeProxy::output_pool = ABT_POOL_NULL;
+ABT_pool PoolProbeProxy::input_pool  = ABT_POOL_NULL;
+
+KAGE_REGISTER_BACKEND(pool_probe, PoolProbeProxy);
+
+class my_input_provider : public thallium::provider<my_input_provider> {
+
+    thallium::auto_remote_procedure m_hello;
+
+    public:
+
+    my_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id)
+    : thallium::provider<my_input_provider>{engine, provider_id}
+    , m_hello{define("hello", &my_input_provider::hello)}
+    {}
+
+    void hello(const thallium::request& req, const std::string& name) {
+        std::string result = "Hello " + name;
+        req.respond(result);
+    }
+};
+
+TEST_CASE("RPC pool test", "[pool]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": [
+            { "name": "hello", "pool": "control" }
+        ],
+        "direction": "inout",
+        "proxy": {
+            "type": "pool_probe",
+            "config": {}
+        }
+    }
+    )";
+
+    auto input_provider = new my_input_provider{engine, 33};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    SECTION("Missing pool") {
+        REQUIRE_THROWS_AS(
+            kage::Provider(engine, 42, "kage", provider_config,
+                           thallium::provider_handle{engine.self(), 33}),
+            kage::Exception);
+    }
+
+    SECTION("Provided pool") {
+        // a pool with its own xstream, distinct from the handler pool
+        auto control_pool = thallium::pool::create(thallium::pool::access::mpmc);
+        auto control_es = thallium::xstream::create(
+            thallium::scheduler::predef::deflt, *control_pool);
+        std::unordered_map<std::string, thallium::pool> pools{
+            {"control", *control_pool}
+        };
+        kage::Provider provider{
+            engine, 42, "kage", provider_config,
+            thallium::provider_handle{engine.self(), 33},
+            thallium::pool{}, thallium::pool{}, pools
+        };
+
+        auto hello = engine.define("hello");
+
+        std::string input = "Matthieu Dorier";
+        auto ph = thallium::provider_handle{engine.self(), 42};
+        std::string output = hello.on(ph)(input);
+        REQUIRE(output == "Hello Matthieu Dorier");
+        // both the output-side handler and the input-side
+        // call to the target ran in the RPC's pool
+        REQUIRE(PoolProbeProxy::output_pool == control_pool->native_handle());
+        REQUIRE(PoolProbeProxy::input_pool == control_pool->native_handle());
+    }
+}
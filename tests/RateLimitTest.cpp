@@ -0,0 +1,85 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
+#include <chrono>
+
+TEST_CASE("Rate limit test", "[rate_limit]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": [
+            {
+                "name": "my_rpc",
+                "rate_limit": { "rate": 0.1, "burst": 1 }
+            }
+        ],
+        "direction": "out",
+        "proxy": {
+            "type": "echo",
+            "config": {}
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto rpc = engine.define("my_rpc");
+
+    std::string input = "Matthieu Dorier";
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string output = rpc.on(ph)(input);
+    REQUIRE(input == output);
+    // the second request comes before the bucket refills and gets
+    // an empty response, which cannot be deserialized as a string
+    REQUIRE_THROWS([&]() { std::string o = rpc.on(ph)(input); }());
+}
+
+TEST_CASE("Rate limit delayed admission test", "[rate_limit]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": [
+            {
+                "name": "my_rpc",
+                "rate_limit": { "rate": 10, "burst": 1, "max_queued": 1 }
+            }
+        ],
+        "direction": "out",
+        "proxy": {
+            "type": "echo",
+            "config": {}
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto rpc = engine.define("my_rpc");
+
+    std::string input = "Matthieu Dorier";
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string output = rpc.on(ph)(input);
+    REQUIRE(input == output);
+    // the second request waits for the bucket to refill (100ms)
+    // in the queue instead of being rejected
+    auto t_start = std::chrono::steady_clock::now();
+    output = static_cast<std::string>(rpc.on(ph)(input));
+    auto elapsed = std::chrono::steady_clock::now() - t_start;
+    REQUIRE(input == output);
+    REQUIRE(elapsed >= std::chrono::milliseconds{50});
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    auto& limit = stats["rpcs"]["my_rpc"]["output"]["rate_limit"];
+    REQUIRE(limit["admitted"].get<uint64_t>() == 2);
+    REQUIRE(limit["delayed"].get<uint64_t>() == 1);
+    REQUIRE(limit["rejected"].get<uint64_t>() == 0);
+    REQUIRE(limit["queued"].get<uint64_t>() == 0);
+}
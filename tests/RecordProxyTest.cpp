@@ -0,0 +1,297 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <kage/Backend.hpp>
+#include <nlohmann/json.hpp>
+#include "record/RecordLog.hpp"
+#include "record/RecordReplay.hpp"
+#include <algorithm>
+#include <unistd.h>
+
+class slow_input_provider : public thallium::provider<slow_input_provider> {
+
+    thallium::auto_remote_procedure m_hello;
+
+    public:
+
+    slow_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id)
+    : thallium::provider<slow_input_provider>{engine, provider_id}
+    , m_hello{define("hello", &slow_input_provider::hello)}
+    {}
+
+    // requests named "slow" take 200ms
+    void hello(const thallium::request& req, const std::string& name) {
+        if(name == "slow") thallium::thread::sleep(get_engine(), 200);
+        req.respond("Hello " + name);
+    }
+};
+
+TEST_CASE("RecordProxy test", "[record]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "chain",
+            "config": {
+                "stages": [
+                    {"type": "record", "config": {"path": "kage-record-test.log", "capacity": 65536}},
+                    {"type": "echo", "config": {}}
+                ]
+            }
+        }
+    }
+    )";
+    ENSURE(::unlink("kage-record-test.log"));
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto rpc = engine.define("my_rpc");
+
+    std::string input = "Matthieu Dorier";
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    for(int i = 0; i < 3; ++i) {
+        std::string output = rpc.on(ph)(input);
+        REQUIRE(input == output);
+    }
+
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    auto& record_stats = stats["proxy"]["stages"][0];
+    REQUIRE(record_stats["recorded"] == 3);
+    REQUIRE(record_stats["dropped"] == 0);
+    REQUIRE(::access("kage-record-test.log", F_OK) == 0);
+
+    // records are complete as soon as they are appended,
+    // so the log can be read while the provider is running
+    std::vector<std::string> inputs, outputs;
+    {
+        kage::RecordLogReader log{"kage-record-test.log"};
+        log.forEach([&](const kage::RecordHeader& record) {
+            REQUIRE(record.rpc_id == rpc.id());
+            inputs.emplace_back(record.input(), record.input_size);
+            outputs.emplace_back(record.output(), record.output_size);
+        });
+    }
+    REQUIRE(inputs.size() == 3);
+    for(size_t i = 0; i < 3; ++i) {
+        REQUIRE(inputs[i] == outputs[i]);
+        // payloads are thallium-serialized strings: size, then characters
+        REQUIRE(inputs[i].size() == sizeof(uint64_t) + input.size());
+        REQUIRE(inputs[i].substr(sizeof(uint64_t)) == input);
+    }
+}
+
+TEST_CASE("RecordProxy unanswered request test", "[record]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "chain",
+            "config": {
+                "stages": [
+                    {"type": "record", "config": {"path": "kage-record-fail-test.log", "capacity": 65536}},
+                    {"type": "echo", "config": {"fail": true}}
+                ]
+            }
+        }
+    }
+    )";
+    ENSURE(::unlink("kage-record-fail-test.log"));
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto rpc = engine.define("my_rpc");
+
+    std::string input = "Matthieu Dorier";
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    REQUIRE_THROWS([&]() { std::string o = rpc.on(ph)(input); }());
+
+    // the request is recorded even though the next stage failed
+    size_t num_records = 0;
+    kage::RecordLogReader log{"kage-record-fail-test.log"};
+    log.forEach([&](const kage::RecordHeader& record) {
+        REQUIRE(record.rpc_id == rpc.id());
+        REQUIRE(std::string{record.input() + sizeof(uint64_t),
+                            record.input_size - sizeof(uint64_t)} == input);
+        REQUIRE(record.output_size == 0);
+        num_records += 1;
+    });
+    REQUIRE(num_records == 1);
+}
+
+TEST_CASE("RecordProxy one-way request test", "[record]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": [{"name": "my_rpc", "one_way": true}],
+        "direction": "out",
+        "proxy": {
+            "type": "chain",
+            "config": {
+                "stages": [
+                    {"type": "record", "config": {"path": "kage-record-one-way-test.log", "capacity": 65536}},
+                    {"type": "echo", "config": {}}
+                ]
+            }
+        }
+    }
+    )";
+    ENSURE(::unlink("kage-record-one-way-test.log"));
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto rpc = engine.define("my_rpc");
+
+    std::string input = "Matthieu Dorier";
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    rpc.on(ph)(input);
+
+    // the request is recorded once, without its output,
+    // even though the echo backend answers it anyway
+    size_t num_records = 0;
+    kage::RecordLogReader log{"kage-record-one-way-test.log"};
+    log.forEach([&](const kage::RecordHeader& record) {
+        REQUIRE(record.rpc_id == rpc.id());
+        REQUIRE(record.output_size == 0);
+        num_records += 1;
+    });
+    REQUIRE(num_records == 1);
+}
+
+TEST_CASE("kage-replay test", "[record]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "chain",
+            "config": {
+                "stages": [
+                    {"type": "record", "config": {"path": "kage-replay-test.log", "capacity": 65536}},
+                    {"type": "echo", "config": {}}
+                ]
+            }
+        }
+    }
+    )";
+    ENSURE(::unlink("kage-replay-test.log"));
+    auto rpc = engine.define("my_rpc");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::vector<std::string> names = {"Matthieu", "Philip", "Rob"};
+    {
+        kage::Provider provider(engine, 42, "kage", provider_config);
+        for(auto& name : names) {
+            std::string output = rpc.on(ph)(name);
+            REQUIRE(output == name);
+        }
+    }
+
+    // replay the log against an echo backend, as kage-replay -b does
+    auto backend = kage::ProxyFactory::createProxy(
+        nlohmann::json{{"type", "echo"}, {"config", nlohmann::json::object()}},
+        engine, engine.get_handler_pool());
+    thallium::mutex mutex;
+    std::vector<std::string> replayed;
+    std::vector<hg_id_t> replayed_ids;
+    kage::RecordLogReader log{"kage-replay-test.log"};
+    auto report = kage::ReplayLog(engine, log, 100.0,
+        [&](const kage::RecordHeader& record) {
+            kage::RequestContext context;
+            std::string output;
+            auto result = backend->forwardOutput(
+                record.rpc_id, record.input(), record.input_size,
+                [&output](const char* data, size_t size) { output.assign(data, size); },
+                context);
+            std::unique_lock<thallium::mutex> lock{mutex};
+            replayed_ids.push_back(record.rpc_id);
+            replayed.push_back(output.substr(sizeof(uint64_t)));
+            return result.success();
+        });
+    backend->destroy();
+
+    REQUIRE(report["requests"].get<uint64_t>() == names.size());
+    REQUIRE(report["errors"].get<uint64_t>() == 0);
+    for(auto id : replayed_ids) REQUIRE(id == rpc.id());
+    std::sort(replayed.begin(), replayed.end());
+    REQUIRE(replayed == names);
+}
+
+TEST_CASE("kage-replay overlapping requests test", "[record]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "inout",
+        "proxy": {
+            "type": "chain",
+            "config": {
+                "stages": [
+                    {"type": "record", "config": {"path": "kage-replay-overlap-test.log", "capacity": 65536}},
+                    {"type": "passthrough", "config": {}}
+                ]
+            }
+        }
+    }
+    )";
+    ENSURE(::unlink("kage-replay-overlap-test.log"));
+
+    auto input_provider = new slow_input_provider{engine, 33};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    auto hello = engine.define("hello");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    {
+        kage::Provider provider{
+            engine, 42, "kage", provider_config,
+            thallium::provider_handle{engine.self(), 33}};
+        // the slow request arrives first and completes last
+        std::string slow_output;
+        auto slow_ult = engine.get_handler_pool().make_thread([&]() {
+            slow_output = static_cast<std::string>(hello.on(ph)(std::string{"slow"}));
+        });
+        thallium::thread::sleep(engine, 20);
+        std::string fast_output = hello.on(ph)(std::string{"fast"});
+        slow_ult->join();
+        REQUIRE(slow_output == "Hello slow");
+        REQUIRE(fast_output == "Hello fast");
+    }
+
+    auto payload = [](const kage::RecordHeader& record) {
+        return std::string{record.input() + sizeof(uint64_t),
+                           record.input_size - sizeof(uint64_t)};
+    };
+    kage::RecordLogReader log{"kage-replay-overlap-test.log"};
+    std::vector<std::string> logged;
+    log.forEach([&](const kage::RecordHeader& record) { logged.push_back(payload(record)); });
+    REQUIRE(logged == std::vector<std::string>{"fast", "slow"});
+
+    // the replay follows the arrival order, without waiting
+    // for a bogus offset computed from the log order
+    thallium::mutex mutex;
+    std::vector<std::string> replayed;
+    auto report = kage::ReplayLog(engine, log, 1.0,
+        [&](const kage::RecordHeader& record) {
+            std::unique_lock<thallium::mutex> lock{mutex};
+            replayed.push_back(payload(record));
+            return true;
+        });
+    REQUIRE(report["requests"].get<uint64_t>() == 2);
+    REQUIRE(report["errors"].get<uint64_t>() == 0);
+    REQUIRE(report["elapsed_s"].get<double>() < 1.0);
+    REQUIRE(replayed == std::vector<std::string>{"slow", "fast"});
+}
@@ -0,0 +1,100 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <vector>
+
+static nlohmann::json waitForShadows(thallium::engine& engine,
+                                     kage::Provider& provider,
+                                     size_t count) {
+    auto stats = nlohmann::json::parse(provider.getStatistics());
+    for(int i = 0; i < 200; ++i) {
+        if(stats["proxy"]["shadow"]["latency"]["count"].get<size_t>() >= count) break;
+        thallium::thread::sleep(engine, 5);
+        stats = nlohmann::json::parse(provider.getStatistics());
+    }
+    return stats;
+}
+
+TEST_CASE("TeeProxy test", "[tee]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "tee",
+            "config": {
+                "primary": {"type": "echo", "config": {}},
+                "shadow": {"type": "echo", "config": {}},
+                "max_queued": 4
+            }
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto rpc = engine.define("my_rpc");
+
+    std::string input = "Matthieu Dorier";
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string output = rpc.on(ph)(input);
+    REQUIRE(input == output);
+
+    auto stats = waitForShadows(engine, provider, 1);
+    auto& tee_stats = stats["proxy"];
+    REQUIRE(tee_stats["primary"]["latency"]["count"] == 1);
+    REQUIRE(tee_stats["shadow"]["latency"]["count"] == 1);
+    REQUIRE(tee_stats["shadow"]["matches"] == 1);
+    REQUIRE(tee_stats["shadow"]["dropped"] == 0);
+}
+
+TEST_CASE("TeeProxy concurrent shadows test", "[tee]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["my_rpc"],
+        "direction": "out",
+        "proxy": {
+            "type": "tee",
+            "config": {
+                "primary": {"type": "echo", "config": {}},
+                "shadow": {"type": "echo", "config": {"delay_ms": 200}},
+                "max_queued": 8,
+                "max_in_flight": 4
+            }
+        }
+    }
+    )";
+    kage::Provider provider(engine, 42, "kage", provider_config);
+
+    auto rpc = engine.define("my_rpc");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+
+    auto t_start = std::chrono::steady_clock::now();
+    for(int i = 0; i < 4; ++i) {
+        std::string input = "request " + std::to_string(i);
+        std::string output = rpc.on(ph)(input);
+        REQUIRE(input == output);
+    }
+    auto stats = waitForShadows(engine, provider, 4);
+    auto elapsed = std::chrono::steady_clock::now() - t_start;
+
+    auto& tee_stats = stats["proxy"];
+    REQUIRE(tee_stats["shadow"]["latency"]["count"] == 4);
+    REQUIRE(tee_stats["shadow"]["matches"] == 4);
+    REQUIRE(tee_stats["shadow"]["dropped"] == 0);
+    // the four shadow requests are in flight together:
+    // about 200ms instead of 800ms one after the other
+    REQUIRE(elapsed < std::chrono::milliseconds{600});
+}
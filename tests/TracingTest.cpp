@@ -0,0 +1,88 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_all.hpp>
+#include "Ensure.hpp"
+#include <thallium/serialization/stl/string.hpp>
+#include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
+#include <fstream>
+#include <set>
+
+class my_input_provider : public thallium::provider<my_input_provider> {
+
+    thallium::auto_remote_procedure m_hello;
+
+    public:
+
+    my_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id)
+    : thallium::provider<my_input_provider>{engine, provider_id}
+    , m_hello{define("hello", &my_input_provider::hello)}
+    {}
+
+    void hello(const thallium::request& req, const std::string& name) {
+        std::string result = "Hello " + name;
+        req.respond(result);
+    }
+};
+
+TEST_CASE("Tracing test", "[tracing]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "inout",
+        "tracing": {
+            "path": "kage-tracing-test.json",
+            "format": "chrome",
+            "sample_rate": 1.0,
+            "flush_interval_ms": 10
+        },
+        "proxy": {
+            "type": "passthrough",
+            "config": {}
+        }
+    }
+    )";
+
+    auto input_provider = new my_input_provider{engine, 33};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    {
+        kage::Provider provider{
+            engine, 42, "kage", provider_config,
+            thallium::provider_handle{engine.self(), 33}
+        };
+
+        auto hello = engine.define("hello");
+
+        std::string input = "Matthieu Dorier";
+        auto ph = thallium::provider_handle{engine.self(), 42};
+        std::string output = hello.on(ph)(input);
+        REQUIRE(output == "Hello Matthieu Dorier");
+
+        auto stats = nlohmann::json::parse(provider.getStatistics());
+        REQUIRE(stats["tracing"]["recorded"].get<uint64_t>() >= 2);
+    }
+
+    // The provider's destruction flushes and closes the trace
+    std::ifstream file{"kage-tracing-test.json"};
+    auto trace = nlohmann::json::parse(file);
+    REQUIRE(trace.is_array());
+    std::set<std::string> trace_ids;
+    size_t spans = 0;
+    for(auto& event : trace) {
+        if(event["ph"] != "X") continue;
+        spans += 1;
+        trace_ids.insert(event["args"]["trace_id"].get<std::string>());
+    }
+    // Output side: "hello" and "forward"; input side: "hello" and "target"
+    REQUIRE(spans == 4);
+    REQUIRE(trace_ids.size() == 1);
+}
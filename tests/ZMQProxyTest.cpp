@@ -8,7 +8,11 @@
 #include "Ensure.hpp"
 #include <thallium/serialization/stl/string.hpp>
 #include <kage/Provider.hpp>
+#include <nlohmann/json.hpp>
 #include <spdlog/spdlog.h>
+#include <zmq.hpp>
+#include "zmq/MessageHeader.hpp"
+#include <cstring>
 
 class my_input_provider : public thallium::provider<my_input_provider> {
 
@@ -30,6 +34,28 @@ class my_input_provider : public thallium::provider<my_input_provider> {
     }
 };
 
+class slow_input_provider : public thallium::provider<slow_input_provider> {
+
+    thallium::auto_remote_procedure m_hello;
+    double                          m_delay_ms;
+
+    public:
+
+    slow_input_provider(
+        thallium::engine engine,
+        uint16_t provider_id,
+        double delay_ms)
+    : thallium::provider<slow_input_provider>{engine, provider_id}
+    , m_hello{define("hello", &slow_input_provider::hello)}
+    , m_delay_ms{delay_ms}
+    {}
+
+    void hello(const thallium::request& req, const std::string& name) {
+        thallium::thread::sleep(get_engine(), m_delay_ms);
+        req.respond("Hello " + name);
+    }
+};
+
 TEST_CASE("ZMQProxy test", "[zmq]") {
     auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
     ENSURE(engine.finalize());
@@ -80,9 +106,10 @@ TEST_CASE("ZMQProxy test", "[zmq]") {
         thallium::provider_handle{engine.self(), 34}
     };
 
-    // sleep a bit to allow the providers to connect to each other
+    // wait for the providers to connect to each other
     // before we start sending things
-    thallium::thread::sleep(engine, 200);
+    REQUIRE(provider1.waitReady(std::chrono::seconds{5}).success());
+    REQUIRE(provider2.waitReady(std::chrono::seconds{5}).success());
 
     // with the setup above, RPCs sent to Kage provider 42 will end up
     // forwarded to my_input_provider 34, and RPCs sent to Kage provider
@@ -102,3 +129,335 @@ TEST_CASE("ZMQProxy test", "[zmq]") {
         REQUIRE(output == "Hello Matthieu Dorier from provider 33");
     }
 }
+
+TEST_CASE("ZMQProxy ordered dispatch test", "[zmq]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+
+    const auto provider_config_1 = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "out",
+        "proxy": {
+            "type": "zmq",
+            "config": {
+                "pub_address": "tcp://*:4565",
+                "sub_address": "tcp://*:4566"
+            }
+        }
+    }
+    )";
+
+    const auto provider_config_2 = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "in",
+        "proxy": {
+            "type": "zmq",
+            "config": {
+                "pub_address": "tcp://localhost:4566",
+                "sub_address": "tcp://localhost:4565",
+                "dispatch": {"key": "payload", "key_offset": 8, "shards": 4}
+            }
+        }
+    }
+    )";
+
+    auto input_provider = new my_input_provider{engine, 34};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    kage::Provider provider1{engine, 42, "kage", provider_config_1};
+
+    kage::Provider provider2{
+        engine, 43, "kage", provider_config_2,
+        thallium::provider_handle{engine.self(), 34}
+    };
+
+    REQUIRE(provider1.waitReady(std::chrono::seconds{5}).success());
+    REQUIRE(provider2.waitReady(std::chrono::seconds{5}).success());
+
+    auto hello = engine.define("hello");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    for(auto input : {"Matthieu", "Dorier", "Matthieu"}) {
+        std::string output = hello.on(ph)(std::string{input});
+        REQUIRE(output == std::string{"Hello "} + input + " from provider 34");
+    }
+
+    auto stats = nlohmann::json::parse(provider2.getStatistics());
+    REQUIRE(stats["proxy"]["dispatch"]["dispatched"] == 3);
+}
+
+TEST_CASE("ZMQProxy chunking test", "[zmq]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+
+    const auto provider_config_1 = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "out",
+        "proxy": {
+            "type": "zmq",
+            "config": {
+                "pub_address": "tcp://*:4575",
+                "sub_address": "tcp://*:4576",
+                "chunking": {"chunk_size": 4096, "max_queued_chunks": 4}
+            }
+        }
+    }
+    )";
+
+    const auto provider_config_2 = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "in",
+        "proxy": {
+            "type": "zmq",
+            "config": {
+                "pub_address": "tcp://localhost:4576",
+                "sub_address": "tcp://localhost:4575",
+                "chunking": {"chunk_size": 4096}
+            }
+        }
+    }
+    )";
+
+    auto input_provider = new my_input_provider{engine, 34};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    kage::Provider provider1{engine, 42, "kage", provider_config_1};
+
+    kage::Provider provider2{
+        engine, 43, "kage", provider_config_2,
+        thallium::provider_handle{engine.self(), 34}
+    };
+
+    REQUIRE(provider1.waitReady(std::chrono::seconds{5}).success());
+    REQUIRE(provider2.waitReady(std::chrono::seconds{5}).success());
+
+    auto hello = engine.define("hello");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string small_input = "Matthieu Dorier";
+    std::string large_input(100000, 'x');
+    std::string large_output = hello.on(ph)(large_input);
+    REQUIRE(large_output == "Hello " + large_input + " from provider 34");
+    std::string small_output = hello.on(ph)(small_input);
+    REQUIRE(small_output == "Hello " + small_input + " from provider 34");
+
+    // the request and its response were both sent in chunks
+    auto stats_1 = nlohmann::json::parse(provider1.getStatistics());
+    auto stats_2 = nlohmann::json::parse(provider2.getStatistics());
+    REQUIRE(stats_1["proxy"]["chunking"]["chunked_messages"] == 1);
+    REQUIRE(stats_1["proxy"]["chunking"]["reassembled_messages"] == 1);
+    REQUIRE(stats_2["proxy"]["chunking"]["chunked_messages"] == 1);
+    REQUIRE(stats_2["proxy"]["chunking"]["reassembled_messages"] == 1);
+    REQUIRE(stats_2["proxy"]["chunking"]["dropped_messages"] == 0);
+}
+
+TEST_CASE("ZMQProxy deadline test", "[zmq]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+
+    const auto provider_config_1 = R"(
+    {
+        "exported_rpcs": [{"name": "hello", "deadline_ms": 50}],
+        "direction": "out",
+        "proxy": {
+            "type": "zmq",
+            "config": {
+                "pub_address": "tcp://*:4585",
+                "sub_address": "tcp://*:4586"
+            }
+        }
+    }
+    )";
+
+    const auto provider_config_2 = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "in",
+        "proxy": {
+            "type": "zmq",
+            "config": {
+                "pub_address": "tcp://localhost:4586",
+                "sub_address": "tcp://localhost:4585"
+            }
+        }
+    }
+    )";
+
+    auto input_provider = new slow_input_provider{engine, 34, 300};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    kage::Provider provider1{engine, 42, "kage", provider_config_1};
+
+    kage::Provider provider2{
+        engine, 43, "kage", provider_config_2,
+        thallium::provider_handle{engine.self(), 34}
+    };
+
+    REQUIRE(provider1.waitReady(std::chrono::seconds{5}).success());
+    REQUIRE(provider2.waitReady(std::chrono::seconds{5}).success());
+
+    // the request gives up at its deadline instead of waiting
+    // for the target, and gets an empty response
+    auto hello = engine.define("hello");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    auto t_start = std::chrono::steady_clock::now();
+    REQUIRE_THROWS([&]() { std::string o = hello.on(ph)(std::string{"Matthieu"}); }());
+    REQUIRE(std::chrono::steady_clock::now() - t_start < std::chrono::milliseconds{250});
+
+    auto stats = nlohmann::json::parse(provider1.getStatistics());
+    REQUIRE(stats["proxy"]["timed_out"] == 1);
+
+    // the response the target eventually sends is dropped
+    for(int i = 0; i < 100 && stats["proxy"]["late_responses"] == 0; ++i) {
+        thallium::thread::sleep(engine, 10);
+        stats = nlohmann::json::parse(provider1.getStatistics());
+    }
+    REQUIRE(stats["proxy"]["late_responses"] == 1);
+}
+
+TEST_CASE("ZMQProxy reassembly limit test", "[zmq]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+
+    const auto provider_config_1 = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "out",
+        "proxy": {
+            "type": "zmq",
+            "config": {
+                "pub_address": "tcp://*:4595",
+                "sub_address": "tcp://*:4596",
+                "chunking": {"chunk_size": 4096}
+            }
+        }
+    }
+    )";
+
+    const auto provider_config_2 = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "in",
+        "proxy": {
+            "type": "zmq",
+            "config": {
+                "pub_address": "tcp://localhost:4596",
+                "sub_address": "tcp://localhost:4595",
+                "chunking": {"chunk_size": 4096, "max_reassembly_bytes": 10000}
+            }
+        }
+    }
+    )";
+
+    auto input_provider = new my_input_provider{engine, 34};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    kage::Provider provider1{engine, 42, "kage", provider_config_1};
+
+    kage::Provider provider2{
+        engine, 43, "kage", provider_config_2,
+        thallium::provider_handle{engine.self(), 34}
+    };
+
+    REQUIRE(provider1.waitReady(std::chrono::seconds{5}).success());
+    REQUIRE(provider2.waitReady(std::chrono::seconds{5}).success());
+
+    // the request does not fit in max_reassembly_bytes: the receiver
+    // drops it and answers with an error instead of the target's output
+    auto hello = engine.define("hello");
+    auto ph = thallium::provider_handle{engine.self(), 42};
+    std::string large_input(100000, 'x');
+    REQUIRE_THROWS([&]() { std::string o = hello.on(ph)(large_input); }());
+
+    // smaller requests still go through
+    std::string small_input = "Matthieu Dorier";
+    std::string small_output = hello.on(ph)(small_input);
+    REQUIRE(small_output == "Hello " + small_input + " from provider 34");
+
+    auto stats_2 = nlohmann::json::parse(provider2.getStatistics());
+    REQUIRE(stats_2["proxy"]["chunking"]["dropped_messages"] == 1);
+    REQUIRE(stats_2["proxy"]["chunking"]["reassembled_messages"] == 0);
+    REQUIRE(stats_2["proxy"]["chunking"]["expired_messages"] == 0);
+}
+
+TEST_CASE("ZMQProxy reassembly idle timeout test", "[zmq]") {
+    auto engine = thallium::engine("na+sm", THALLIUM_SERVER_MODE);
+    ENSURE(engine.finalize());
+
+    const auto provider_config = R"(
+    {
+        "exported_rpcs": ["hello"],
+        "direction": "in",
+        "proxy": {
+            "type": "zmq",
+            "config": {
+                "pub_address": "tcp://*:4597",
+                "sub_address": "tcp://*:4598",
+                "chunking": {"chunk_size": 1000, "reassembly_timeout_ms": 300}
+            }
+        }
+    }
+    )";
+
+    auto input_provider = new my_input_provider{engine, 34};
+    engine.push_finalize_callback([input_provider]() { delete input_provider; });
+
+    kage::Provider provider{
+        engine, 43, "kage", provider_config,
+        thallium::provider_handle{engine.self(), 34}
+    };
+
+    // play the remote's part with a raw socket, to control
+    // the time at which each chunk is sent
+    zmq::context_t context{1};
+    zmq::socket_t pub_socket{context, zmq::socket_type::pub};
+    pub_socket.connect("tcp://localhost:4598");
+    thallium::thread::sleep(engine, 300);
+
+    // a one-way request whose payload is a serialized string of 8000 bytes
+    std::string payload(8000, 'x');
+    uint64_t length = payload.size() - sizeof(uint64_t);
+    std::memcpy(payload.data(), &length, sizeof(length));
+    MessageHeader header{};
+    header.rpc_id     = engine.define("hello").id();
+    header.is_forward = true;
+    header.one_way    = true;
+    header.total_size = payload.size();
+    auto send_chunk = [&](uint64_t message_id, size_t offset) {
+        header.message_id   = message_id;
+        header.chunk_offset = offset;
+        zmq::message_t msg{sizeof(header) + 1000};
+        std::memcpy(msg.data(), &header, sizeof(header));
+        std::memcpy(static_cast<char*>(msg.data()) + sizeof(header), payload.data() + offset, 1000);
+        pub_socket.send(msg, zmq::send_flags::none);
+    };
+    auto get_stats = [&provider]() {
+        return nlohmann::json::parse(provider.getStatistics())["proxy"]["chunking"];
+    };
+
+    // the chunks take 700ms in total, but never more than
+    // 100ms apart, so the message is not expired
+    for(size_t offset = 0; offset < payload.size(); offset += 1000) {
+        if(offset) thallium::thread::sleep(engine, 100);
+        send_chunk(1, offset);
+    }
+    auto stats = get_stats();
+    for(int i = 0; i < 100 && stats["reassembled_messages"] == 0; ++i) {
+        thallium::thread::sleep(engine, 10);
+        stats = get_stats();
+    }
+    REQUIRE(stats["reassembled_messages"] == 1);
+    REQUIRE(stats["expired_messages"] == 0);
+
+    // a sender that stops midway has its message expired
+    send_chunk(2, 0);
+    send_chunk(2, 1000);
+    for(int i = 0; i < 100 && stats["expired_messages"] == 0; ++i) {
+        thallium::thread::sleep(engine, 10);
+        stats = get_stats();
+    }
+    REQUIRE(stats["expired_messages"] == 1);
+    REQUIRE(stats["reassembled_messages"] == 1);
+}
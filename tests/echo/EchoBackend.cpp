@@ -19,14 +19,33 @@ std::string EchoProxy::getConfig() const {
 }
 
 kage::Result<bool> EchoProxy::forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
-                                            const std::function<void(const char*, size_t)>& output_cb) {
+                                            kage::OutputCallback output_cb,
+                                            kage::RequestContext& context) {
     (void)rpc_id;
+    (void)context;
+    // "fail": true simulates an unreachable remote
+    if(m_config.value("fail", false))
+        return kage::Result<bool>{kage::ErrorCode::Transport, "Echo backend configured to fail"};
+    // "delay_ms" simulates a slow remote
+    auto delay_ms = m_config.value("delay_ms", 0.0);
+    if(delay_ms > 0) thallium::thread::sleep(m_engine, delay_ms);
     kage::Result<bool> result;
     result.success() = true;
     output_cb(input, input_size);
     return result;
 }
 
+kage::Result<uint64_t> EchoProxy::ping(uint64_t timeout_ns) {
+    (void)timeout_ns;
+    kage::Result<uint64_t> result;
+    result.value() = 0;
+    if(m_config.value("fail", false)) {
+        result.success() = false;
+        result.error() = "Echo backend configured to fail";
+    }
+    return result;
+}
+
 void EchoProxy::setInputProxy(kage::InputProxy proxy) {
     m_input_proxy = std::move(proxy);
 }
@@ -19,8 +19,9 @@ std::string PassThroughProxy::getConfig() const {
 }
 
 kage::Result<bool> PassThroughProxy::forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
-                                                   const std::function<void(const char*, size_t)>& output_cb) {
-    return m_input_proxy.forwardInput(rpc_id, input, input_size, output_cb);
+                                                   kage::OutputCallback output_cb,
+                                                   kage::RequestContext& context) {
+    return m_input_proxy.forwardInput(rpc_id, input, input_size, output_cb, context);
 }
 
 void PassThroughProxy::setInputProxy(kage::InputProxy proxy) {
@@ -60,7 +60,8 @@ class PassThroughProxy : public kage::Backend {
      * @see Backend::forward
      */
     kage::Result<bool> forwardOutput(hg_id_t rpc_id, const char* input, size_t input_size,
-                                     const std::function<void(const char*, size_t)>& output_cb) override;
+                                     kage::OutputCallback output_cb,
+                                     kage::RequestContext& context) override;
 
     /**
      * @see Backend::setInputProxy